@@ -23,6 +23,12 @@
 #include <modglue/pipe.hh>
 #include <modglue/process.hh>
 #include <fstream>
+#include <iomanip>
+#include <map>
+#include <cstdlib>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
 #include <gtkmm/messagedialog.h>
 #include <gtkmm/main.h>
 #include <stdexcept>
@@ -143,6 +149,13 @@ TeXEngine::~TeXEngine()
 TeXEngine::TeXEngine()
 	: horizontal_pixels_(800), font_size_(12)
 	{
+	// Without a usable ~/.xcadabra_cache we simply run uncached.
+	const char *home=getenv("HOME");
+	if(home!=0) {
+		cache_dir_=std::string(home)+"/.xcadabra_cache";
+		if(mkdir(cache_dir_.c_str(), 0700)!=0 && errno!=EEXIST)
+			cache_dir_="";
+		}
 	}
 
 void TeXEngine::set_geometry(int horpix)
@@ -215,22 +228,140 @@ void TeXEngine::convert_one(TeXRequest *req)
 	convert_set(reqset);
 	}
 
-void TeXEngine::convert_set(std::set<TeXRequest *>& reqs)
+std::string TeXEngine::hash(const std::string& str)
 	{
-	// We now follow
-	// 
-	// https://www.securecoding.cert.org/confluence/display/seccode/FI039-C.+Create+temporary+files+securely
-	// 
-	// for temporary files.
+	// 64-bit FNV-1a; the length is appended to make collisions even less likely.
+	unsigned long long h=14695981039346656037ULL;
+	for(size_t i=0; i<str.size(); ++i) {
+		h^=static_cast<unsigned char>(str[i]);
+		h*=1099511628211ULL;
+		}
+	std::ostringstream ss;
+	ss << std::hex << std::setw(16) << std::setfill('0') << h << std::dec << "-" << str.size();
+	return ss.str();
+	}
 
-	char olddir[1024];
-	if(getcwd(olddir, 1023)==NULL)
-		 olddir[0]=0;
-	if(chdir("/tmp")==-1)
-		throw TeXException("Failed to chdir to /tmp.");
+std::string TeXEngine::preamble(double horizontal_mm, double vertical_mm) const
+	{
+	std::ostringstream total;
+	total << "\\documentclass[12pt]{article}\n"
+			<< "\\usepackage[dvips,verbose,voffset=0pt,hoffset=0pt,textwidth="
+			<< horizontal_mm << "mm,textheight="
+			<< vertical_mm << "mm]{geometry}\n"
+			<< "\\usepackage{color}\\usepackage{amssymb}\n"
+			<< "\\usepackage[parfill]{parskip}\n\\usepackage{tableaux}\n";
 
-	char templ[]="/tmp/cdbXXXXXX";
+	for(size_t i=0; i<latex_packages.size(); ++i)
+		total << "\\usepackage{" << latex_packages[i] << "}\n";
+
+	total	<< "\\def\\specialcolon{\\mathrel{\\mathop{:}}\\hspace{-.5em}}\n"
+			<< "\\renewcommand{\\bar}[1]{\\overline{#1}}\n";
+	return total.str();
+	}
+
+std::string TeXEngine::page(const TeXRequest *req) const
+	{
+	std::ostringstream total;
+	if(req->latex_string.size()>100000)
+		total << "Expression too long, output suppressed.\n";
+	else {
+		if(req->start_wrap.size()>0) 
+			total << req->start_wrap;
+		total << req->latex_string;
+		if(req->end_wrap.size()>0)
+			total << "\n" << req->end_wrap;
+		else total << "\n";
+		}
+	total << "\\eject\n";
+	return total.str();
+	}
+
+bool TeXEngine::load_cached(TeXRequest *req, const std::string& cname) const
+	{
+	std::ifstream tst(cname.c_str());
+	if(!tst.good())
+		return false;
+	try {
+		req->pixbuf = Gdk::Pixbuf::create_from_file(cname);
+		}
+	catch(Glib::Error& ex) {
+		// Unreadable entry, e.g. left behind by a full disk; generate it again.
+		erase_file(cname);
+		return false;
+		}
+	req->needs_generating=false;
+	return true;
+	}
+
+void TeXEngine::store_cached(const std::string& png, const std::string& cname) const
+	{
+	if(cname.size()==0)
+		return;
+
+	// Write under a temporary name first, so that other instances never
+	// pick up a half-written image.
+	std::ostringstream tmpname;
+	tmpname << cname << "." << getpid();
+	std::ifstream in(png.c_str(), std::ios::binary);
+	std::ofstream out(tmpname.str().c_str(), std::ios::binary);
+	out << in.rdbuf();
+	out.close();
+	if(!out || rename(tmpname.str().c_str(), cname.c_str())!=0)
+		erase_file(tmpname.str());
+	}
+
+std::string TeXEngine::format_for(const std::string& pre)
+	{
+#ifdef __CYGWIN__
+	// MikTeX handles -ini and -fmt differently; just load the preamble every time.
+	return "";
+#endif
+	if(cache_dir_.size()==0)
+		return "";
+
+	const std::string name=hash(pre);
+	const std::string base=cache_dir_+"/"+name;
+	if(failed_formats_.find(base)!=failed_formats_.end())
+		return "";
+	std::ifstream tst((base+".fmt").c_str());
+	if(tst.good())
+		return base;
+
+	// Dump a format containing LaTeX itself plus all packages and definitions of
+	// the preamble, so that later runs only need to typeset the pages.
+	std::ofstream ltx((base+".ltx").c_str());
+	ltx << pre << "\\dump\n";
+	ltx.close();
+
+	bool ok=ltx.good();
+	std::string result;
+	if(ok) {
+		modglue::child_process ini_proc("latex");
+		ini_proc << "-ini" << "--interaction" << "nonstopmode"
+					<< "-output-directory="+cache_dir_ << "-jobname="+name
+					<< "&latex" << base+".ltx";
+		try {
+			ini_proc.call("", result);
+			}
+		catch(std::logic_error& ex) {
+			ok=false;
+			}
+		}
+	erase_file(base+".ltx");
+	erase_file(base+".log");
+
+	// Errors in the preamble (typically a missing package) leave a useless format;
+	// the normal run without it will report them properly.
+	if(!ok || result.find("\n!")!=std::string::npos) {
+		erase_file(base+".fmt");
+		failed_formats_.insert(base);
+		return "";
+		}
+	return base;
+	}
 
+void TeXEngine::convert_set(std::set<TeXRequest *>& reqs)
+	{
 	// The size in mm or inches which we use will in the end determine how large
 	// the font will come out. 
 	//
@@ -249,44 +380,64 @@ void TeXEngine::convert_set(std::set<TeXRequest *>& reqs)
 	//(int)(millimeter_per_inch*horizontal_pixels/100.0); //140;
 	const double vertical_mm=10*horizontal_mm;
 
+	std::ostringstream resspec;
+	resspec << horizontal_pixels_/(1.0*horizontal_mm)*millimeter_per_inch;
+	const std::string pre=preamble(horizontal_mm, vertical_mm);
+
+	// Images are cached on disk under a hash of everything which determines
+	// their content. Requests which are found there are done; only the
+	// remaining ones go through LaTeX and dvipng.
+
+	std::set<TeXRequest *>              todo;
+	std::map<TeXRequest *, std::string> cache_names;
+	std::set<TeXRequest *>::iterator reqit=reqs.begin();
+	while(reqit!=reqs.end()) {
+		if((*reqit)->needs_generating) {
+			std::string cname;
+			if(cache_dir_.size()>0)
+				cname=cache_dir_+"/"+hash(pre+resspec.str()+"\n"+page(*reqit))+".png";
+			if(cname.size()==0 || !load_cached(*reqit, cname)) {
+				todo.insert(*reqit);
+				cache_names[*reqit]=cname;
+				}
+			}
+		++reqit;
+		}
+	if(todo.size()==0)
+		return;
+
+	// We now follow
+	// 
+	// https://www.securecoding.cert.org/confluence/display/seccode/FI039-C.+Create+temporary+files+securely
+	// 
+	// for temporary files.
+
+	char olddir[1024];
+	if(getcwd(olddir, 1023)==NULL)
+		 olddir[0]=0;
+	if(chdir("/tmp")==-1)
+		throw TeXException("Failed to chdir to /tmp.");
+
+	char templ[]="/tmp/cdbXXXXXX";
 
 	// Write each string in the set of requests into a buffer, separating
-	// them by a page eject.
+	// them by a page eject. If a precompiled format for the preamble is
+	// available, the buffer starts directly at \begin{document}.
+
+	const std::string fmt=format_for(pre);
 
 	std::ostringstream total;
 	int fd = mkstemp(templ);
 	if(fd == -1) 
 		 throw TeXException("Failed to create temporary file in /tmp.");
 
-	total << "\\documentclass[12pt]{article}\n"
-			<< "\\usepackage[dvips,verbose,voffset=0pt,hoffset=0pt,textwidth="
-			<< horizontal_mm << "mm,textheight="
-			<< vertical_mm << "mm]{geometry}\n"
-			<< "\\usepackage{color}\\usepackage{amssymb}\n"
-			<< "\\usepackage[parfill]{parskip}\n\\usepackage{tableaux}\n";
-
-	for(size_t i=0; i<latex_packages.size(); ++i)
-		total << "\\usepackage{" << latex_packages[i] << "}\n";
+	if(fmt.size()==0)
+		total << pre;
+	total	<< "\\begin{document}\n\\pagestyle{empty}\n";
 
-	total	<< "\\def\\specialcolon{\\mathrel{\\mathop{:}}\\hspace{-.5em}}\n"
-			<< "\\renewcommand{\\bar}[1]{\\overline{#1}}\n"
-			<< "\\begin{document}\n\\pagestyle{empty}\n";
-
-	std::set<TeXRequest *>::iterator reqit=reqs.begin();
-	while(reqit!=reqs.end()) {
-		if((*reqit)->needs_generating) {
-			if((*reqit)->latex_string.size()>100000)
-				total << "Expression too long, output suppressed.\n";
-			else {
-				if((*reqit)->start_wrap.size()>0) 
-					total << (*reqit)->start_wrap;
-				total << (*reqit)->latex_string;
-				if((*reqit)->end_wrap.size()>0)
-					total << "\n" << (*reqit)->end_wrap;
-				else total << "\n";
-				}
-			total << "\\eject\n";
-			}
+	reqit=todo.begin();
+	while(reqit!=todo.end()) {
+		total << page(*reqit);
 		++reqit;
 		}
 	total << "\\end{document}\n";
@@ -324,6 +475,8 @@ void TeXEngine::convert_set(std::set<TeXRequest *>& reqs)
 	// Run LaTeX on the .tex file.
 
 	modglue::child_process latex_proc("latex");
+	if(fmt.size()>0)
+		latex_proc << "-fmt="+fmt;
 	latex_proc << "--interaction" << "nonstopmode" << nf;
 	std::string result;
 	try {
@@ -346,6 +499,8 @@ void TeXEngine::convert_set(std::set<TeXRequest *>& reqs)
 				 throw TeXException(err+" (and cannot chdir back to original "+olddir+")");
 			 throw TeXException(err); 
 			 }
+		if(fmt.size()>0 && result.find("format file error")!=std::string::npos)
+			throw std::logic_error("Unusable format file.");
 		}
 	catch(std::logic_error& err) {
 		erase_file(std::string(templ)+".tex");
@@ -354,6 +509,17 @@ void TeXEngine::convert_set(std::set<TeXRequest *>& reqs)
 		erase_file(std::string(templ)+".log");
 		
 		std::string latex_err=handle_latex_errors(result);
+		if(latex_err.size()==0 && fmt.size()>0) {
+			// The format may have been written by a different version of TeX;
+			// drop it and try once more with the full preamble.
+			erase_file(fmt+".fmt");
+			failed_formats_.insert(fmt);
+			if(chdir(olddir)==-1)
+				throw TeXException("Failed to chdir back to " +std::string(olddir)+".");
+			convert_set(reqs);
+			return;
+			}
+
 		reqit=reqs.begin();
 		while(reqit!=reqs.end()) 
 			(*reqit++)->needs_generating=false;
@@ -374,7 +540,6 @@ void TeXEngine::convert_set(std::set<TeXRequest *>& reqs)
 	// Convert the entire dvi file to png files.
 	//
 	modglue::child_process dvipng_proc("dvipng");
-	std::ostringstream rgbspec, resspec;
 	dvipng_proc << "-T" << "tight" << "-bg" << "Transparent"; // << "-fg";
 //	rgbspec << "\"rgb "
 //			  << foreground_colour.get_red()/65536.0 << " "
@@ -382,7 +547,6 @@ void TeXEngine::convert_set(std::set<TeXRequest *>& reqs)
 //			  << foreground_colour.get_blue()/65536.0 << "\"";
 //	dvipng_proc << rgbspec.str();
 	dvipng_proc << "-D";
-	resspec << horizontal_pixels_/(1.0*horizontal_mm)*millimeter_per_inch;
 	dvipng_proc << resspec.str() << std::string(templ)+".dvi";
 
 	try {
@@ -394,17 +558,15 @@ void TeXEngine::convert_set(std::set<TeXRequest *>& reqs)
 	catch(std::logic_error& ex) {
 		// Erase all dvi and png files and put empty pixbufs into the TeXRequests.
 		erase_file(std::string(templ)+".dvi");
-		reqit=reqs.begin();
+		reqit=todo.begin();
 		int pagenum=1;
-		while(reqit!=reqs.end()) {
-			if((*reqit)->needs_generating) {
-				std::ostringstream pngname;
-				pngname << std::string(templ) << pagenum << ".png";
-				erase_file(pngname.str());
-				(*reqit)->pixbuf = Gdk::Pixbuf::create(Gdk::COLORSPACE_RGB, false, 8, 1, 1);
-				(*reqit)->needs_generating=true;
-				++pagenum;
-				}
+		while(reqit!=todo.end()) {
+			std::ostringstream pngname;
+			pngname << std::string(templ) << pagenum << ".png";
+			erase_file(pngname.str());
+			(*reqit)->pixbuf = Gdk::Pixbuf::create(Gdk::COLORSPACE_RGB, false, 8, 1, 1);
+			(*reqit)->needs_generating=true;
+			++pagenum;
 			++reqit;
 			}
 		if(chdir(olddir)==-1)
@@ -415,22 +577,22 @@ void TeXEngine::convert_set(std::set<TeXRequest *>& reqs)
 
 	erase_file(std::string(templ)+".dvi");
 
-	// Conversion completed successfully, now convert all resulting PNG files to Pixbuf images.
+	// Conversion completed successfully, now convert all resulting PNG files to Pixbuf images
+	// and keep a copy of each in the cache.
 
-	reqit=reqs.begin();
+	reqit=todo.begin();
 	int pagenum=1;
-	while(reqit!=reqs.end()) {
-		if((*reqit)->needs_generating) {
-			std::ostringstream pngname;
-			pngname << std::string(templ) << pagenum << ".png";
-			std::ifstream tst(pngname.str().c_str());
-			if(tst.good()) {
-				(*reqit)->pixbuf = Gdk::Pixbuf::create_from_file(pngname.str());
-				(*reqit)->needs_generating=false;
-				erase_file(pngname.str());
-				}
-			++pagenum;
+	while(reqit!=todo.end()) {
+		std::ostringstream pngname;
+		pngname << std::string(templ) << pagenum << ".png";
+		std::ifstream tst(pngname.str().c_str());
+		if(tst.good()) {
+			(*reqit)->pixbuf = Gdk::Pixbuf::create_from_file(pngname.str());
+			(*reqit)->needs_generating=false;
+			store_cached(pngname.str(), cache_names[*reqit]);
+			erase_file(pngname.str());
 			}
+		++pagenum;
 		++reqit;
 		}
 
@@ -47,6 +47,12 @@ std::string trim(const std::string& s);
 /// If you need to generate images for more than one string, simply
 /// check them all in and then call 'convert_all' before retrieving
 /// the pixbufs.
+///
+/// Generated images are kept in ~/.xcadabra_cache, named by a hash of
+/// the preamble, resolution and LaTeX input, so that re-opening a
+/// notebook does not run LaTeX again for cells which have not changed.
+/// The preamble itself is dumped into a LaTeX format file in the same
+/// directory, which saves loading all packages on every run.
 
 class TeXEngine {
 	public:
@@ -90,10 +96,21 @@ class TeXEngine {
 		int                    horizontal_pixels_;
 		int                    font_size_;
 
+		std::string            cache_dir_;
+		std::set<std::string>  failed_formats_;
+
 		void erase_file(const std::string&) const;
 		void convert_one(TeXRequest*);
 		void convert_set(std::set<TeXRequest *>&);
 
+		/// Helpers for the image cache and the precompiled preamble.
+		static std::string hash(const std::string&);
+		std::string preamble(double horizontal_mm, double vertical_mm) const;
+		std::string page(const TeXRequest *) const;
+		bool        load_cached(TeXRequest *, const std::string& cachename) const;
+		void        store_cached(const std::string& pngname, const std::string& cachename) const;
+		std::string format_for(const std::string& preamble);
+
 		std::string handle_latex_errors(const std::string&) const;
 };
 
@@ -25,8 +25,12 @@
 #include "modules/dummies.hh"
 #include "modules/algebra.hh"
 #include "modules/field_theory.hh"
+#include "settings.hh"
 #include <typeinfo>
 #include <sstream>
+#include <thread>
+#include <exception>
+#include <unordered_map>
 
 stopwatch algorithm::index_sw;
 stopwatch algorithm::get_dummy_sw;
@@ -116,6 +120,11 @@ bool algorithm::is_output_module() const
 	return false;
 	}
 
+std::shared_ptr<algorithm> algorithm::termwise_instance(exptree&, iterator) const
+	{
+	return std::shared_ptr<algorithm>();
+	}
+
 //bool algorithm::can_apply(iterator it) 
 //	{
 //	if(tr.begin(it)!=tr.end(it))
@@ -220,7 +229,8 @@ void algorithm::apply(unsigned int lue, bool multiple, bool until_nochange, bool
 		if(multiple) {
 //			 debugout << "acting with " << *(this_command->name) << " multiple." << std::endl;
 			subtree=actold;
-			apply_recursive(subtree, true, act_at_level, called_by_manipulator, until_nochange);
+			if(act_at_level!=-1 || !apply_termwise_parallel(subtree, until_nochange))
+				apply_recursive(subtree, true, act_at_level, called_by_manipulator, until_nochange);
 			}
 		else {
 //			 debugout << "acting with " << *(this_command->name) << " single." << std::endl;
@@ -401,9 +411,14 @@ bool algorithm::apply_recursive(exptree::iterator& st, bool check_cons, int act_
 	int worked=0;
 	int failed=0;
 
-	long total_number_of_nodes=0;
+	// Progress is only reported when a frontend listens for it, and then only
+	// every few hundred nodes; the size of the tree is computed only when needed.
+	bool report=called_by_manipulator && eo!=0 && eo->output_format==exptree_output::out_xcadabra;
+	long total_number_of_nodes=-1;
 	long processed_number_of_nodes=0;
 
+	hash_cache_scope hcs(this);
+
 	do { // loop which keeps iterating until the expression no longer changes
 		post_order_iterator end;
 		if(act_at_level!=-1) {
@@ -412,7 +427,8 @@ bool algorithm::apply_recursive(exptree::iterator& st, bool check_cons, int act_
 			end=tr.end();
 			}
 		else {
-			total_number_of_nodes=tr.size(cit);
+			total_number_of_nodes=-1;
+			processed_number_of_nodes=0;
 			wit=cit;
 			end=wit;
 			wit.descend_all();
@@ -430,6 +446,12 @@ bool algorithm::apply_recursive(exptree::iterator& st, bool check_cons, int act_
          // If we are at the top node and the algorithm changes the iterator 'start',
 			// we have to propagate that change into 'st'.
 			if(start==st) change_st=true; 
+			if(report && act_at_level==-1 && (++processed_number_of_nodes & 0xff)==0) {
+				if(total_number_of_nodes<0)
+					total_number_of_nodes=tr.size(cit);
+				report_progress((*this_command->name).substr(1, (*this_command->name).size()-2), 
+									 total_number_of_nodes, processed_number_of_nodes, 1);
+				}
 			if(can_apply(start)) {
 //				debugout << "can apply, entry point:" << std::endl;
 //				exptree::print_recursive_treeform(debugout, start);
@@ -442,11 +464,6 @@ bool algorithm::apply_recursive(exptree::iterator& st, bool check_cons, int act_
 				if(act_at_level==-1) {
 					// Because nextone is a post_order_iterator, the increment that follows 
 					// skips straight to the next sibling, not to the next child.
-					processed_number_of_nodes+=tr.size(nextone);
-					if(called_by_manipulator)
-						report_progress((*this_command->name).substr(1,
-																					(*this_command->name).size()-2), 
-											 total_number_of_nodes, processed_number_of_nodes, 1);
 					++nextone;
                //	txtout << "applying at " << *wit->name << " next is " << *nextone->name << std::endl;
 					}
@@ -458,9 +475,10 @@ bool algorithm::apply_recursive(exptree::iterator& st, bool check_cons, int act_
 					}
 				count++;
 				++number_of_calls;
-				std::string www=*wit->name;
 //				txtout << "applying at " << *start->name << std::endl;
 				result_t res=apply(start);
+				if(res!=l_no_action || expression_modified)
+					hash_cache_scope::invalidate();
 //				debugout << "after apply: " << *(start->multiplier) << std::endl;
 //				exptree::print_recursive_treeform(debugout, start);
 //				exptree::print_recursive_treeform(txtout, tr.begin());
@@ -578,6 +596,144 @@ bool algorithm::apply_recursive(exptree::iterator& st, bool check_cons, int act_
 	return atleastoneglobal;
 	}
 
+bool algorithm::apply_termwise_parallel(iterator& st, bool until_nochange)
+	{
+	const Threads *thr=properties::get<Threads>();
+	if(thr==0 || thr->value<2 || *st->name!="\\expression" || tr.begin(st)==tr.end(st))
+		return false;
+	iterator sum=tr.begin(st);
+	if(*sum->name!="\\sum")
+		return false;
+
+	// A few chunks per thread, so that threads which finish early can pick up
+	// the remaining work, but no chunks so small that the copying dominates.
+	const unsigned int min_terms_per_chunk=8;
+	unsigned int terms=tr.number_of_children(sum);
+	unsigned int chunks=std::min(4*thr->value, terms/min_terms_per_chunk);
+	if(chunks<2) 
+		return false;
+
+	// Every chunk gets a private tree with the same structure as the original
+	// expression, and its own instance of the algorithm. Messages are collected
+	// per chunk and written out in chunk order once all threads have finished.
+	struct chunk_t {
+			exptree                    tr;
+			iterator                   sum;
+			std::shared_ptr<algorithm> alg;
+			std::exception_ptr         error;
+			std::ostringstream         messages, forced_messages;
+	};
+	std::vector<chunk_t> work(chunks);
+	sibling_iterator term=tr.begin(sum);
+	for(unsigned int c=0; c<chunks; ++c) {
+		chunk_t& ch=work[c];
+		iterator top=ch.tr.set_head(str_node("\\expression"));
+		ch.alg=termwise_instance(ch.tr, ch.tr.insert_subtree_after(top, this_command));
+		if(!ch.alg) 
+			return false;
+		ch.alg->eo=eo;
+		ch.sum=ch.tr.append_child(top, *sum);
+		unsigned int num=terms/chunks + (c<terms%chunks?1:0);
+		for(unsigned int i=0; i<num; ++i, ++term)
+			ch.tr.append_child(ch.sum, iterator(term));
+		}
+
+	std::atomic<unsigned int> next_chunk(0);
+	auto worker=[&work, &next_chunk, until_nochange](bool own_thread) {
+		std::ostream *remember_txtout=fake_txtout;
+		std::ostream *remember_forcedout=fake_forcedout;
+		unsigned int c;
+		while((c=next_chunk++) < work.size()) {
+			fake_txtout=&work[c].messages;
+			fake_forcedout=&work[c].forced_messages;
+			try {
+				work[c].alg->apply_recursive(work[c].sum, false, -1, false, until_nochange);
+				}
+			catch(...) {
+				work[c].error=std::current_exception();
+				}
+			}
+		fake_txtout=remember_txtout;
+		fake_forcedout=remember_forcedout;
+		if(own_thread)
+			str_node_allocator::release_thread_cache();
+		};
+
+	pools_shared=true;
+	std::vector<std::thread> threads;
+	try {
+		for(unsigned int t=1; t<std::min(thr->value, chunks); ++t)
+			threads.push_back(std::thread(worker, true));
+		}
+	catch(std::system_error&) {
+		// Continue with the threads we managed to start.
+		}
+	worker(false);
+	for(size_t t=0; t<threads.size(); ++t)
+		threads[t].join();
+	pools_shared=false;
+
+	for(unsigned int c=0; c<chunks; ++c) {
+		txtout    << work[c].messages.str();
+		forcedout << work[c].forced_messages.str();
+		}
+
+	bool failed=false;
+	for(unsigned int c=0; c<chunks; ++c) {
+		if(work[c].error)
+			std::rethrow_exception(work[c].error);
+		number_of_calls        +=work[c].alg->number_of_calls;
+		number_of_modifications+=work[c].alg->number_of_modifications;
+		if(work[c].alg->global_success==g_apply_failed)
+			failed=true;
+		else if(work[c].alg->global_success>global_success)
+			global_success=work[c].alg->global_success;
+		}
+	if(failed)
+		global_success=g_apply_failed;
+
+	// Replace the terms with the results, in order. The sums in the chunks were
+	// top nodes, so terms which became zero were only removed from chunks which had
+	// more than two terms left. Finish that here the way propagate_zeroes would
+	// have done on the full sum.
+	tr.erase_children(sum);
+	for(unsigned int c=0; c<chunks; ++c) {
+		if(*work[c].sum->name!="\\sum") { // the chunk was reduced to a single term
+			tr.append_child(sum, work[c].sum);
+			continue;
+			}
+		sibling_iterator res=work[c].tr.begin(work[c].sum);
+		while(res!=work[c].tr.end(work[c].sum)) {
+			tr.append_child(sum, iterator(res));
+			++res;
+			}
+		}
+	sibling_iterator sib=tr.begin(sum);
+	while(sib!=tr.end(sum)) {
+		if(*sib->multiplier==0) sib=tr.erase(sib);
+		else                    ++sib;
+		}
+	terms=tr.number_of_children(sum);
+	if(terms==0) 
+		node_zero(sum);
+	else if(terms==1) {
+		sibling_iterator singlearg=tr.begin(sum);
+		singlearg->fl.bracket=sum->fl.bracket;
+		tr.flatten(sum);
+		tr.erase(sum);
+		}
+	if(tr.begin(st)->is_zero()) {
+		tr.erase_children(tr.begin(st));
+		tr.begin(st)->name=name_set.insert("1").first;
+		}
+
+	if(getenv("CDB_PARANOID")) 
+		if(global_success==g_applied)
+			check_consistency(st);
+
+	return true;
+	}
+
 bool algorithm::prepare_for_modification(bool make_copy)
 	{
 	// Collect iterators pointing to all selected nodes and copy the
@@ -1174,28 +1330,25 @@ void algorithm::print_classify_indices(iterator st) const
 
 // For each iterator in the original map, find the sequential position of the index.
 // That is, the index 'd' has position '3' in A_{a b} C_{c} D_{d}.
-// WARNING: expensive operation.
 //
 void algorithm::fill_index_position_map(iterator prodnode, const index_map_t& im, index_position_map_t& ipm) const
 	{
 	ipm.clear();
+	index_position_map_t all_positions;
+	int current_pos=0;
+	exptree::index_iterator indexit=tr.begin_index(prodnode);
+	while(indexit!=tr.end_index(prodnode)) {
+		all_positions.insert(index_position_map_t::value_type((iterator)(indexit), current_pos));
+		++current_pos;
+		++indexit;
+		}
 	index_map_t::const_iterator imit=im.begin();
 	while(imit!=im.end()) {
-		int current_pos=0;
-		bool found=false;
-		exptree::index_iterator indexit=tr.begin_index(prodnode);
-		while(indexit!=tr.end_index(prodnode)) {
-			if(imit->second==(iterator)(indexit)) {
-				ipm.insert(index_position_map_t::value_type(imit->second, current_pos));
-				found=true;
-				break;
-				}
-			++current_pos;
-			++indexit;
-			}
-		if(!found) 
+		index_position_map_t::const_iterator fnd=all_positions.find(imit->second);
+		if(fnd==all_positions.end())
 			throw consistency_error("Internal error in fill_index_position_map; cannot find index "
 											+ *(imit->first.begin()->name)+".");
+		ipm.insert(*fnd);
 		++imit;
 		}
 	}
@@ -1350,11 +1503,11 @@ void algorithm::classify_indices_up(iterator it, index_map_t& ind_free, index_ma
 		goto loopie;
 		}
 	else if(*par->name=="\\expression") { // reached the top
-		index_sw.stop();
+		if(!pools_shared) index_sw.stop();
 		return;
 		}
 	else if((*par->name).size()>0 && (*par->name)[0]=='@') { // command nodes swallow everything
-		index_sw.stop();
+		if(!pools_shared) index_sw.stop();
 		return;
 		}
 	else if(*par->name=="\\tie") { // tie lists do not care about indices
@@ -1401,11 +1554,86 @@ void algorithm::dumpmap(std::ostream& str, const index_map_t& mp) const
 	str << std::endl;
 	}
 
+// Hashes remembered by algorithm::calc_hash, for the algorithm which runs the
+// current pass of apply_recursive on this thread. Only the nodes for which a
+// hash was asked are stored (terms of sums, factors of products); a later walk
+// over a larger subtree reaches earlier work through those nodes. The hashes
+// are only valid as long as no tree has changed shape since they were stored;
+// 'hash_cache_changes' holds the value of exptree_structure_changes at that time.
+
+namespace {
+	typedef std::unordered_map<const void *, hashval_t> hash_cache_t;
+
+	thread_local hash_cache_t     hash_cache;
+	thread_local unsigned long    hash_cache_changes=0;
+	thread_local const algorithm *hash_cache_owner=0;
+
+	// Clearing costs time proportional to the number of buckets, which stays
+	// large after a big pass, so an empty cache is left alone and a full one
+	// is replaced as a whole.
+	void drop_hashes()
+		{
+		if(!hash_cache.empty())
+			hash_cache_t().swap(hash_cache);
+		hash_cache_changes=exptree_structure_changes;
+		}
+
+	hashval_t cached_hash(exptree::iterator it)
+		{
+		hashval_t ret=(hashval_t)(&(*it->name));
+		if(it.node->first_child==0)
+			return ret;
+
+		hash_cache_t::const_iterator fnd=hash_cache.find(it.node);
+		if(fnd!=hash_cache.end())
+			return fnd->second;
+
+		exptree::sibling_iterator sub=it.begin();
+		while(sub!=it.end()) {
+			ret*=17;
+			ret+=cached_hash(sub);
+			++sub;
+			}
+		return ret;
+		}
+}
+
+algorithm::hash_cache_scope::hash_cache_scope(const algorithm *owner)
+	: previous_owner_(hash_cache_owner)
+	{
+	drop_hashes();
+	hash_cache_owner=owner;
+	}
+
+algorithm::hash_cache_scope::~hash_cache_scope()
+	{
+	drop_hashes();
+	hash_cache_owner=previous_owner_;
+	}
+
+void algorithm::hash_cache_scope::invalidate()
+	{
+	drop_hashes();
+	}
+
+hashval_t algorithm::calc_hash(iterator it) const
+	{
+	if(hash_cache_owner!=this) 
+		return tr.calc_hash(it);
+	if(hash_cache_changes!=exptree_structure_changes)
+		drop_hashes();
+	hashval_t ret=cached_hash(it);
+	if(it.node->first_child!=0)
+		hash_cache.insert(hash_cache_t::value_type(it.node, ret));
+	return ret;
+	}
+
 // This classifies indices top-down, that is, finds the free indices and all dummy 
 // index pairs used in the full subtree below a given node.
 void algorithm::classify_indices(iterator it, index_map_t& ind_free, index_map_t& ind_dummy) const
 	{
-	index_sw.start();
+	if(!pools_shared) index_sw.start();
+
 //	debugout << "   " << *it->name << std::endl;
 	const IndexInherit *inh=properties::get<IndexInherit>(it);
 	if(*it->name=="\\sum" || *it->name=="\\equals") {
@@ -1574,7 +1802,7 @@ void algorithm::classify_indices(iterator it, index_map_t& ind_free, index_map_t
 //	txtout << "ind_free: " << ind_free.size() << std::endl;
 //	txtout << "ind_dummy: " << ind_dummy.size() << std::endl;
 
-	index_sw.stop();
+	if(!pools_shared) index_sw.stop();
 	}
 
 bool algorithm::contains(sibling_iterator from, sibling_iterator to, sibling_iterator arg)
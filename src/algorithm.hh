@@ -29,11 +29,12 @@
 #include "display.hh"
 #include <map>
 
-// These are initiated in main.cc
+// These are initiated in main.cc; the output streams are per thread, so that
+// apply_termwise_parallel can collect the messages of each chunk separately.
 #include <fstream>
-extern std::ostream  *fake_txtout;
+extern thread_local std::ostream  *fake_txtout;
 #define txtout (*fake_txtout)
-extern std::ostream  *fake_forcedout;
+extern thread_local std::ostream  *fake_forcedout;
 #define forcedout (*fake_forcedout)
 extern modglue::opipe texout;
 extern std::ofstream  debugout;
@@ -122,6 +123,12 @@ class algorithm : public active_node {
 
 		virtual bool     is_output_module() const;
 
+		/// Algorithms which act on each term of a sum independently, and never on the
+		/// sum node itself, return a fresh instance of themselves acting on the given
+		/// tree. This enables apply() to process the terms of large sums in several
+		/// threads (see the Threads property).
+		virtual std::shared_ptr<algorithm> termwise_instance(exptree&, iterator) const;
+
 		virtual bool     can_apply(iterator)=0;
 //		virtual bool     can_apply(sibling_iterator, sibling_iterator);
 		// These return their result in the return value
@@ -168,6 +175,13 @@ class algorithm : public active_node {
 		iterator                       previous_expression;
 		bool                           dont_iterate;
 
+		/// Run apply_recursive on chunks of the terms of the sum in the expression 'st'
+		/// in separate threads, each on a private copy, and replace the terms with the
+		/// results.
+		/// Returns false (without touching anything) if this is not possible or
+		/// not worth it.
+		bool     apply_termwise_parallel(iterator& st, bool until_nochange);
+
 		// Index stuff
 		int      index_parity(iterator) const;
 		static bool less_without_numbers(nset_t::iterator, nset_t::iterator);
@@ -250,6 +264,24 @@ class algorithm : public active_node {
 		exptree get_dummy(const list_property *, iterator, iterator) const;
       //@}
 
+		/// Hash of a subtree, equal to exptree::calc_hash. During a pass of
+		/// apply_recursive, the hashes computed by this are remembered, so that
+		/// terms and factors are not re-hashed for every sum or product around 
+		/// them. The remembered hashes are dropped as soon as a tree changes 
+		/// shape, after every call to apply() which modified the tree (which 
+		/// catches names changed in place), and whenever another pass starts or ends.
+		hashval_t calc_hash(iterator) const;
+
+		class hash_cache_scope {
+			public:
+				hash_cache_scope(const algorithm *);
+				~hash_cache_scope();
+
+				static void invalidate();
+			private:
+				const algorithm *previous_owner_;
+		};
+
 	private:
 		void     cancel_modification();
 		void     copy_expression(exptree::iterator) const;
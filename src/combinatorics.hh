@@ -89,14 +89,23 @@ class combinations_base {
 
 		long                       start_, end_, vector_generated_called_;
 		std::vector<int>           current_weight;
+
+		/// Sign of the permutation of block locations in temparr, kept up to date
+		/// while generating. It equals ordersign(temparr) whenever 'full_permutation_'
+		/// is set, i.e. when all blocks are used and each is used only once.
+		int                        current_sign_;
+		bool                       full_permutation_;
+		/// Set this in vector_generated to stop generating further vectors.
+		bool                       stop_;
 	private:
 		bool is_allowed_by_weight_constraints(unsigned int i);
 		bool final_weight_constraints_check() const;
 		void update_weights(unsigned int i);
 		void restore_weights(unsigned int i);
       void nextstep(unsigned int current, unsigned int fromalgehad, unsigned int groupindex, 
-						  std::vector<bool> algehad);
+						  unsigned int groupend);
 
+		std::vector<bool>          algehad_;
 };
 
 template<class T>
@@ -120,7 +129,32 @@ class combinations : public combinations_base<T> {
 		virtual void vector_generated(const std::vector<unsigned int>&);
 
    private:
-		permuted_sets_t storage;
+		permuted_sets_t  storage;
+		std::vector<int> signs;  // location signs of the stored sets, if distinct_values
+		bool             distinct_values;
+};
+
+/// Generates the same sets as combinations<T>, but instead of storing them hands
+/// each one to visit() as soon as it has been generated. The sign passed along is
+/// the sign of the permutation with respect to 'original' (only meaningful when all
+/// blocks are permuted). Returning false from visit() stops the generation.
+
+template<class T>
+class combinations_visitor : public combinations_base<T> {
+	public:
+		combinations_visitor();
+		combinations_visitor(const std::vector<T>&);
+
+		virtual void           clear_results();
+		unsigned int           size() const; // number of sets visited
+
+	protected:
+		virtual bool visit(const std::vector<T>&, int sign)=0;
+		virtual void vector_generated(const std::vector<unsigned int>&);
+
+	private:
+		std::vector<T> current_;
+		unsigned int   visited_;
 };
 
 template<class T>
@@ -295,25 +329,39 @@ T fact(T x)
 
 template<class T>
 combinations_base<T>::combinations_base()
-	: block_length(1), multiple_pick(false), sub_problem_blocksize(0)
+	: block_length(1), multiple_pick(false), sub_problem_blocksize(0), 
+	  current_sign_(1), full_permutation_(false), stop_(false)
    { 
    }
 
 template<class T>
 combinations_base<T>::combinations_base(const std::vector<T>& oa)
-	: block_length(1), original(oa), multiple_pick(false), sub_problem_blocksize(0)
+	: block_length(1), original(oa), multiple_pick(false), sub_problem_blocksize(0),
+	  current_sign_(1), full_permutation_(false), stop_(false)
    { 
    }
 
 template<class T>
 combinations<T>::combinations()
-	: combinations_base<T>()
+	: combinations_base<T>(), distinct_values(false)
 	{
 	}
 
 template<class T>
 combinations<T>::combinations(const std::vector<T>& oa)
-	: combinations_base<T>(oa)
+	: combinations_base<T>(oa), distinct_values(false)
+	{
+	}
+
+template<class T>
+combinations_visitor<T>::combinations_visitor()
+	: combinations_base<T>(), visited_(0)
+	{
+	}
+
+template<class T>
+combinations_visitor<T>::combinations_visitor(const std::vector<T>& oa)
+	: combinations_base<T>(oa), visited_(0)
 	{
 	}
 
@@ -331,16 +379,61 @@ template<class T>
 void combinations<T>::vector_generated(const std::vector<unsigned int>& toadd) 
 	{
 	++this->vector_generated_called_;
+	if(this->vector_generated_called_==0) {
+		// ordersign compares values, so the location sign can only be used
+		// when no two blocks start with the same value.
+		distinct_values=this->full_permutation_;
+		for(unsigned int i=0; distinct_values && i<this->original.size(); i+=this->block_length) 
+			for(unsigned int j=i+this->block_length; j<this->original.size(); j+=this->block_length) 
+				if(this->original[i]==this->original[j]) {
+					distinct_values=false;
+					break;
+					}
+		}
 	if((this->start_==-1 || this->vector_generated_called_ >= this->start_) && 
 		(this->end_==-1   || this->vector_generated_called_ < this->end_)) {
-		std::vector<T> newone(toadd.size()*this->block_length);
+		storage.push_back(std::vector<T>(toadd.size()*this->block_length));
+		std::vector<T>& newone=storage.back();
 		for(unsigned int i=0; i<toadd.size(); ++i) 
 			for(unsigned int bl=0; bl<this->block_length; ++bl) 
 				newone[i*this->block_length+bl]=this->original[toadd[i]*this->block_length+bl];
-		storage.push_back(newone);
+		if(distinct_values)
+			signs.push_back(this->current_sign_);
+		}
+	}
+
+template<class T>
+void combinations_visitor<T>::vector_generated(const std::vector<unsigned int>& toadd) 
+	{
+	++this->vector_generated_called_;
+	if(this->end_!=-1 && this->vector_generated_called_ >= this->end_) {
+		this->stop_=true;
+		return;
+		}
+	if(this->start_==-1 || this->vector_generated_called_ >= this->start_) {
+		current_.resize(toadd.size()*this->block_length);
+		for(unsigned int i=0; i<toadd.size(); ++i) 
+			for(unsigned int bl=0; bl<this->block_length; ++bl) 
+				current_[i*this->block_length+bl]=this->original[toadd[i]*this->block_length+bl];
+		++visited_;
+		if(!visit(current_, this->current_sign_))
+			this->stop_=true;
 		}
 	}
 
+template<class T>
+void combinations_visitor<T>::clear_results()
+	{
+	visited_=0;
+	combinations_base<T>::clear_results();
+	}
+
+template<class T>
+unsigned int combinations_visitor<T>::size() const
+	{
+	return visited_;
+	}
+
 template<class T>
 bool combinations_base<T>::entry_accepted(unsigned int) const
 	{
@@ -379,8 +472,11 @@ void combinations_base<T>::permute(long start, long end)
 		std::sort(this->input_asym[i].begin(), this->input_asym[i].end());
 
    temparr=std::vector<unsigned int>(len/* *block_length*/);
-   std::vector<bool> algehad(original.size()/block_length,false);
-   nextstep(0,0,0,algehad);
+	algehad_.assign(original.size()/block_length,false);
+	current_sign_=1;
+	full_permutation_=(!multiple_pick && len*block_length==original.size());
+	stop_=false;
+   nextstep(0,0,0,sublengths[0]);
 	}
 
 template<class T>
@@ -408,6 +504,7 @@ template<class T>
 void combinations<T>::clear()
 	{
    storage.clear();
+	signs.clear();
 	combinations_base<T>::clear();
 	}
 
@@ -415,6 +512,7 @@ template<class T>
 void combinations<T>::clear_results()
 	{
 	storage.clear();
+	signs.clear();
 	combinations_base<T>::clear_results();
 	}
 
@@ -458,6 +556,8 @@ template<class T>
 int combinations<T>::ordersign(unsigned int num) const
 	{
 	assert(num<storage.size());
+	if(signs.size()==storage.size())
+		return signs[0]*signs[num];
 	return combin::ordersign(storage[0].begin(), storage[0].end(),
 							 storage[num].begin(), storage[num].end(), this->block_length);
 	}
@@ -556,18 +656,16 @@ void combinations_base<T>::restore_weights(unsigned int i)
 
 template<class T>
 void combinations_base<T>::nextstep(unsigned int current, unsigned int lowest_in_group, unsigned int groupindex, 
-										 std::vector<bool> algehad)
+										 unsigned int groupend)
    {
-	unsigned int grouplen=0;
-	for(unsigned int i=0; i<=groupindex; ++i)
-		grouplen+=sublengths[i];
-   if(current==grouplen) { // group is filled
+   if(current==groupend) { // group is filled
 		++groupindex;
 		if(groupindex==sublengths.size()) {
 			if(final_weight_constraints_check())
 				vector_generated(temparr);
 			return;
 			}
+		groupend+=sublengths[groupindex];
 		lowest_in_group=0;
       }
 	
@@ -576,8 +674,8 @@ void combinations_base<T>::nextstep(unsigned int current, unsigned int lowest_in
 		starti=current-current%sub_problem_blocksize;
 		endi=starti+sub_problem_blocksize;
 		}
-   for(unsigned int i=starti; i<endi; i++) {
-		if(!algehad[i] || multiple_pick) {
+   for(unsigned int i=starti; i<endi && !stop_; i++) {
+		if(!algehad_[i] || multiple_pick) {
 			bool discard=false;
 			if(is_allowed_by_weight_constraints(i)) {
 				// handle input_asym
@@ -587,7 +685,7 @@ void combinations_base<T>::nextstep(unsigned int current, unsigned int lowest_in
 							unsigned int k2=kk;
 							while(k2!=0) {
 								--k2;
-								if(!algehad[this->input_asym[k][k2]]) {
+								if(!algehad_[this->input_asym[k][k2]]) {
 //									std::cout << "discarding " << std::endl;
 									discard=true;
 									break;
@@ -601,15 +699,23 @@ void combinations_base<T>::nextstep(unsigned int current, unsigned int lowest_in
 			else discard=true;
 			if(!discard)
 				if(i+1>lowest_in_group) {
-					algehad[i]=true;
+					bool prev=algehad_[i];
+					// Every location already used which lies to the right of 'i'
+					// is an inversion.
+					int sign=current_sign_;
+					if(!multiple_pick) 
+						for(unsigned int j=i+1; j<algehad_.size(); ++j)
+							if(algehad_[j]) current_sign_=-current_sign_;
+					algehad_[i]=true;
 					update_weights(i);
 					temparr[current]=i;
 //					for(unsigned bl=0; bl<block_length; ++bl) 
 //						temparr[current*block_length+bl]=original[i*block_length+bl];
 					if(entry_accepted(current)) {
-						nextstep(current+1, i, groupindex, algehad);
+						nextstep(current+1, i, groupindex, groupend);
 						}
-					algehad[i]=false;
+					algehad_[i]=prev;
+					current_sign_=sign;
 					restore_weights(i);
 					}
 			}
@@ -960,7 +1066,7 @@ void symm_val_helper<T>::vector_generated(const std::vector<unsigned int>& vec)
 				// Take care of the multiplicity & sign.
 				int multiplicity=owner_.multiplicity[i] * current_multiplicity;
 				if(owner_.permutation_sign==-1)
-					multiplicity*=ordersign(vec.begin(), vec.end());
+					multiplicity*=(this->full_permutation_?this->current_sign_:ordersign(vec.begin(), vec.end()));
 				owner_.multiplicity.push_back(multiplicity); //sign==1?true:false);
 				
 				// We now have to find the permuted objects in the larger
@@ -1029,7 +1135,7 @@ void symm_helper<T>::vector_generated(const std::vector<unsigned int>& vec)
 			// Take care of the permutation sign.
 			int multiplicity=owner_.multiplicity[owner_.current_] * current_multiplicity;
 			if(owner_.permutation_sign==-1)
-				multiplicity*=ordersign(vec.begin(), vec.end());
+				multiplicity*=(this->full_permutation_?this->current_sign_:ordersign(vec.begin(), vec.end()));
 			owner_.multiplicity.push_back(multiplicity);
 			
 			for(unsigned int k=0; k<owner_.permute_blocks.size(); ++k) {
@@ -145,8 +145,6 @@ unsigned int exchange::possible_singlets(exptree& tr, exptree::iterator it)
 	else
 		lie.algebra_type=LiE::LiE_t::alg_B;
 	lie.algebra_dim=dims/2;
-	
-	lie.start();
 
 	// Find the representation for each group of tensors, taking into
 	// account their exchange symmetries.
@@ -206,10 +204,7 @@ unsigned int exchange::possible_singlets(exptree& tr, exptree::iterator it)
 		lie.tensor(result, groupreps[i+1], tmpstore);
 		result=tmpstore;
 		}
-	unsigned int retval=lie.multiplicity_of_singlet(result);
-	lie.stop();
-
-	return retval;
+	return lie.multiplicity_of_singlet(result);
 	}
 
 bool exchange::get_node_gs(exptree& tr, exptree::iterator it, std::vector<std::vector<int> >& gs)
@@ -0,0 +1,348 @@
+/*
+
+	Cadabra: a field-theory motivated computer algebra system.
+	Copyright (C) 2001-2011  Kasper Peeters <kasper.peeters@aei.mpg.de>
+
+   This program is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation, either version 3 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "history.hh"
+#include <map>
+#include <set>
+#include <vector>
+#include <unordered_map>
+#include <cassert>
+
+namespace {
+
+// Nodes are encoded as in snapshots (see snapshot.hh), in pre-order, each as
+// name index, multiplier index, flag byte and number of children. The top
+// node of a shared term has no multiplier index; its factor is kept with
+// the step which uses it.
+
+std::vector<nset_t::iterator>                           names;
+std::unordered_map<const std::string *, unsigned long>  name_index;
+std::vector<rset_t::iterator>                           rationals; // keeps the rationals alive
+std::unordered_map<const multiplier_t *, unsigned long> rat_index;
+
+typedef std::unordered_map<std::string, unsigned long> term_pool_t; // term -> number of references
+term_pool_t term_pool;
+size_t      term_references=0;
+
+// The content of a packed step is a sequence of children of the \expression
+// node, each starting with a tag: 't' for a subtree stored in full, 's' for
+// the top node of a sum whose terms live in the term pool.
+
+class packed_step {
+	public:
+		std::string                            content;
+		std::vector<term_pool_t::value_type *> terms;
+		std::vector<unsigned long>             factors;
+};
+
+typedef std::map<unsigned long, packed_step> step_map_t;
+step_map_t    steps;
+unsigned long next_id=1;
+
+const std::string marker("\\packed");
+
+void varint(std::string& out, unsigned long val)
+	{
+	while(val>=0x80) {
+		out+=(char)((val&0x7f)|0x80);
+		val>>=7;
+		}
+	out+=(char)val;
+	}
+
+unsigned long varint(const char *& pos)
+	{
+	unsigned long val=0;
+	unsigned int  shift=0;
+	for(;;) {
+		unsigned char c=*pos++;
+		val|=((unsigned long)(c&0x7f))<<shift;
+		if((c&0x80)==0) break;
+		shift+=7;
+		}
+	return val;
+	}
+
+unsigned long name_number(nset_t::iterator nm)
+	{
+	std::pair<std::unordered_map<const std::string *, unsigned long>::iterator, bool> ins=
+		name_index.insert(std::make_pair(&(*nm), names.size()));
+	if(ins.second)
+		names.push_back(nm);
+	return ins.first->second;
+	}
+
+unsigned long rational_number(rset_t::iterator mult)
+	{
+	std::pair<std::unordered_map<const multiplier_t *, unsigned long>::iterator, bool> ins=
+		rat_index.insert(std::make_pair(&(*mult), rationals.size()));
+	if(ins.second)
+		rationals.push_back(mult);
+	return ins.first->second;
+	}
+
+void encode_node(std::string& out, exptree::iterator it, bool with_multiplier)
+	{
+	varint(out, name_number(it->name));
+	if(with_multiplier)
+		varint(out, rational_number(it->multiplier));
+	out+=(char)it->packed_flags();
+	varint(out, exptree::number_of_children(it));
+	}
+
+void encode(std::string& out, exptree::iterator top, bool with_top_multiplier)
+	{
+	exptree::pre_order_iterator it=top, stop=top;
+	stop.skip_children();
+	++stop;
+	while(it!=stop) {
+		encode_node(out, it, it!=top || with_top_multiplier);
+		++it;
+		}
+	}
+
+// Decode one node; if 'factor' is non-zero, it is used as the multiplier
+// instead of reading one.
+
+str_node decode_node(const char *& pos, const rset_t::iterator *factor, unsigned long& children)
+	{
+	str_node ret(names[varint(pos)]);
+	ret.multiplier=factor?(*factor):rationals[varint(pos)];
+	ret.unpack_flags(*pos++);
+	children=varint(pos);
+	return ret;
+	}
+
+exptree::iterator decode(exptree& tr, exptree::iterator parent, const char *& pos,
+								 const rset_t::iterator *factor)
+	{
+	std::vector<std::pair<exptree::iterator, unsigned long> > todo;
+	unsigned long children;
+
+	exptree::iterator top=tr.append_child(parent, decode_node(pos, factor, children));
+	if(children>0) todo.push_back(std::make_pair(top, children));
+
+	while(todo.size()>0) {
+		exptree::iterator it=tr.append_child(todo.back().first, decode_node(pos, 0, children));
+		if(--todo.back().second==0)
+			todo.pop_back();
+		if(children>0)
+			todo.push_back(std::make_pair(it, children));
+		}
+	return top;
+	}
+
+unsigned long store(exptree::iterator expression)
+	{
+	unsigned long id=next_id++;
+	packed_step& step=steps[id];
+
+	exptree::sibling_iterator sib=expression.begin();
+	while(sib!=expression.end()) {
+		if(*sib->name=="\\sum") {
+			step.content+='s';
+			encode_node(step.content, sib, true);
+			exptree::sibling_iterator term=sib.begin();
+			while(term!=sib.end()) {
+				std::string body;
+				encode(body, term, false);
+				term_pool_t::value_type& entry=*term_pool.insert(std::make_pair(body, 0)).first;
+				++entry.second;
+				step.terms.push_back(&entry);
+				step.factors.push_back(rational_number(term->multiplier));
+				++term;
+				}
+			}
+		else {
+			step.content+='t';
+			encode(step.content, sib, true);
+			}
+		++sib;
+		}
+	term_references+=step.terms.size();
+	return id;
+	}
+
+void release(packed_step& step)
+	{
+	for(size_t i=0; i<step.terms.size(); ++i)
+		if(--step.terms[i]->second==0)
+			term_pool.erase(step.terms[i]->first);
+	term_references-=step.terms.size();
+	}
+
+void mark(exptree& tr, exptree::iterator expression, unsigned long id)
+	{
+	exptree::iterator mk=tr.append_child(expression, str_node(marker));
+	mk->multiplier=rat_set.insert(multiplier_t(id)).first;
+	}
+
+}
+
+void history::pack(exptree& tr, exptree::iterator expression)
+	{
+	if(is_packed(expression)) return;
+	unsigned long id=store(expression);
+	tr.erase_children(expression);
+	mark(tr, expression, id);
+	}
+
+void history::unpack(exptree& tr, exptree::iterator expression)
+	{
+	if(!is_packed(expression)) return;
+
+	// The step itself is left in place, as the marker may have been copied
+	// (e.g. by snapshot::save); sweep() removes it once it is unused.
+	step_map_t::const_iterator sit=steps.find(to_long(*expression.begin()->multiplier));
+	assert(sit!=steps.end());
+	const packed_step& step=sit->second;
+	tr.erase_children(expression);
+
+	const char *pos=step.content.data(), *end=pos+step.content.size();
+	size_t term=0;
+	while(pos!=end) {
+		if(*pos++=='s') {
+			unsigned long children;
+			exptree::iterator sum=tr.append_child(expression, decode_node(pos, 0, children));
+			for(unsigned long i=0; i<children; ++i, ++term) {
+				const char *tpos=step.terms[term]->first.data();
+				decode(tr, sum, tpos, &rationals[step.factors[term]]);
+				}
+			}
+		else decode(tr, expression, pos, 0);
+		}
+	}
+
+bool history::is_packed(exptree::iterator expression)
+	{
+	return exptree::number_of_children(expression)==1 && *expression.begin()->name==marker;
+	}
+
+void history::pack_all(exptree& tr, unsigned int depth)
+	{
+	exptree::sibling_iterator hist=tr.begin();
+	while(hist!=tr.end()) {
+		if(*hist->name=="\\history" && hist.begin()!=hist.end()) {
+			exptree::sibling_iterator last=tr.active_expression(hist);
+			unsigned int num=0;
+			exptree::sibling_iterator ex=hist.begin();
+			while(ex!=last) {
+				if(*ex->name=="\\expression") ++num;
+				++ex;
+				}
+			ex=hist.begin();
+			while(ex!=last) {
+				if(*ex->name=="\\expression") {
+					if(depth>0 && num>depth) {
+						ex=tr.erase(ex);
+						--num;
+						continue;
+						}
+					pack(tr, ex);
+					}
+				++ex;
+				}
+			}
+		++hist;
+		}
+	}
+
+void history::unpack_all(exptree& tr)
+	{
+	exptree::sibling_iterator hist=tr.begin();
+	while(hist!=tr.end()) {
+		if(*hist->name=="\\history") {
+			exptree::sibling_iterator ex=hist.begin();
+			while(ex!=hist.end()) {
+				if(*ex->name=="\\expression")
+					unpack(tr, ex);
+				++ex;
+				}
+			}
+		++hist;
+		}
+	}
+
+void history::sweep(const exptree& tr)
+	{
+	if(steps.size()==0) return;
+
+	std::set<unsigned long> used;
+	exptree::sibling_iterator hist=tr.begin();
+	while(hist!=tr.end()) {
+		if(*hist->name=="\\history") {
+			exptree::sibling_iterator ex=hist.begin();
+			while(ex!=hist.end()) {
+				if(*ex->name=="\\expression" && is_packed(ex))
+					used.insert(to_long(*ex.begin()->multiplier));
+				++ex;
+				}
+			}
+		++hist;
+		}
+
+	step_map_t::iterator sit=steps.begin();
+	while(sit!=steps.end()) {
+		if(used.find(sit->first)==used.end()) {
+			release(sit->second);
+			steps.erase(sit++);
+			}
+		else ++sit;
+		}
+
+	// Once nothing is packed, let go of the names and rationals as well.
+	if(steps.size()==0) {
+		names.clear();
+		name_index.clear();
+		rationals.clear();
+		rat_index.clear();
+		}
+	}
+
+size_t history::number_of_steps()
+	{
+	return steps.size();
+	}
+
+size_t history::number_of_terms()
+	{
+	return term_pool.size();
+	}
+
+size_t history::number_of_term_references()
+	{
+	return term_references;
+	}
+
+size_t history::bytes()
+	{
+	// Approximate: string contents plus the size of the entries, counting three
+	// pointers for every hash table entry.
+	const size_t index_entry=3*sizeof(void *);
+	size_t ret=names.size()*(sizeof(nset_t::iterator)+index_entry)
+		+ rationals.size()*(sizeof(rset_t::iterator)+index_entry);
+	for(term_pool_t::const_iterator it=term_pool.begin(); it!=term_pool.end(); ++it)
+		ret+=sizeof(term_pool_t::value_type)+index_entry+it->first.capacity();
+	for(step_map_t::const_iterator it=steps.begin(); it!=steps.end(); ++it)
+		ret+=sizeof(step_map_t::value_type)+it->second.content.capacity()
+			+ it->second.terms.capacity()*sizeof(term_pool_t::value_type *)
+			+ it->second.factors.capacity()*sizeof(unsigned long);
+	return ret;
+	}
@@ -0,0 +1,74 @@
+/*
+
+	Cadabra: a field-theory motivated computer algebra system.
+	Copyright (C) 2001-2011  Kasper Peeters <kasper.peeters@aei.mpg.de>
+
+   This program is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation, either version 3 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/**
+
+  Compact storage for the steps of an expression history. Every
+  algorithm which does not act in place leaves the previous form of
+  the expression behind as an \\expression node in the \\history (see
+  algorithm::copy_expression). Only the last of these is ever looked
+  at, so all others are packed: their content is encoded into a few
+  bytes per node and replaced by a single \\packed node, which refers
+  to the stored step through its multiplier.
+
+  A sum at the top of an expression is stored term by term, and terms
+  are shared between all packed steps in which they appear (with
+  their numerical factor stored separately). Steps which differ only
+  in a few terms, or in the coefficients of the terms, therefore take
+  little more space than a single copy.
+
+  Packing is done by the manipulator once an input line has been
+  handled completely, as the code handling a line may still refer to
+  earlier steps. Steps are unpacked again when they become the last
+  step of their history, i.e.\ by \@pop. Packed steps which are no
+  longer referenced from the tree are removed by sweep().
+
+*/
+
+#ifndef history_hh_
+#define history_hh_
+
+#include "storage.hh"
+
+class history {
+	public:
+		/// Replace the content of an \\expression node by a reference to a packed copy.
+		static void   pack(exptree&, exptree::iterator expression);
+		/// Restore the content of an \\expression node; does nothing if it is not packed.
+		static void   unpack(exptree&, exptree::iterator expression);
+		static bool   is_packed(exptree::iterator expression);
+
+		/// Pack all but the last step of every history in the tree. If 'depth' is
+		/// non-zero, only that many steps are kept in front of the last one.
+		static void   pack_all(exptree&, unsigned int depth=0);
+		/// Unpack all steps of every history in the tree.
+		static void   unpack_all(exptree&);
+
+		/// Free all packed steps which are not referenced from the tree.
+		static void   sweep(const exptree&);
+
+		/// Statistics for \@mem.
+		static size_t number_of_steps();
+		static size_t number_of_terms();         // distinct terms stored
+		static size_t number_of_term_references();
+		static size_t bytes();
+};
+
+#endif
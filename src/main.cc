@@ -38,6 +38,8 @@
        - props.hh and props.cc
        - exchange.hh and exchange.cc
        - storage.hh and storage.cc
+       - snapshot.hh and snapshot.cc
+       - history.hh and history.cc
  
     Further code is in the src/modules directory.
 */
@@ -46,6 +48,7 @@
 #include "storage.hh"
 #include "props.hh"
 #include "manipulator.hh"
+#include "modules/gamma.hh"
 #include <modglue/main.hh>
 #include <modglue/pipe.hh>
 #include "stopwatch.hh"
@@ -70,9 +73,9 @@ std::ofstream  debugout;
 std::ofstream  nullout("/dev/null",std::ios::app);
 
 std::ostream  *real_txtout;
-std::ostream  *fake_txtout;
+thread_local std::ostream  *fake_txtout;
 std::ostream  *real_forcedout;
-std::ostream  *fake_forcedout;
+thread_local std::ostream  *fake_forcedout;
 #define txtout    (*fake_txtout)
 #define forcedout (*fake_forcedout)
 
@@ -187,6 +190,17 @@ int main(int argc, char **argv)
 		else if(strcmp(argv[i],"--nowarnings")==0) {
 			nowarnings=true;
 			}
+		else if(strcmp(argv[i],"--gamma-tables")==0) {
+			// Tables grow quickly with the number of indices, so only allow small values.
+			char *end=0;
+			long maxind=(i+1<argc)?strtol(argv[i+1], &end, 10):0;
+			if(i+1>=argc || end==argv[i+1] || *end!='\0' || maxind<1 || maxind>8) {
+				std::cerr << "cadabra: --gamma-tables needs a number of indices between 1 and 8." << std::endl;
+				return -1;
+				}
+			++i;
+			join::prebuild(maxind);
+			}
 		else if(strcmp(argv[i],"--help")==0) {
 			std::cout << "Usage: cadabra [options] input\n\n"
 						 << "where [options] can be any of \n"
@@ -201,6 +215,7 @@ int main(int argc, char **argv)
 						 << "   --prompt [string]  : set the prompt string\n"
 						 << "   --silentfail       : do not report errors upon failure\n"
 						 << "   --nowarnings       : disable warnings\n"
+						 << "   --gamma-tables n   : prepare @join{expand} for up to n indices\n"
 						 << "   --help             : this help\n" << std::endl;
 			return -1;
 			}
@@ -26,6 +26,8 @@
 #include "preprocessor.hh"
 #include "settings.hh"
 #include "parser.hh"
+#include "snapshot.hh"
+#include "history.hh"
 #include <stdexcept>
 
 extern std::string defaults;
@@ -46,7 +48,8 @@ manipulator::algo_info::algo_info(std::shared_ptr<algorithm> (*cr)(exptree&, ite
 manipulator::manipulator()
 	: eo(expressions, exptree_output::out_plain), getline_was_eof(0),
 	  editing_equation(0), last_used_equation_number(0), 
-	  utf8_output(getenv("CDB_USE_UTF8")), status_output(false), prompt_string(">")
+	  utf8_output(getenv("CDB_USE_UTF8")), status_output(false), prompt_string(">"),
+	  rat_set_swept_size(0)
 	{
 	properties::register_properties();
 	settings::register_properties();
@@ -219,7 +222,7 @@ manipulator::~manipulator()
 	properties::clear();
 	expressions.clear();
 	name_set.clear();
-	rat_set.clear();
+	rat_set.sweep();
 	}
 
 bool manipulator::is_whitespace_(const std::string& str) const
@@ -553,6 +556,7 @@ void manipulator::handle_input()
 					if(oldeq!=expressions.end() && oldeq!=topit) {
 						topit=expressions.replace(oldeq, topit);
 						expressions.erase(topit);
+						str_node_allocator::trim();
 						}
 					}
 				cleanup_new_expression_(it);
@@ -714,6 +718,19 @@ void manipulator::handle_input()
 			}
 		debugout << "almost done" << std::endl;
 
+		// Pack the earlier steps of all expressions, which nothing refers to
+		// anymore now that the line has been handled (see history.hh).
+		history::sweep(expressions);
+		const KeepHistory *kh=properties::get<KeepHistory>();
+		history::pack_all(expressions, kh?kh->depth:0);
+
+		// Drop rationals which are no longer referenced by any node. The sweep walks
+		// the entire pool, so only do this once the pool has grown substantially.
+		if(rat_set.size() > 2*rat_set_swept_size + 1024) {
+			rat_set.sweep();
+			rat_set_swept_size=rat_set.size();
+			}
+
 		if(streamstack.size()==1) {
 			debugout << "going to print prompt" << std::endl;
 			print_prompt();
@@ -893,6 +910,9 @@ exptree::iterator manipulator::handle_active_nodes_(exptree::iterator original_e
 				}
 			txtout << std::setw(30) << "classify_indices" << "  " << algorithm::index_sw << std::endl;
 			txtout << std::setw(30) << "get_dummy       " << "  " << algorithm::get_dummy_sw << std::endl;
+			txtout << std::setw(30) << "canonicalise gs cache" << "  " 
+					 << std::setw(10) << canonicalise::gs_cache_hits << "  hits, "
+					 << canonicalise::gs_cache_misses << " misses" << std::endl;
 			expressions.erase_expression(original_expression);
 			original_expression=expressions.end();
 			return expressions.end();
@@ -1031,12 +1051,42 @@ exptree::iterator manipulator::handle_active_nodes_(exptree::iterator original_e
 		else if(*it->name=="@reset") {
 			properties::clear();
 			expressions.clear();
+			str_node_allocator::trim();
 			name_set.clear();
-			rat_set.clear();
+			rat_set.sweep();
 			txtout << "All expressions and object properties erased." << std::endl;
 			refill_input_buffer=defaults;
 			return expressions.end();
 			}
+		else if(*it->name=="@save_state" || *it->name=="@load_state") {
+			bool load=(*it->name=="@load_state");
+			std::string filename, error;
+			sibling_iterator nm=expressions.begin(it);
+			if(nm!=expressions.end(it)) {
+				if(nm->is_quoted_string())
+					filename=(*nm->name).substr(1,(*nm->name).size()-2);
+				else
+					filename=*nm->name;
+				}
+			expressions.erase_expression(original_expression);
+			if(filename.size()==0) 
+				txtout << (load?"@load_state":"@save_state") << " needs a file name." << std::endl;
+			else if(load) {
+				if(snapshot::load(filename, expressions, last_used_equation_number, error)) {
+					rat_set.sweep();
+					txtout << "State restored from \"" << filename << "\"." << std::endl;
+					}
+				else
+					txtout << "Cannot restore state: " << error << "." << std::endl;
+				}
+			else {
+				if(snapshot::save(filename, expressions, last_used_equation_number, error))
+					txtout << "State saved to \"" << filename << "\"." << std::endl;
+				else
+					txtout << "Cannot save state: " << error << "." << std::endl;
+				}
+			return expressions.end();
+			}
 		
 		// All the rest is handled externally:
 		if(handle_external_commands_(original_expression, it, expression_to_print))
@@ -47,8 +47,8 @@ extern std::vector<std::string> cmdline_arguments;
 
 // All modules write to txtout, which we can point to whatever stream
 // we like in order to redirect output to files.
-extern std::ostream  *fake_txtout;
-extern std::ostream  *fake_forcedout;
+extern thread_local std::ostream  *fake_txtout;
+extern thread_local std::ostream  *fake_forcedout;
 #define txtout (*fake_txtout)
 #define forcedout (*fake_forcedout)
 
@@ -171,6 +171,7 @@ class manipulator : public sigc::trackable {
 		std::string        goto_label;
 		std::string        bailout_label;
 		std::string        prompt_string;
+		size_t             rat_set_swept_size;
 };
 
 #endif
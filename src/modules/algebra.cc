@@ -32,6 +32,7 @@
 #include "dummies.hh"
 #include "field_theory.hh"
 #include "numerical.hh"
+#include "settings.hh"
 #include "xperm_new.h"
 #include <utility>
 #include <algorithm>
@@ -636,6 +637,11 @@ prodrule::prodrule(exptree& tr, iterator it)
 //  A(b*c)(e*f) 1-> A(b)(e*f)*c + b*A(c)(e*f)
 //  A(b*c)(e*f) 2-> A(b*c)(e)*f + e*A(b*c)(f)
 
+std::shared_ptr<algorithm> prodrule::termwise_instance(exptree& tr_, iterator it_) const
+	{
+	return create<prodrule>(tr_, it_);
+	}
+
 bool prodrule::can_apply(iterator it)
 	{
 	const Derivative *der=properties::get<Derivative>(it);
@@ -844,6 +850,11 @@ distribute::distribute(exptree& tr, iterator it)
 	{
 	}
 
+std::shared_ptr<algorithm> distribute::termwise_instance(exptree& tr_, iterator it_) const
+	{
+	return create<distribute>(tr_, it_);
+	}
+
 bool distribute::can_apply(iterator st)
 	{
 	const Distributable *db=properties::get<Distributable>(st);
@@ -862,96 +873,152 @@ bool distribute::can_apply(iterator st)
 
 algorithm::result_t distribute::apply(iterator& prod)
 	{
+	// Determine the number of terms which the expansion will produce, and
+	// compare with the budget set by the user (if any).
+	std::vector<sibling_iterator> sums, choice;
+	multiplier_t number_of_terms=1;
+	unsigned int number_of_factors=0;
+	sibling_iterator facs=tr.begin(prod);
+	while(facs!=tr.end(prod)) {
+		++number_of_factors;
+		if(*facs->name=="\\sum") {
+			sums.push_back(facs);
+			choice.push_back(tr.begin(facs));
+			number_of_terms*=tr.number_of_children(facs);
+			}
+		++facs;
+		}
+	if(number_of_terms==1) // nothing happens, no sum with more than one term was present
+		return l_applied;
+	if(number_of_terms==0) {
+		node_zero(prod);
+		expression_modified=true;
+		return l_applied;
+		}
+
+	const TermBudget *budget=properties::get<TermBudget>();
+	if(budget && number_of_terms>budget->value) {
+		txtout << "distribute: expanding this product gives " << number_of_terms 
+				 << " terms, more than the TermBudget of " << budget->value << "." << std::endl;
+		if(budget->abort)
+			return l_error;
+		}
+	
 	exptree rep;
 	rep.set_head(str_node("\\expression"));
 	sibling_iterator top=rep.append_child(rep.begin(), str_node("\\sum", prod->fl.bracket, prod->fl.parent_rel));
-	// add
-	iterator ploc=rep.append_child(top, str_node(prod->name, prod->fl.bracket, prod->fl.parent_rel));
-	// The multiplier should sit on each term, not on the sum.
-	ploc->multiplier=prod->multiplier;
-	
-	// Examine each child node in turn. If it is a sum, distribute it
-	// over all previously constructed nodes. Otherwise, add the child
-	// node as a child to the previously constructed nodes.
-	
-	// "facs" iterates over all child nodes of the distributable (top-level) node
-	sibling_iterator facs=tr.begin(prod);
-	while(facs!=tr.end(prod)) {
-		if(*(*facs).name=="\\sum") {
-			sibling_iterator se=rep.begin(top);
-			// "se" iterates over all nodes in the replacement \sum
-			while(se!=rep.end(top)) {
-				if(interrupted) 
-					throw algorithm_interrupted();
-
-				exptree termrep;
-				termrep.set_head(str_node());
-				sibling_iterator sumch=tr.begin(facs);
-				while(sumch!=tr.end(facs)) {
-					if(interrupted) 
-						throw algorithm_interrupted();
-
-					// add product "se" to termrep.
-					sibling_iterator dup=termrep.append_child(termrep.begin(), str_node()); // dummy
-					dup=termrep.replace(dup, se);
-					// add term from sum as factor to product above.
-					sibling_iterator newfact=termrep.append_child(dup, sumch);
-					// put the multiplier up front
-					multiply(dup->multiplier,*newfact->multiplier); 
-					multiply(dup->multiplier,*facs->multiplier);
+
+	// Generate the terms one by one, by running through all choices of a term 
+	// in each sum. Each new term is flattened and has its numerical factors 
+	// collected, after which it is merged with an identical term produced 
+	// earlier, if any. 
+	prodflatten pf(rep, rep.end());
+	pf.make_consistent_only=true;
+	prodcollectnum pc(rep, rep.end());
+	term_hash_t term_hash;
+	multiplier_t sums_multiplier=*prod->multiplier;
+	for(unsigned int i=0; i<sums.size(); ++i)
+		sums_multiplier*=*sums[i]->multiplier;
+	for(;;) {
+		if(interrupted) 
+			throw algorithm_interrupted();
+
+		iterator term=rep.append_child(top, str_node(prod->name, prod->fl.bracket, prod->fl.parent_rel));
+		// The multiplier should sit on each term, not on the sum.
+		multiplier_t mult=sums_multiplier;
+		bool nested=(number_of_factors==1), numerical=false;
+		unsigned int cursum=0;
+		facs=tr.begin(prod);
+		while(facs!=tr.end(prod)) {
+			sibling_iterator newfact;
+			if(*facs->name=="\\sum") {
+				newfact=rep.append_child(term, (iterator)(choice[cursum++]));
+				// put the multiplier up front
+				if(*newfact->multiplier!=1) {
+					mult*=*newfact->multiplier;
 					one(newfact->multiplier);
-					// make this child inherit the bracket from the sum node
-					newfact->fl.bracket=facs->fl.bracket;
-//					newfact->fl.bracket=str_node::b_none;  
-					++sumch;
 					}
-				sibling_iterator nxt=se;
-				++nxt;
-				sibling_iterator sep1=se; ++sep1;
-				se=rep.move_ontop(se, (sibling_iterator)(termrep.begin()));
-				rep.flatten(se);
-				rep.erase(se);
-//				rep.replace(se, sep1, termrep.begin(termrep.begin()), termrep.end(termrep.begin()));
-				se=nxt;
+				// make this child inherit the bracket from the sum node
+				newfact->fl.bracket=facs->fl.bracket;
+				}
+			else newfact=rep.append_child(term, (iterator)(facs));
+			if(*newfact->name=="\\prod")                     nested=true;
+			if(newfact->is_rational() || *newfact->multiplier!=1) numerical=true;
+			++facs;
+			}
+		term->multiplier=rat_set.insert(mult).first;
+
+		// Only the new term needs flattening and collecting, and only when it 
+		// contains nested products or numerical factors.
+		if(nested) {
+			if(pf.can_apply(term)) pf.apply(term);
+			if(*term->name=="\\prod") {
+				sibling_iterator ch=rep.begin(term);
+				while(ch!=rep.end(term)) {
+					iterator tmp=ch;
+					++ch;
+					cleanup_nests(rep, tmp, false);
+					}
 				}
 			}
+		if(numerical || nested)
+			if(pc.can_apply(term)) pc.apply(term);
+
+		if(*term->multiplier==0) 
+			rep.erase(term);
 		else {
-			sibling_iterator se=rep.begin(top);
-			while(se!=rep.end(top)) {
-				if(interrupted) 
-					throw algorithm_interrupted();
-				rep.append_child(se, facs);
-				++se;
+			hashval_t hsh=rep.calc_hash(term);
+			std::pair<term_hash_t::iterator, term_hash_t::iterator> range=term_hash.equal_range(hsh);
+			while(range.first!=range.second) {
+				if(subtree_exact_equal(range.first->second, term, -2, true, 0, true)) {
+					add(range.first->second->multiplier, *term->multiplier);
+					rep.erase(term);
+					break;
+					}
+				++range.first;
 				}
+			if(range.first==range.second)
+				term_hash.insert(term_hash_t::value_type(hsh, term));
 			}
-		++facs;
+		
+		// Move on to the next choice of terms, the last sum running fastest.
+		unsigned int k=sums.size();
+		while(k>0) {
+			--k;
+			++choice[k];
+			if(choice[k]!=tr.end(sums[k])) break;
+			choice[k]=tr.begin(sums[k]);
+			if(k==0) break;
+			}
+		if(k==0 && choice[0]==tr.begin(sums[0])) break;
 		}
-	if(rep.number_of_children(top)==1) { // nothing happened, no sum was present
-//		prod->fl.mark=0; // handled
-		return l_applied;
+
+	// Terms which cancelled against each other are removed now.
+	sibling_iterator trm=rep.begin(top);
+	while(trm!=rep.end(top)) {
+		if(*trm->multiplier==0) trm=rep.erase(trm);
+		else                    ++trm;
 		}
+
 	expression_modified=true;
+	if(rep.number_of_children(top)==0) {
+		node_zero(prod);
+		return l_applied;
+		}
 
 // FIXME: why does this faster move lead to a crash in linear.cdb?
 	iterator ret=tr.move_ontop(prod, (iterator)top);
 //	assert(rep.begin()==rep.end());
 
-//	iterator ret=tr.replace(prod, top);
-//	txtout << "calling cleanup on " << *ret->name << " " << *tr.begin(ret)->name << std::endl;
-
-	prodflatten pf(tr, tr.end());
-	pf.make_consistent_only=true;
-	pf.apply_recursive(ret, false);
-	prodcollectnum pc(tr, tr.end());
-	pc.apply_recursive(ret,false);
-//	cleanup_sums_products(tr, ret);
-//	txtout << "..." << *ret->name << std::endl;
-	cleanup_nests_below(tr, ret, false); // CHANGED  true to false in last argument
+	if(tr.number_of_children(ret)==1) {
+		tr.begin(ret)->fl.bracket=ret->fl.bracket;
+		tr.begin(ret)->fl.parent_rel=ret->fl.parent_rel;
+		tr.flatten(ret);
+		ret=tr.erase(ret);
+		pushup_multiplier(ret);
+		}
 	cleanup_nests(tr, ret, false); // CHANGED true to false in last argument
 
-	// FIXME: if we had a flattened sum, does the apply_recursive now
-	// go and examine every sum that we have created? Should we better
-	// return an iterator to the last element in the sum?
 	prod=ret;
 	return l_applied;
 	}
@@ -1259,57 +1326,16 @@ bool sumsort::can_apply(iterator st)
 
 algorithm::result_t sumsort::apply(iterator& st) 
 	{
-	// This bubble sort is of course a disaster, but it'll have to do for now.
-
-	sibling_iterator one, two;
-	unsigned int num=tr.number_of_children(st);
-	for(unsigned int i=1; i<num; ++i) {
-		one=tr.begin(st);
-		two=one; ++two;
-		for(unsigned int j=i+1; j<=num; ++j) { // this loops too many times, no?
-			int es=subtree_compare(one, two, -2, true, 0, true);
-			if(should_swap(one, es)) {
-				tr.swap(one);
-				std::swap(one,two);  // put the iterators back in order
-				expression_modified=true;
-				}
-			++one;
-			++two;
-			}
+	// Terms in a sum always commute, so the merge sort never has to give up.
+	bool modified=false;
+	exptree_ordering::sort_children(tr, st, false, modified, -2, 0, true);
+	if(modified) {
+		expression_modified=true;
+		return l_applied;
 		}
-
-	if(expression_modified) return l_applied;
 	else return l_no_action;
 	}
 
-bool sumsort::should_swap(iterator obj, int subtree_comparison) const
-	{
-	sibling_iterator one=obj, two=obj;
-	++two;
-
-	// Find a SortOrder property which contains both one and two.
-	int num1, num2;
-	const SortOrder *so1=properties::get_composite<SortOrder>(one,num1);
-	const SortOrder *so2=properties::get_composite<SortOrder>(two,num2);
-
-	if(so1==0 || so2==0) { // No sort order known
-		if(subtree_comparison<0) return true;
-		return false;
-		}
-	else if(abs(subtree_comparison)<=1) { // Identical up to index names
-		if(subtree_comparison==-1) return true;
-		return false;
-		}
-	else {
-		if(so1==so2) {
-			if(num1>num2) return true;
-			return false;
-			}
-		}
-
-	return false;
-	}
-
 
 prodsort::prodsort(exptree& tr, iterator it)
 	: algorithm(tr, it) //, ignore_numbers_(false)
@@ -1330,33 +1356,12 @@ bool prodsort::can_apply(iterator st)
 
 algorithm::result_t prodsort::apply(iterator& st) 
 	{
-	// This could have been done using STL's sort, but then you have to worry
-	// about using stable_sort, and then the tree.sort() doesn't do that,
-	// and anyhow you would perhaps want exceptions. Let's just use a bubble
-	// sort since how many times do we have more than 100 items in a product?
-
-	sibling_iterator one, two;
-	unsigned int num=tr.number_of_children(st);
-	for(unsigned int i=1; i<num; ++i) {
-		one=tr.begin(st);
-		two=one; ++two;
-		for(unsigned int j=i+1; j<=num; ++j) { // this loops too many times, no?
-			int es=subtree_compare(one, two, -2);
-//			std::cerr << "hi " << es << std::endl;
-			if(exptree_ordering::should_swap(one, es)) {
-				int canswap=exptree_ordering::can_swap(one, two, es);
-				if(canswap!=0) {
-//					std::cout << "swapping " << *one->name << " with " << *two->name << std::endl;
-					tr.swap(one);
-					std::swap(one,two);  // put the iterators back in order
-					if(canswap==-1)
-						flip_sign(st->multiplier);
-					expression_modified=true;
-					}
-				}
-			++one;
-			++two;
-			}
+	bool modified=false;
+	int sign=exptree_ordering::sort_children(tr, st, true, modified);
+	if(modified) {
+		if(sign==-1)
+			flip_sign(st->multiplier);
+		expression_modified=true;
 		}
 
 	if(expression_modified) return l_applied;
@@ -1848,9 +1853,9 @@ void collect_factors::fill_hash_map(iterator it)
 			}
 		if(!dontcollect) {
 			if(*sib->name=="\\pow") 
-				factor_hash.insert(std::pair<hashval_t, sibling_iterator>(tr.calc_hash(tr.begin(sib)), tr.begin(sib)));
+				factor_hash.insert(std::pair<hashval_t, sibling_iterator>(calc_hash(tr.begin(sib)), tr.begin(sib)));
 			else
-				factor_hash.insert(std::pair<hashval_t, sibling_iterator>(tr.calc_hash(sib), sib));
+				factor_hash.insert(std::pair<hashval_t, sibling_iterator>(calc_hash(sib), sib));
 			++factors;
 			}
 		++sib;
@@ -2329,7 +2334,7 @@ bool factor_in::can_apply(iterator st)
 
 hashval_t factor_in::calc_restricted_hash(iterator it) const
 	{
-	if(*it->name!="\\prod") return tr.calc_hash(it);
+	if(*it->name!="\\prod") return calc_hash(it);
 
 	sibling_iterator sib=tr.begin(it);
 	hashval_t ret=1;
@@ -2338,11 +2343,11 @@ hashval_t factor_in::calc_restricted_hash(iterator it) const
 		 if(factnodes.count(exptree(sib))==0) {
 			if(first) { 
 				first=false;
-				ret=tr.calc_hash(sib);
+				ret=calc_hash(sib);
 				}
 			else { 
 				ret*=17;
-				ret+=tr.calc_hash(sib);
+				ret+=calc_hash(sib);
 				}
 			}
 		++sib;
@@ -2523,8 +2528,10 @@ algorithm::result_t factor_in::apply(iterator& it)
 	// Remove all terms which have zero multiplier.
 	sibling_iterator one=tr.begin(it);
 	while(one!=tr.end(it)) {
-		if(*one->multiplier==0) 
+		if(*one->multiplier==0) {
 			one=tr.erase(one);
+			expression_modified=true;
+			}
 		else if(*one->name=="\\sum" && *one->multiplier!=1) {
 			sibling_iterator oneit=tr.begin(one);
 			while(oneit!=tr.end(one)) {
@@ -2539,12 +2546,14 @@ algorithm::result_t factor_in::apply(iterator& it)
 	
 	// If there is only one term left, flatten the tree.
 	if(tr.number_of_children(it)==1) {
+		expression_modified=true;
 		tr.begin(it)->fl.bracket=it->fl.bracket;
 		tr.begin(it)->fl.parent_rel=it->fl.parent_rel;
 		tr.flatten(it);
 		it=tr.erase(it);
 		}
 	else if(tr.number_of_children(it)==0) {
+		expression_modified=true;
 		it->multiplier=rat_set.insert(0).first;
 		}
 
@@ -2582,7 +2591,7 @@ void collect_terms::fill_hash_map(sibling_iterator sib, sibling_iterator end)
 	{
 	term_hash.clear();
 	while(sib!=end) {
-		term_hash.insert(std::pair<hashval_t, sibling_iterator>(tr.calc_hash(sib), sib));
+		term_hash.insert(std::pair<hashval_t, sibling_iterator>(calc_hash(sib), sib));
 		++sib;
 		}
 	}
@@ -2592,8 +2601,10 @@ void collect_terms::remove_zeroed_terms(sibling_iterator from, sibling_iterator
 	// Remove all terms which have zero multiplier.
 	sibling_iterator one=from;
 	while(one!=to) {
-		if(*one->multiplier==0) 
+		if(*one->multiplier==0) {
 			one=tr.erase(one);
+			expression_modified=true;
+			}
 		else if(*one->name=="\\sum" && *one->multiplier!=1) {
 			sibling_iterator oneit=tr.begin(one);
 			while(oneit!=tr.end(one)) {
@@ -2626,6 +2637,7 @@ algorithm::result_t collect_terms::apply(iterator& st)
 
 	// If there is only one term left, flatten the tree.
 	if(tr.number_of_children(st)==1) {
+		expression_modified=true;
 		tr.begin(st)->fl.bracket=st->fl.bracket;
 		tr.begin(st)->fl.parent_rel=st->fl.parent_rel;
 		tr.flatten(st);
@@ -2634,6 +2646,7 @@ algorithm::result_t collect_terms::apply(iterator& st)
 		pushup_multiplier(st);
 		}
 	else if(tr.number_of_children(st)==0) {
+		expression_modified=true;
 //		zero(st->multiplier);
 		node_zero(st);
 		}
@@ -3040,11 +3053,19 @@ algorithm::result_t order::doit(iterator& st, bool sign)
 	return l_applied;
 	}
 
+std::atomic<unsigned long> canonicalise::gs_cache_hits(0);
+std::atomic<unsigned long> canonicalise::gs_cache_misses(0);
+
 canonicalise::canonicalise(exptree& tr, iterator it)
 	: algorithm(tr, it), reuse_generating_set(false) 
 	{
 	}
 
+std::shared_ptr<algorithm> canonicalise::termwise_instance(exptree& tr_, iterator it_) const
+	{
+	return create<canonicalise>(tr_, it_);
+	}
+
 bool canonicalise::can_apply(iterator it) 
 	{
 	if(*(it->name)!="\\prod")
@@ -3148,6 +3169,147 @@ bool canonicalise::only_one_on_derivative(iterator i1, iterator i2) const
 	else return false;
 	}
 
+bool canonicalise::skeleton(iterator it, std::vector<uintptr_t>& key) const
+	{
+	// Walk all nodes below the product, recording names and structure but
+	// recording indices only by their index set. Terms with non-trivial 
+	// multipliers inside are rare and not worth caching.
+	key.clear();
+	iterator walk=it, last=it;
+	last.skip_children();
+	++last;
+	++walk;
+	while(walk!=last) {
+		const Indices *ind=0;
+		if(walk->is_index() && !walk->is_rational())
+			ind=properties::get<Indices>(walk, true);
+		if(ind) key.push_back(reinterpret_cast<uintptr_t>(ind));
+		else    key.push_back(reinterpret_cast<uintptr_t>(&(*walk->name)));
+		key.push_back(walk->fl.bracket + 8*walk->fl.parent_rel + 64*tr.number_of_children(walk));
+		if(walk->is_rational()) {
+			if(!walk->is_integer() || !walk->multiplier->get_num().fits_slong_p()) 
+				return false;
+			key.push_back(to_long(*walk->multiplier));
+			}
+		else if(*walk->multiplier!=1) 
+			return false;
+		++walk;
+		}
+	return true;
+	}
+
+void canonicalise::fill_gs_cache_entry(iterator it, unsigned int total_number_of_indices, gs_cache_entry& entry)
+	{
+	entry.vanishes=false;
+
+	// Index set information for each slot, needed to sort dummies into sets.
+	exptree::index_iterator indexit=tr.begin_index(it);
+	while(indexit!=tr.end_index(it)) {
+		entry.slot_set_name.push_back(get_index_set_name(iterator(indexit)));
+		entry.slot_position_type.push_back(position_type(iterator(indexit)));
+		++indexit;
+		}
+
+	// Construct the generating set.
+	if(!reuse_generating_set || generating_set.size()==0) {
+		generating_set.clear();
+		// Symmetry of individual tensors.
+		sibling_iterator facit=tr.begin(it);
+		int curr_pos=0;
+		while(facit!=tr.end(it)) {
+			const TableauBase *tba=properties::get_composite<TableauBase>(facit);
+			if(tba) {
+				unsigned int number_of_indices=tr.number_of_indices(facit);
+
+				// Add indices to the base. We used to add everything except the last one, but that
+				// seems to be the wrong thing to do after the XPERM -> XPERM_EXT upgrade (see Jose's email).
+				for(unsigned int kk=0; kk<number_of_indices; ++kk) 
+					entry.base.push_back(curr_pos+kk+1);
+				
+				// loop over tabs
+				for(unsigned int ti=0; ti<tba->size(tr, facit); ++ti) {
+					TableauBase::tab_t tmptab=tba->get_tab(tr,facit,ti);
+					if(tmptab.number_of_rows()>0) {
+						for(unsigned int col=0; col<tmptab.row_size(0); ++col) { // anti-symmetry in all inds in a col
+							if(tmptab.column_size(col)>1) {
+								// all pairs NEW: SGS
+								for(unsigned int indnum1=0; indnum1<tmptab.column_size(col)-1; ++indnum1) {
+//								for(unsigned int indnum2=indnum1+1; indnum2<tmptab.column_size(col); ++indnum2) {
+									std::vector<int> permute(total_number_of_indices+2);
+									for(unsigned int kk=0; kk<permute.size(); ++kk)
+										permute[kk]=kk+1;
+									std::swap(permute[tmptab(indnum1,col)+curr_pos],
+												 permute[tmptab(indnum1+1,col)+curr_pos]);
+									std::swap(permute[total_number_of_indices+1],
+												 permute[total_number_of_indices]); // anti-symmetry
+									generating_set.push_back(permute);
+									}
+								}
+							}
+						}
+					if(tmptab.number_of_rows()==1 && tmptab.row_size(0)>1) { // symmetry, if all cols of size 1
+						// all pairs
+						for(unsigned int indnum1=0; indnum1<tmptab.row_size(0)-1; ++indnum1) {
+//						for(unsigned int indnum2=indnum1+1; indnum2<tmptab.row_size(0); ++indnum2) {
+							std::vector<int> permute(total_number_of_indices+2);
+							for(unsigned int kk=0; kk<permute.size(); ++kk)
+								permute[kk]=kk+1;
+							std::swap(permute[tmptab(0,indnum1)+curr_pos],
+										 permute[tmptab(0,indnum1+1)+curr_pos]);
+							generating_set.push_back(permute);
+							}
+						}
+					else if(tmptab.number_of_rows()>0) { // find symmetry under equal-length column exchange
+						unsigned int column_height=tmptab.column_size(0);
+						unsigned int this_set_start=0;
+						for(unsigned int col=1; col<=tmptab.row_size(0); ++col) {
+							if(col==tmptab.row_size(0) || column_height!=tmptab.column_size(col)) {
+								if(col-this_set_start>1) {
+									// two or more equal-length columns found, make generating set
+									for(unsigned int col1=this_set_start; col1+1<=col-1; ++col1) {
+//									for(unsigned int col2=this_set_start+1; col2<col; ++col2) {
+										std::vector<int> permute(total_number_of_indices+2);
+										for(unsigned int kk=0; kk<permute.size(); ++kk)
+											permute[kk]=kk+1;
+										for(unsigned int row=0; row<column_height; ++row) {
+//										txtout << row << " " << col1 << std::endl;
+											std::swap(permute[tmptab(row,col1)+curr_pos],
+														 permute[tmptab(row,col1+1)+curr_pos]);
+											}
+										generating_set.push_back(permute);
+										}
+									}
+								this_set_start=col;
+								if(col<tmptab.row_size(0)) 
+									column_height=tmptab.column_size(col);
+								}
+							}
+						}
+					}
+//					txtout << "loop over tabs done" << std::endl;
+				curr_pos+=number_of_indices;
+				}
+			else {
+				unsigned int number_of_indices=tr.number_of_indices(facit);
+				if(number_of_indices==1)
+					entry.base.push_back(curr_pos+1);
+				else {
+					for(unsigned int kk=0; kk<number_of_indices; ++kk) 
+						entry.base.push_back(curr_pos+kk+1);
+					}
+				curr_pos+=tr.number_of_indices(facit); // even if tba=0, this factor may contain indices
+				}
+			++facit;
+			}
+		// Symmetry under tensor exchange.
+		if(exchange::get_node_gs(tr, it, generating_set)==false) 
+			entry.vanishes=true;
+		}
+
+	for(unsigned int i=0; i<generating_set.size(); ++i) 
+		entry.gs.insert(entry.gs.end(), generating_set[i].begin(), generating_set[i].end());
+	}
+
 algorithm::result_t canonicalise::apply(iterator& it)
 	{
 #ifdef XPERM_DEBUG
@@ -3181,6 +3343,22 @@ algorithm::result_t canonicalise::apply(iterator& it)
 		return l_no_action;
 		}
 
+	// Find the generating set and the properties of the index slots in the cache, 
+	// or compute them if this is the first term with this tensor skeleton.
+	gs_cache_entry  local_entry;
+	gs_cache_entry *gse=&local_entry;
+	std::vector<uintptr_t> key;
+	if(!reuse_generating_set && skeleton(it, key)) {
+		std::pair<gs_cache_t::iterator, bool> ins=gs_cache.insert(gs_cache_t::value_type(key, gs_cache_entry()));
+		gse=&(ins.first->second);
+		if(ins.second) {
+			++gs_cache_misses;
+			fill_gs_cache_entry(it, total_number_of_indices, *gse);
+			}
+		else ++gs_cache_hits;
+		}
+	else fill_gs_cache_entry(it, total_number_of_indices, *gse);
+
 	// Construct the "name to slot" map from the order in ind_free & ind_dummy.
 	// Also construct the free and dummy lists.
 	// And a map from index number to iterator (for later).
@@ -3271,21 +3449,23 @@ algorithm::result_t canonicalise::apply(iterator& it)
 		// setting the metric flag to 0. Ditto when only one index is on a derivative
 		// (canonicalising usually makes the expression uglier in that case).
 		iterator tmp;
-		if( ( (separated_by_derivative(ii->first, i2->first,tmp) 
-				 || only_one_on_derivative(ii->first, i2->first) )
-				&& position_type(ii->first)==Indices::fixed ) ||
-			 position_type(ii->first)==Indices::independent ) {
-			dummy_sets[" NR "+get_index_set_name(ii->first)].push_back(ii->second+1);
-			dummy_sets[" NR "+get_index_set_name(i2->first)].push_back(i2->second+1);
+		const std::string& set1=gse->slot_set_name[ii->second];
+		const std::string& set2=gse->slot_set_name[i2->second];
+		Indices::position_t pt=gse->slot_position_type[ii->second];
+		if( ( pt==Indices::fixed && (separated_by_derivative(ii->first, i2->first,tmp) 
+											  || only_one_on_derivative(ii->first, i2->first) ) ) ||
+			 pt==Indices::independent ) {
+			dummy_sets[" NR "+set1].push_back(ii->second+1);
+			dummy_sets[" NR "+set2].push_back(i2->second+1);
 			}
 		else {
 			if( properties::get<AntiCommuting>(ii->first, true) != 0 ) {
-				dummy_sets[" AC "+get_index_set_name(ii->first)].push_back(ii->second+1);
-				dummy_sets[" AC "+get_index_set_name(i2->first)].push_back(i2->second+1);
+				dummy_sets[" AC "+set1].push_back(ii->second+1);
+				dummy_sets[" AC "+set2].push_back(i2->second+1);
 				}
 			else {
-				dummy_sets[get_index_set_name(ii->first)].push_back(ii->second+1);
-				dummy_sets[get_index_set_name(i2->first)].push_back(i2->second+1);
+				dummy_sets[set1].push_back(ii->second+1);
+				dummy_sets[set2].push_back(i2->second+1);
 				}
 			}
 
@@ -3306,138 +3486,33 @@ algorithm::result_t canonicalise::apply(iterator& it)
 //		}
 //
 	
-	// Construct the generating set.
-
-	std::vector<unsigned int> base_here;
-
-	if(!reuse_generating_set || generating_set.size()==0) {
-		generating_set.clear();
-		// Symmetry of individual tensors.
-		sibling_iterator facit=tr.begin(it);
-		int curr_pos=0;
-		while(facit!=tr.end(it)) {
-			const TableauBase *tba=properties::get_composite<TableauBase>(facit);
-			if(tba) {
-				unsigned int number_of_indices=tr.number_of_indices(facit);
-
-				// Add indices to the base. We used to add everything except the last one, but that
-				// seems to be the wrong thing to do after the XPERM -> XPERM_EXT upgrade (see Jose's email).
-				for(unsigned int kk=0; kk<number_of_indices; ++kk) 
-					base_here.push_back(curr_pos+kk+1);
-				
-				// loop over tabs
-				for(unsigned int ti=0; ti<tba->size(tr, facit); ++ti) {
-					TableauBase::tab_t tmptab=tba->get_tab(tr,facit,ti);
-					if(tmptab.number_of_rows()>0) {
-						for(unsigned int col=0; col<tmptab.row_size(0); ++col) { // anti-symmetry in all inds in a col
-							if(tmptab.column_size(col)>1) {
-								// all pairs NEW: SGS
-								for(unsigned int indnum1=0; indnum1<tmptab.column_size(col)-1; ++indnum1) {
-//								for(unsigned int indnum2=indnum1+1; indnum2<tmptab.column_size(col); ++indnum2) {
-									std::vector<int> permute(total_number_of_indices+2);
-									for(unsigned int kk=0; kk<permute.size(); ++kk)
-										permute[kk]=kk+1;
-									std::swap(permute[tmptab(indnum1,col)+curr_pos],
-												 permute[tmptab(indnum1+1,col)+curr_pos]);
-									std::swap(permute[total_number_of_indices+1],
-												 permute[total_number_of_indices]); // anti-symmetry
-									generating_set.push_back(permute);
-									}
-								}
-							}
-						}
-					if(tmptab.number_of_rows()==1 && tmptab.row_size(0)>1) { // symmetry, if all cols of size 1
-						// all pairs
-						for(unsigned int indnum1=0; indnum1<tmptab.row_size(0)-1; ++indnum1) {
-//						for(unsigned int indnum2=indnum1+1; indnum2<tmptab.row_size(0); ++indnum2) {
-							std::vector<int> permute(total_number_of_indices+2);
-							for(unsigned int kk=0; kk<permute.size(); ++kk)
-								permute[kk]=kk+1;
-							std::swap(permute[tmptab(0,indnum1)+curr_pos],
-										 permute[tmptab(0,indnum1+1)+curr_pos]);
-							generating_set.push_back(permute);
-							}
-						}
-					else if(tmptab.number_of_rows()>0) { // find symmetry under equal-length column exchange
-						unsigned int column_height=tmptab.column_size(0);
-						unsigned int this_set_start=0;
-						for(unsigned int col=1; col<=tmptab.row_size(0); ++col) {
-							if(col==tmptab.row_size(0) || column_height!=tmptab.column_size(col)) {
-								if(col-this_set_start>1) {
-									// two or more equal-length columns found, make generating set
-									for(unsigned int col1=this_set_start; col1+1<=col-1; ++col1) {
-//									for(unsigned int col2=this_set_start+1; col2<col; ++col2) {
-										std::vector<int> permute(total_number_of_indices+2);
-										for(unsigned int kk=0; kk<permute.size(); ++kk)
-											permute[kk]=kk+1;
-										for(unsigned int row=0; row<column_height; ++row) {
-//										txtout << row << " " << col1 << std::endl;
-											std::swap(permute[tmptab(row,col1)+curr_pos],
-														 permute[tmptab(row,col1+1)+curr_pos]);
-											}
-										generating_set.push_back(permute);
-										}
-									}
-								this_set_start=col;
-								if(col<tmptab.row_size(0)) 
-									column_height=tmptab.column_size(col);
-								}
-							}
-						}
-					}
-//					txtout << "loop over tabs done" << std::endl;
-				curr_pos+=number_of_indices;
-				}
-			else {
-				unsigned int number_of_indices=tr.number_of_indices(facit);
-				if(number_of_indices==1)
-					base_here.push_back(curr_pos+1);
-				else {
-					for(unsigned int kk=0; kk<number_of_indices; ++kk) 
-						base_here.push_back(curr_pos+kk+1);
-					}
-				curr_pos+=tr.number_of_indices(facit); // even if tba=0, this factor may contain indices
-				}
-			++facit;
-			}
-		// Symmetry under tensor exchange.
-		if(exchange::get_node_gs(tr, it, generating_set)==false) {
-			zero(it->multiplier);
-			expression_modified=true;
-			}
+	if(gse->vanishes) {
+		zero(it->multiplier);
+		expression_modified=true;
 		}
-	// End of construction of generating set.
 
 #ifdef XPERM_DEBUG
-	txtout << generating_set.size() << " " << *it->multiplier << std::endl;
+	txtout << gse->gs.size()/(total_number_of_indices+2) << " " << *it->multiplier << std::endl;
 #endif
 	if(*it->multiplier!=0) {
-		// Fill data for the xperm routines.
-		int *gs=0;
-
-		if(generating_set.size()>0) {
-			gs=new int[generating_set.size()*generating_set[0].size()];
-			for(unsigned int i=0; i<generating_set.size(); ++i) {
-				for(unsigned int j=0; j<total_number_of_indices+2; ++j) {
-					gs[i*(total_number_of_indices+2)+j]=generating_set[i][j];
-#ifdef XPERM_DEBUG
-					txtout << gs[i*(total_number_of_indices+2)+j] << " ";
-#endif				
-					}
+		// The generating set and base are passed straight from the cache entry;
+		// xperm copies them before doing anything else.
+		int *gs  =gse->gs.size()>0?const_cast<int *>(&gse->gs[0]):0;
+		int *base=gse->base.size()>0?const_cast<int *>(&gse->base[0]):0;
+		
 #ifdef XPERM_DEBUG
+		for(unsigned int i=0; i<gse->gs.size(); ++i) {
+			txtout << gse->gs[i] << " ";
+			if((i+1)%(total_number_of_indices+2)==0)
 				txtout << std::endl;
-#endif
-				}
 			}
-		
+#endif
+
 		// Setup the arrays for xperm from our own data structures.
 
-		int    *base=new int[base_here.size()];
 		int    *perm=new int[total_number_of_indices+2];
 		int   *cperm=new int[total_number_of_indices+2];
 
-		for(unsigned int i=0; i<base_here.size(); ++i)
-			base[i]=base_here[i];
 		assert(vec_perm.size()==total_number_of_indices);
 		for(unsigned int i=0; i<total_number_of_indices; ++i) 
 			perm[i]=vec_perm[i];
@@ -3477,7 +3552,7 @@ algorithm::result_t canonicalise::apply(iterator& it)
 			txtout << perm[i] << " "; 
 			txtout << std::endl;
 			txtout << "base:" << std::endl;
-			for(unsigned int i=0; i<base_here.size(); ++i)
+			for(unsigned int i=0; i<gse->base.size(); ++i)
 			txtout << base[i] << " "; 
 			txtout << std::endl;
 			txtout << "free indices:" << std::endl;
@@ -3560,9 +3635,9 @@ algorithm::result_t canonicalise::apply(iterator& it)
 								 total_number_of_indices+2,  // degree (+2 for the overall sign)
 								 1,                          // is this a strong generating set?
 								 base,                       // base for the strong generating set
-								 base_here.size(),           //    its length
+								 gse->base.size(),           //    its length
 								 gs,                         // generating set
-								 generating_set.size(),      //    its size
+								 gse->gs.size()/(total_number_of_indices+2), //    its size
 								 free_indices_new_order,     // free indices
 								 ind_free.size(),            // number of free indices
 								 lengths_of_dummy_sets,      // list of lengths of dummy sets
@@ -3635,10 +3710,6 @@ algorithm::result_t canonicalise::apply(iterator& it)
 			expression_modified=true;
 			}
 		
-		if(gs) 
-			delete [] gs;
-		delete [] base;
-
 		delete [] repeated_indices;
 		delete [] lengths_of_repeated_sets;
 		delete [] metric_signatures;
@@ -3909,11 +3980,18 @@ algorithm::result_t asymprop::apply(iterator& st)
 
 
 young_project::young_project(exptree& tr, iterator it)
-	: algorithm(tr,it), remove_traces(false)
+	: algorithm(tr,it), remove_traces(false), canonicalise_terms(false)
 	{
 	if(it==tr.end()) return; // for in-program calls
 
-	if(number_of_args()==2) {
+	if(number_of_args()==3) {
+		sibling_iterator arg=args_begin();
+		++arg; ++arg;
+		if(*arg->name=="Canonicalise") 
+			canonicalise_terms=true;
+		else throw consistency_error("Unknown option "+*arg->name+" to @young_project.");
+		}
+	if(number_of_args()==2 || number_of_args()==3) {
 		sibling_iterator arg=args_begin();
 		if(*arg->name=="\\comma") {
 			++arg;
@@ -4027,17 +4105,35 @@ algorithm::result_t young_project::apply(iterator& it)
 	// locations which belong to the same asym set. This could actually
 	// be done in combinatorics already.
 
+	// Index positions in the original; the positions in each generated term
+	// are determined in a single pass as well, since index_iterator::operator+=
+	// walks the tree.
+	std::vector<iterator> src_pos, dst_pos;
+	exptree::index_iterator ii=tr.begin_index(it);
+	while(ii!=tr.end_index(it)) {
+		src_pos.push_back(ii);
+		++ii;
+		}
+
 	exptree rep;
 	rep.set_head(str_node("\\sum"));
+	term_hash_t term_hash;
+	// All terms are generated in the same tree, so that a single canonicalise
+	// object (and its cache of generating sets) can be used for all of them.
+	exptree repfac;
+	canonicalise canon(repfac, repfac.end());
 	for(unsigned int i=0; i<sym.size(); ++i) {
 		// Generate the term.
-		exptree repfac(it);
+		repfac=exptree(it);
+		dst_pos.clear();
+		ii=repfac.begin_index(repfac.begin());
+		while(ii!=repfac.end_index(repfac.begin())) {
+			dst_pos.push_back(ii);
+			++ii;
+			}
 		for(unsigned int j=0; j<sym[i].size(); ++j) {
-			exptree::index_iterator src_fd=tr.begin_index(it);
-			exptree::index_iterator dst_fd=tr.begin_index(repfac.begin());
-			src_fd+=sym[i][j];        // take the index at location sym[i][j]
-			dst_fd+=sym.original[j];  // and store it in location sym.original[j]
-			tr.replace_index(dst_fd, src_fd); 
+			// take the index at location sym[i][j] and store it in location sym.original[j]
+			repfac.replace_index(dst_pos[sym.original[j]], src_pos[sym[i][j]]);
 			}
 		// Remove traces of antisymmetric objects. This can really
 		// only be done here, since combinatorics.hh does not know
@@ -4065,20 +4161,76 @@ algorithm::result_t young_project::apply(iterator& it)
 
 		{ multiply(repfac.begin()->multiplier, sym.signature(i));
 		multiply(repfac.begin()->multiplier, tab.projector_normalisation());
-		iterator repfactop=repfac.begin();
-		prod_unwrap_single_term(repfactop);
-		rep.append_child(rep.begin(), repfac.begin()); }
+		if(canonicalise_terms) 
+			add_term(rep, term_hash, canon, repfac);
+		else {
+			iterator repfactop=repfac.begin();
+			prod_unwrap_single_term(repfactop);
+			rep.append_child(rep.begin(), repfac.begin()); 
+			}
+		}
 
 	   traceterm: ;
 		}
+
+	if(canonicalise_terms) {
+		sibling_iterator sib=rep.begin(rep.begin());
+		while(sib!=rep.end(rep.begin())) {
+			if(*sib->multiplier==0) sib=rep.erase(sib);
+			else                    ++sib;
+			}
+		if(rep.number_of_children(rep.begin())==0) {
+			node_zero(it);
+			expression_modified=true;
+			sym.remove_multiplicity_zero();
+			return l_applied;
+			}
+		if(rep.number_of_children(rep.begin())==1) {
+			rep.begin(rep.begin())->fl.bracket=rep.begin()->fl.bracket;
+			rep.begin(rep.begin())->fl.parent_rel=rep.begin()->fl.parent_rel;
+			iterator top=rep.begin();
+			rep.flatten(top);
+			rep.erase(top);
+			}
+		}
+
 	it=tr.replace(it,rep.begin());
 	expression_modified=true;
 
 	sym.remove_multiplicity_zero();
 
+	if(canonicalise_terms) 
+		pushup_multiplier(it);
+
 	return l_applied;
 	}
 
+// Canonicalise a single generated term, at every level as @canonicalise! does,
+// and add it to the sum 'rep', adding its multiplier to that of an identical 
+// term if one is present already.
+//
+void young_project::add_term(exptree& rep, term_hash_t& term_hash, canonicalise& canon, exptree& term)
+	{
+	iterator top=term.begin();
+	canon.apply_recursive(top, false);
+	if(*term.begin()->multiplier==0)
+		return;
+	top=term.begin();
+	prod_unwrap_single_term(top);
+
+	hashval_t hsh=term.calc_hash(term.begin());
+	std::pair<term_hash_t::iterator, term_hash_t::iterator> range=term_hash.equal_range(hsh);
+	while(range.first!=range.second) {
+		if(subtree_exact_equal(range.first->second, term.begin(), -2, true, 0, true)) {
+			add(range.first->second->multiplier, *term.begin()->multiplier);
+			return;
+			}
+		++range.first;
+		}
+	sibling_iterator added=rep.append_child(rep.begin(), term.begin());
+	term_hash.insert(term_hash_t::value_type(hsh, added));
+	}
+
 young_project_tensor::young_project_tensor(exptree& tr, iterator it)
 	: algorithm(tr,it), modulo_monoterm(false)
 	{
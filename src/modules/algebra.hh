@@ -248,6 +248,7 @@ class prodrule : public algorithm {
 
 		virtual bool     can_apply(iterator);
 		virtual result_t apply(iterator&);
+		virtual std::shared_ptr<algorithm> termwise_instance(exptree&, iterator) const;
 
 		sibling_iterator prodnode;
 		unsigned int     number_of_indices;
@@ -267,6 +268,9 @@ class distribute : public algorithm {
 
 		virtual bool     can_apply(iterator);
 		virtual result_t apply(iterator&);
+		virtual std::shared_ptr<algorithm> termwise_instance(exptree&, iterator) const;
+	private:
+		typedef std::multimap<hashval_t, iterator> term_hash_t;
 };
 
 class sumsort : public algorithm {
@@ -275,8 +279,6 @@ class sumsort : public algorithm {
 
 		virtual bool     can_apply(iterator);
 		virtual result_t apply(iterator&);
-
-		bool should_swap(iterator obj, int subtree_comparison) const;
 };
 
 class prodsort : public algorithm {
@@ -460,11 +462,34 @@ class canonicalise : public algorithm {
 
 		virtual bool     can_apply(iterator);
 		virtual result_t apply(iterator&);		
+		virtual std::shared_ptr<algorithm> termwise_instance(exptree&, iterator) const;
 
 		std::vector<std::vector<int> > generating_set;
 		bool             reuse_generating_set;
 
+		/// Number of terms for which the generating set was found in, or had
+		/// to be added to, the cache below (summed over all instances).
+		static std::atomic<unsigned long> gs_cache_hits, gs_cache_misses;
+
 	private:
+		/// Everything needed to canonicalise a term which depends only on the
+		/// tensor skeleton of the term, i.e. on the term with all index names
+		/// replaced by their index set. Kept for the duration of a single
+		/// command, so property changes cannot make entries stale.
+		class gs_cache_entry {
+			public:
+				bool                             vanishes; // exchange symmetry makes the term zero
+				std::vector<int>                 base;
+				std::vector<int>                 gs;       // generating set, flattened
+				std::vector<std::string>         slot_set_name;
+				std::vector<Indices::position_t> slot_position_type;
+		};
+		typedef std::map<std::vector<uintptr_t>, gs_cache_entry> gs_cache_t;
+		gs_cache_t gs_cache;
+
+		bool skeleton(iterator, std::vector<uintptr_t>&) const;
+		void fill_gs_cache_entry(iterator, unsigned int total_number_of_indices, gs_cache_entry&);
+
 		bool remove_traceless_traces(iterator&);
 		bool remove_vanishing_numericals(iterator&);
 		bool only_one_on_derivative(iterator index1, iterator index2) const;
@@ -656,8 +681,16 @@ class young_project : public algorithm {
 		// combinatorics.hh point of view.
 		combin::combinations<unsigned int>::permuted_sets_t asym_ranges;
 		bool remove_traces;
+
+		// Canonicalise each generated term and collect it with the terms
+		// generated so far, instead of building the full projected sum. 
+		// The terms then no longer correspond one-to-one to 'sym'.
+		bool canonicalise_terms;
 	private:
 		iterator nth_index_node(iterator, unsigned int);
+
+		typedef std::multimap<hashval_t, sibling_iterator> term_hash_t;
+		void     add_term(exptree& rep, term_hash_t&, canonicalise&, exptree& term);
 };
 
 class young_project_tensor : public algorithm {
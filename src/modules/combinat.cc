@@ -26,6 +26,19 @@ permute::permute(exptree& tr, iterator it)
 	{
 	}
 
+permute::comma_generator::comma_generator()
+	: rep(0)
+	{
+	}
+
+bool permute::comma_generator::visit(const std::vector<iterator>& vec, int)
+	{
+	iterator comit=rep->append_child(rep->begin(), str_node("\\comma"));
+	for(unsigned int j=0; j<vec.size(); ++j) 
+		rep->append_child(comit, vec[j]);
+	return true;
+	}
+
 void permute::description() const
 	{
 	txtout << "Generic combinatorial algorithm" << std::endl;
@@ -104,16 +117,10 @@ algorithm::result_t permute::apply(iterator& it)
 		com.sublengths[0]=1;
 		}
 	
+	com.rep=&rep;
 	do {
 		com.clear_results();
 		com.permute();
-		
-		for(unsigned int i=0; i<com.size(); ++i) {
-			iterator comit=rep.append_child(rep.begin(), str_node("\\comma"));
-			for(unsigned int j=0; j<com[i].size(); ++j) {
-				rep.append_child(comit, com[i][j]);
-				}
-			}
 		if(scan_through_range)
 			com.sublengths[0]+=1;
 		} while(scan_through_range && com.sublengths[0]<max_range_len);
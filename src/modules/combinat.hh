@@ -35,7 +35,18 @@ class permute : public algorithm {
 		virtual bool     can_apply(iterator);
 		virtual result_t apply(iterator&);
 
-		combin::combinations<iterator> com;
+		/// Appends every generated combination to a \\comma list as soon as
+		/// it has been generated.
+		class comma_generator : public combin::combinations_visitor<iterator> {
+			public:
+				comma_generator();
+
+				exptree *rep;
+			protected:
+				virtual bool visit(const std::vector<iterator>&, int);
+		};
+
+		comma_generator        com;
 		bool                   scan_through_range;
 };
 
@@ -24,6 +24,10 @@
 #include <modglue/process.hh>
 #include <sstream>
 #include <pcrecpp.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <unistd.h>
 
 // FIXME: some of these probably need to be converted only when appropriate properties
 // have been set, but definitely only when a node matches, not just as random text
@@ -394,6 +398,182 @@ R_{a b c d}::WeylTensor.
 
 */
 
+const char *cas_session::marker="cadabra_batch_end";
+
+cas_session::cas_session(const std::string& pr, const std::string& in, const std::string& rs,
+								 const std::string& mc, const std::string& qc)
+	: program(pr), init(in), reset(rs), marker_command(mc), quit_command(qc), pid(0)
+	{
+	}
+
+cas_session::~cas_session()
+	{
+	stop();
+	}
+
+bool cas_session::start()
+	{
+	proc.reset(new modglue::child_process(program));
+	pending.clear();
+	try {
+		proc->fork();
+		}
+	catch(std::logic_error& err) {
+		proc.reset();
+		return false;
+		}
+	pid=proc->get_pid();
+
+	// Send the initialisation commands and eat the banner.
+	std::string banner;
+	try {
+		proc->write(init+marker_command);
+		if(read_segment(banner))
+			return true;
+		}
+	catch(std::exception& ex) {
+		}
+	stop();
+	return false;
+	}
+
+// Ask the program to quit, but do not wait for it indefinitely: a program
+// which does not exit in time is terminated, and killed if that fails too.
+
+void cas_session::stop()
+	{
+	if(!proc) return;
+	try {
+		if(alive()) {
+			proc->write(quit_command);
+			if(!wait_for_exit(2000)) {
+				proc->terminate();
+				if(!wait_for_exit(1000)) {
+					kill(pid, SIGKILL);
+					int status;
+					waitpid(pid, &status, 0);
+					}
+				}
+			}
+		proc->close();
+		}
+	catch(std::exception& ex) {
+		}
+	proc.reset();
+	pid=0;
+	}
+
+bool cas_session::wait_for_exit(unsigned int milliseconds)
+	{
+	for(unsigned int waited=0; waited<milliseconds; waited+=10) {
+		if(!alive()) return true;
+		usleep(10000);
+		}
+	return !alive();
+	}
+
+// Check (without blocking) whether the process is still there. A process
+// which has exited gets reaped here, so it should not be waited for again.
+
+bool cas_session::alive()
+	{
+	if(!proc || pid==0) return false;
+	int status;
+	if(waitpid(pid, &status, WNOHANG)==0) 
+		return true;
+	pid=0;
+	return false;
+	}
+
+// Read output up to and including the next marker line. Only a line which
+// consists of the marker alone counts, so that echoed input or an error
+// message quoting a command does not end the segment. Returns false if the
+// process closed its output before the marker appeared.
+
+bool cas_session::read_segment(std::string& segment)
+	{
+	segment.clear();
+	for(;;) {
+		std::string::size_type nl;
+		while((nl=pending.find('\n'))!=std::string::npos) {
+			std::string line=pending.substr(0, nl);
+			pending.erase(0, nl+1);
+			std::string::size_type first=line.find_first_not_of(" \t");
+			std::string::size_type last =line.find_last_not_of(" \t");
+			if(first!=std::string::npos && line.compare(first, last-first+1, marker)==0)
+				return true;
+			segment+=line+"\n";
+			}
+		char buf[1024];
+		int len=proc->read(buf, sizeof(buf));
+		if(len<=0) 
+			return false;
+		for(int i=0; i<len; ++i)
+			if(buf[i]!='\r') pending+=buf[i];
+		}
+	}
+
+bool cas_session::evaluate(const std::vector<std::string>& in, std::vector<std::string>& out)
+	{
+	out.clear();
+	size_t done=0;
+	while(done<in.size()) {
+		// Input is written in chunks which fit in the pipe buffer, so that the write
+		// never blocks while the program is waiting for us to read its output. The
+		// first chunk starts by resetting the program; its output is discarded.
+		std::string tosend;
+		if(done==0) 
+			tosend=reset+init+marker_command;
+		size_t num=0;
+		do {
+			tosend+=in[done+num]+";\n"+marker_command;
+			++num;
+			} while(done+num<in.size() && tosend.size()<16384);
+
+		// A process which has died (or dies on this input) is restarted once.
+		bool success=false;
+		for(int attempt=0; attempt<2 && !success; ++attempt) {
+			if(!alive()) {
+				stop();
+				if(!start()) return false;
+				}
+			out.resize(done);
+			try {
+				proc->write(tosend);
+				std::string segment;
+				if(done==0 && !read_segment(segment)) 
+					throw std::logic_error("no output after reset");
+				while(out.size()<done+num && read_segment(segment))
+					out.push_back(segment);
+				}
+			catch(std::exception& ex) {
+				}
+			if(out.size()==done+num) success=true;
+			else                     stop();
+			}
+		if(!success) return false;
+		done+=num;
+		}
+	return true;
+	}
+
+// Sessions are only started when first used, and then stay around until
+// the program exits.
+
+static cas_session& maxima_session()
+	{
+	static cas_session session("maxima", "display2d:false$\nlinel:10000$\n", "kill(all)$\n",
+										"print(concat(\"cadabra\",\"_batch_end\"))$\n", "quit();\n");
+	return session;
+	}
+
+static cas_session& maple_session()
+	{
+	static cas_session session("maple", "interface(prettyprint=0);\n", "restart;\n",
+										"printf(\"%s_%s\\n\",\"cadabra\",\"batch_end\");\n", "quit;\n");
+	return session;
+	}
+
 maxima::maxima(exptree& tr, iterator it)
 	: algorithm(tr, it)
 	{
@@ -413,64 +593,61 @@ bool maxima::can_apply(iterator it)
 
 algorithm::result_t maxima::apply(iterator& it)
 	{
-	std::ostringstream argstr;
 	exptree_output eo(tr);
 	eo.output_format=exptree_output::out_plain;
 	eo.print_star=true;
 
+	std::ostringstream argstr;
 	eo.print_infix(argstr, it);
-	
-	std::string result;
-	modglue::child_process proc("maxima");
-	std::string tomax="display2d:false$\n"+argstr.str()+";\nquit();\n";
-
+	std::string stmt=argstr.str();
 	for(size_t i=0; i<sizeof(max_to_cad)/sizeof(max_to_cad[0]); ++i) 
-		pcrecpp::RE(max_to_cad[i][1]).GlobalReplace(max_to_cad[i][0], &tomax);
+		pcrecpp::RE(max_to_cad[i][1]).GlobalReplace(max_to_cad[i][0], &stmt);
 
 	debugout << "sending to maxima:" << std::endl
-				<< tomax << std::endl;
+				<< stmt << std::endl;
 
-	proc.call(tomax, result);
+	std::vector<std::string> tomax(1, stmt), result;
+	if(!maxima_session().evaluate(tomax, result)) {
+		txtout << "Failed to run maxima." << std::endl;
+		return l_error;
+		}
 
 	debugout << "result from maxima:" << std::endl
-				<< result << std::endl;
+				<< result[0] << std::endl;
 
-	std::stringstream str(result);
-	std::string line;
-	parser pa(true);
-	std::string store;
+	std::stringstream str(result[0]);
+	std::string line, store;
 	while(std::getline(str, line)) {
 		pcrecpp::RE reg(".*\\(%o[0-9]+\\) *(.*)");
-		if(reg.FullMatch(line,&store)) {
-//			txtout << store << std::endl;
+		if(reg.FullMatch(line,&store)) 
 			break;
-			}
 		}
-	if(store.size()>0) {
-		pcrecpp::RE("\\^").GlobalReplace("**", &store);
+	return replace_with_output(it, store);
+	}
 
-		for(size_t i=0; i<sizeof(max_to_cad)/sizeof(max_to_cad[0]); ++i) 
-			pcrecpp::RE(max_to_cad[i][0]).GlobalReplace(max_to_cad[i][1], &store);
-		
-//		debugout << "after conversion:" << std::endl
-//					<< store << std::endl;
+algorithm::result_t maxima::replace_with_output(iterator& it, std::string store)
+	{
+	if(store.size()==0)
+		return l_no_action;
 
-		try {
-			std::stringstream str2(store);
-			str2 >> pa;
-			}
-		catch(std::exception& ex) {
-			txtout << ex.what() << std::endl;
-			return l_error;
-			}
-		it=tr.replace(it,pa.tree.begin().begin());
-		cleanup_expression(tr,it);
-		expression_modified=true;
-		return l_applied;
-		}
+	pcrecpp::RE("\\^").GlobalReplace("**", &store);
 
-	return l_no_action;
-	
+	for(size_t i=0; i<sizeof(max_to_cad)/sizeof(max_to_cad[0]); ++i) 
+		pcrecpp::RE(max_to_cad[i][0]).GlobalReplace(max_to_cad[i][1], &store);
+		
+	parser pa(true);
+	try {
+		std::stringstream str2(store);
+		str2 >> pa;
+		}
+	catch(std::exception& ex) {
+		txtout << ex.what() << std::endl;
+		return l_error;
+		}
+	it=tr.replace(it,pa.tree.begin().begin());
+	cleanup_expression(tr,it);
+	expression_modified=true;
+	return l_applied;
 	}
 
 maple::maple(exptree& tr, iterator it)
@@ -492,73 +669,63 @@ bool maple::can_apply(iterator it)
 
 algorithm::result_t maple::apply(iterator& it)
 	{
-	std::ostringstream argstr;
 	exptree_output eo(tr);
 	eo.output_format=exptree_output::out_plain;
 	eo.print_star=true;
 
+	std::ostringstream argstr;
 	eo.print_infix(argstr, it);
-	
-	std::string result;
-	modglue::child_process proc("maple");
-	std::string tomax="interface(prettyprint=0);\n"+argstr.str()+";\nquit;\n";
-
+	std::string stmt=argstr.str();
 	for(size_t i=0; i<sizeof(maple_to_cad)/sizeof(maple_to_cad[0]); ++i) 
-		pcrecpp::RE(maple_to_cad[i][1]).GlobalReplace(maple_to_cad[i][0], &tomax);
+		pcrecpp::RE(maple_to_cad[i][1]).GlobalReplace(maple_to_cad[i][0], &stmt);
 
 	debugout << "sending to maple:" << std::endl
-				<< tomax << std::endl;
+				<< stmt << std::endl;
 
-	proc.call(tomax, result);
+	std::vector<std::string> tomaple(1, stmt), result;
+	if(!maple_session().evaluate(tomaple, result)) {
+		txtout << "Failed to run maple." << std::endl;
+		return l_error;
+		}
 
 	debugout << "result from maple:" << std::endl
-				<< result << std::endl;
+				<< result[0] << std::endl;
 
-	std::stringstream str(result);
-	std::string line;
-	parser pa(true);
-
-	// Eat input until the second prompt appears
-	int count=0;
+	// The answer is the last non-empty line, after removing prompts;
+	// an error message means there is no answer.
+	std::stringstream str(result[0]);
+	std::string line, store;
 	while(std::getline(str, line)) {
-		if(line[0]=='>')
-			if(++count==2)
-				break;
+		pcrecpp::RE("^[> ]*").Replace("", &line);
+		if(line.size()>0)
+			store=line;
 		}
+	if(store.compare(0, 5, "Error")==0)
+		store.clear();
+	return replace_with_output(it, store);
+	}
 
-	std::string store;
-//	while(std::getline(str, line)) {
-//		pcrecpp::RE reg(".*\\(%o[0-9]+\\) *(.*)");
-//		if(reg.FullMatch(line,&store)) {
-//			txtout << store << std::endl;
-//			break;
-//			}
-//		}
-	std::getline(str,store);
-
-	if(store.size()>0) {
-		pcrecpp::RE("\\^").GlobalReplace("**", &store);
-
-		for(size_t i=0; i<sizeof(maple_to_cad)/sizeof(maple_to_cad[0]); ++i) 
-			pcrecpp::RE(maple_to_cad[i][0]).GlobalReplace(maple_to_cad[i][1], &store);
-		
-//		debugout << "after conversion:" << std::endl
-//					<< store << std::endl;
+algorithm::result_t maple::replace_with_output(iterator& it, std::string store)
+	{
+	if(store.size()==0)
+		return l_no_action;
 
-		try {
-			std::stringstream str2(store);
-			str2 >> pa;
-			}
-		catch(std::exception& ex) {
-			txtout << ex.what() << std::endl;
-			return l_error;
-			}
-		it=tr.replace(it,pa.tree.begin().begin());
-		cleanup_expression(tr,it);
-		expression_modified=true;
-		return l_applied;
-		}
+	pcrecpp::RE("\\^").GlobalReplace("**", &store);
 
-	return l_no_action;
-	
+	for(size_t i=0; i<sizeof(maple_to_cad)/sizeof(maple_to_cad[0]); ++i) 
+		pcrecpp::RE(maple_to_cad[i][0]).GlobalReplace(maple_to_cad[i][1], &store);
+		
+	parser pa(true);
+	try {
+		std::stringstream str2(store);
+		str2 >> pa;
+		}
+	catch(std::exception& ex) {
+		txtout << ex.what() << std::endl;
+		return l_error;
+		}
+	it=tr.replace(it,pa.tree.begin().begin());
+	cleanup_expression(tr,it);
+	expression_modified=true;
+	return l_applied;
 	}
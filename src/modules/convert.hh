@@ -22,6 +22,8 @@
 #define convert_hh_
 
 #include "algorithm.hh"
+#include <modglue/process.hh>
+#include <memory>
 
 class frommath : public algorithm {
 	public:
@@ -49,6 +51,40 @@ class run : public algorithm {
 		result_t         apply(iterator&, std::string program_name, bool mapleout);
 };
 
+/// A long-lived maxima or maple process. Starting these programs takes a
+/// sizeable fraction of a second, so the process is kept running between
+/// calls and restarted when it has died. Every call first sends the reset
+/// command followed by the initialisation commands, so that no definitions 
+/// are carried over from earlier calls. Statements are sent in batches,
+/// each one followed by a command which prints a marker line, so that the
+/// output can be split up again per statement. The marker command should
+/// not contain the marker itself, in case the program echoes its input.
+
+class cas_session {
+	public:
+		cas_session(const std::string& program, const std::string& init, const std::string& reset,
+						const std::string& marker_command, const std::string& quit_command);
+		~cas_session();
+
+		bool start();
+		void stop();
+
+		/// Evaluate all statements in a single round-trip; the raw output of
+		/// each statement ends up in the corresponding element of 'out'.
+		bool evaluate(const std::vector<std::string>& in, std::vector<std::string>& out);
+
+		static const char *marker;
+	private:
+		std::string program, init, reset, marker_command, quit_command;
+		std::unique_ptr<modglue::child_process> proc;
+		pid_t       pid;
+		std::string pending;
+
+		bool alive();
+		bool wait_for_exit(unsigned int milliseconds);
+		bool read_segment(std::string&);
+};
+
 class maxima : public algorithm {
 	public:
 		maxima(exptree&, iterator);
@@ -59,6 +95,8 @@ class maxima : public algorithm {
 		result_t         apply(iterator&, std::string program_name, bool mapleout);
 
 		static const char* max_to_cad[][2];
+	private:
+		result_t         replace_with_output(iterator&, std::string);
 };
 
 class maple : public algorithm {
@@ -71,6 +109,8 @@ class maple : public algorithm {
 		result_t         apply(iterator&, std::string program_name, bool mapleout);
 
 		static const char* maple_to_cad[][2];
+	private:
+		result_t         replace_with_output(iterator&, std::string);
 };
 
 /*
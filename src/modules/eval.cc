@@ -19,18 +19,686 @@
 */
 
 #include "eval.hh"
+#include "numerical.hh"
+#include <cmath>
+#include <limits>
 
 eval::eval(exptree& tr, iterator it)
-	: algorithm(tr, it)
+	: algorithm(tr, it), batch(1), symbolic(false)
 	{
+	if(number_of_args()==0) {
+		txtout << "eval: need a list of replacement rules with numerical values." << std::endl;
+		throw constructor_error();
+		}
+	sibling_iterator rules=args_begin();
+	for(unsigned int i=0; i<tr.arg_size(rules); ++i) {
+		iterator arrow=tr.arg(rules, i);
+		if(*arrow->name!="\\arrow" && *arrow->name!="\\equals") {
+			txtout << "eval: argument " << i+1 << " is not a replacement rule." << std::endl;
+			throw constructor_error();
+			}
+		sibling_iterator lhs=tr.begin(arrow);
+		sibling_iterator rhs=lhs;
+		++rhs;
+
+		// The right-hand side is a number, or a list of numbers with one value
+		// for every point at which the expression should be evaluated. Anything
+		// else makes the evaluation symbolic.
+		std::vector<double> vals;
+		sibling_iterator val=rhs, valend=rhs;
+		++valend;
+		if(*rhs->name=="\\comma") {
+			val=tr.begin(rhs);
+			valend=tr.end(rhs);
+			if(tr.number_of_children(rhs)==1)
+				rhs=tr.begin(rhs);
+			}
+		else if(*rhs->name!="1") {
+			symbolic=true;
+			val=valend;
+			}
+		while(val!=valend) {
+			if(*val->name!="1" || tr.number_of_children(val)!=0) {
+				txtout << "eval: right-hand side of rule " << i+1 
+						 << " is not a number or list of numbers." << std::endl;
+				throw constructor_error();
+				}
+			vals.push_back(val->multiplier->get_d());
+			++val;
+			}
+		if(vals.size()>1) {
+			if(batch>1 && batch!=vals.size()) {
+				txtout << "eval: all lists of values should have the same length." << std::endl;
+				throw constructor_error();
+				}
+			batch=vals.size();
+			}
+
+		// A rule for a component with only index names (no values) on the
+		// left-hand side sets the value for all components not given explicitly.
+		if(*lhs->multiplier!=1) {
+			txtout << "eval: no numerical pre-factors allowed on lhs of rule " << i+1 << "." << std::endl;
+			throw constructor_error();
+			}
+		std::string key=*lhs->name, defkey=*lhs->name;
+		bool is_default=(tr.number_of_children(lhs)>0);
+		sibling_iterator ch=tr.begin(lhs);
+		while(ch!=tr.end(lhs)) {
+			if(tr.number_of_children(ch)!=0) {
+				txtout << "eval: left-hand side of rule " << i+1 
+						 << " should be a scalar or a component." << std::endl;
+				throw constructor_error();
+				}
+			key+=rel_string(ch)+value_string(ch);
+			defkey+=rel_string(ch)+"*";
+			if(!ch->is_index() || *ch->name=="1" || (properties::get<Indices>(ch, true)==0 
+																	 && properties::get<numerical::Integer>(ch, true)==0))
+				is_default=false;
+			++ch;
+			}
+		values.push_back(vals);
+		rhs_nodes.push_back(rhs);
+		if(is_default) defaults[defkey]=values.size()-1;
+		else           components[key]=values.size()-1;
+		}
+	if(symbolic && batch>1) {
+		txtout << "eval: lists of values cannot be combined with non-numerical values." << std::endl;
+		throw constructor_error();
+		}
 	}
 
-bool eval::can_apply(iterator)
+bool eval::can_apply(iterator it)
 	{
-	return true;
+	// Only act on the expression as a whole, not on its subexpressions.
+	iterator par=tr.parent(it);
+	return tr.is_valid(par) && (*par->name=="\\expression" || par==this_command);
 	}
 
 algorithm::result_t eval::apply(iterator& it)
 	{
-	return l_no_action;
+	if(symbolic)
+		return apply_symbolic(it);
+
+	// The elements of a list become separate outputs of a single program.
+	std::vector<iterator> targets;
+	if(*it->name=="\\comma") {
+		sibling_iterator sib=tr.begin(it);
+		while(sib!=tr.end(it)) {
+			targets.push_back(sib);
+			++sib;
+			}
+		}
+	else targets.push_back(it);
+
+	contracted_cache.clear();
+
+	program      prog;
+	assignment_t assign;
+	try {
+		for(size_t i=0; i<targets.size(); ++i) {
+			index_map_t ind_free, ind_dummy;
+			classify_indices(targets[i], ind_free, ind_dummy);
+			if(ind_free.size()>0) {
+				txtout << "eval: expression contains free indices." << std::endl;
+				return l_error;
+				}
+			prog.outputs.push_back(compile(prog, targets[i], assign));
+			}
+		}
+	catch(std::exception& ex) {
+		txtout << "eval: " << ex.what() << std::endl;
+		return l_error;
+		}
+
+	std::vector<double> slots;
+	prog.run(values, batch, slots);
+
+	for(size_t i=0; i<prog.outputs.size(); ++i) {
+		for(size_t b=0; b<batch; ++b) {
+			if(!std::isfinite(slots[prog.outputs[i]*batch+b])) {
+				txtout << "eval: result is not a finite number." << std::endl;
+				return l_error;
+				}
+			}
+		}
+
+	for(size_t i=0; i<targets.size(); ++i) {
+		const double *res=&slots[prog.outputs[i]*batch];
+		if(batch==1) 
+			set_number(targets[i], res[0]);
+		else {
+			tr.erase_children(targets[i]);
+			targets[i]->name=name_set.insert("\\comma").first;
+			one(targets[i]->multiplier);
+			for(size_t b=0; b<batch; ++b) 
+				set_number(tr.append_child(targets[i], str_node("1")), res[b]);
+			}
+		}
+	expression_modified=true;
+	return l_applied;
+	}
+
+// Compile a node, summing over the values of all indices which are 
+// contracted at this node.
+
+unsigned int eval::compile(program& prog, iterator it, assignment_t& assign)
+	{
+	const contracted_t& con=contracted(it);
+	if(con.size()==0)
+		return compile_node(prog, it, assign);
+	else
+		return compile_sum(prog, it, assign, con, 0);
+	}
+
+unsigned int eval::compile_sum(program& prog, iterator it, assignment_t& assign, 
+										 const contracted_t& con, unsigned int num)
+	{
+	if(num==con.size()) 
+		return compile_node(prog, it, assign);
+
+	std::vector<std::string> vals;
+	index_values(con[num].second, vals);
+	unsigned int res=0;
+	for(size_t i=0; i<vals.size(); ++i) {
+		assign[con[num].first]=vals[i];
+		unsigned int term=compile_sum(prog, it, assign, con, num+1);
+		if(i==0) res=term;
+		else     res=prog.emit(program::op_add, res, term);
+		}
+	assign.erase(con[num].first);
+	if(vals.size()==0)
+		res=prog.emit(program::op_const, 0, 0, 0);
+	return res;
+	}
+
+unsigned int eval::compile_node(program& prog, iterator it, assignment_t& assign)
+	{
+	const std::string& nm=*it->name;
+	unsigned int num=tr.number_of_children(it);
+	unsigned int res, par;
+
+	if(nm=="1") 
+		return prog.emit(program::op_const, 0, 0, it->multiplier->get_d());
+
+	if(lookup(it, assign, par)) 
+		res=prog.emit(program::op_param, par);
+	else if(nm=="\\sum" || nm=="\\prod" || (nm=="\\frac" && num>=2)) {
+		program::opcode_t op=program::op_div;
+		if(nm=="\\sum")       op=program::op_add;
+		else if(nm=="\\prod") op=program::op_mul;
+		sibling_iterator sib=tr.begin(it);
+		if(sib==tr.end(it)) 
+			res=prog.emit(program::op_const, 0, 0, (op==program::op_add)?0:1);
+		else {
+			res=compile(prog, sib, assign);
+			while(++sib!=tr.end(it)) 
+				res=prog.emit(op, res, compile(prog, sib, assign));
+			}
+		}
+	else if(nm=="\\pow" && num==2) 
+		res=prog.emit(program::op_pow, compile(prog, tr.child(it,0), assign), 
+						  compile(prog, tr.child(it,1), assign));
+	else if(num==1 && (nm=="\\sin" || nm=="\\cos" || nm=="\\tan" || nm=="\\exp" 
+							 || nm=="\\log" || nm=="\\sqrt")) {
+		program::opcode_t op=program::op_sqrt;
+		if(nm=="\\sin")      op=program::op_sin;
+		else if(nm=="\\cos") op=program::op_cos;
+		else if(nm=="\\tan") op=program::op_tan;
+		else if(nm=="\\exp") op=program::op_exp;
+		else if(nm=="\\log") op=program::op_log;
+		res=prog.emit(op, compile(prog, tr.begin(it), assign));
+		}
+	else {
+		std::string key=nm;
+		sibling_iterator ch=tr.begin(it);
+		while(ch!=tr.end(it)) {
+			assignment_t::const_iterator ai=assign.find(*ch->name);
+			key+=rel_string(ch)+(ai==assign.end()?value_string(ch):ai->second);
+			++ch;
+			}
+		throw consistency_error("no numerical value for "+key+".");
+		}
+
+	if(*it->multiplier!=1) 
+		res=prog.emit(program::op_mul, res, 
+						  prog.emit(program::op_const, 0, 0, it->multiplier->get_d()));
+	return res;
+	}
+
+// Determine the indices which are contracted at the given node: those which
+// appear free in two factors of a product, or twice on a single tensor.
+
+const eval::contracted_t& eval::contracted(iterator it)
+	{
+	std::map<iterator, contracted_t, exptree::iterator_base_less>::iterator ci=contracted_cache.find(it);
+	if(ci!=contracted_cache.end())
+		return ci->second;
+
+	contracted_t& con=contracted_cache[it];
+	std::map<std::string, std::pair<int, iterator> > count;
+	sibling_iterator sib=tr.begin(it);
+	while(sib!=tr.end(it)) {
+		if(*it->name=="\\prod") {
+			index_map_t ind_free, ind_dummy;
+			classify_indices(sib, ind_free, ind_dummy);
+			index_map_t::iterator fi=ind_free.begin();
+			while(fi!=ind_free.end()) {
+				std::pair<int, iterator>& cnt=count[*fi->second->name];
+				if(cnt.first==0) cnt.second=fi->second;
+				++cnt.first;
+				fi=ind_free.upper_bound(fi->first);
+				}
+			}
+		else if(sib->is_index() && tr.number_of_children(sib)==0 && *sib->name!="1") {
+			std::pair<int, iterator>& cnt=count[*sib->name];
+			if(cnt.first==0) cnt.second=sib;
+			++cnt.first;
+			}
+		++sib;
+		}
+	std::map<std::string, std::pair<int, iterator> >::iterator cit=count.begin();
+	while(cit!=count.end()) {
+		if(cit->second.first>1)
+			con.push_back(std::make_pair(cit->first, cit->second.second));
+		++cit;
+		}
+	return con;
+	}
+
+// The values over which an index runs, from either the 'values' key of
+// its Indices property or the range of its Integer property.
+
+void eval::index_values(iterator ind, std::vector<std::string>& vals) const
+	{
+	const Indices *inds=properties::get<Indices>(ind, true);
+	if(inds && inds->values.begin()!=inds->values.end()) {
+		sibling_iterator val=inds->values.begin(inds->values.begin());
+		while(val!=inds->values.end(inds->values.begin())) {
+			vals.push_back(value_string(val));
+			++val;
+			}
+		return;
+		}
+	const numerical::Integer *itg=properties::get<numerical::Integer>(ind, true);
+	if(itg && itg->from.begin()!=itg->from.end()) {
+		if(*itg->from.begin()->name!="1" || *itg->to.begin()->name!="1")
+			throw consistency_error("range of index "+*ind->name+" is not numerical.");
+		long from=to_long(*itg->from.begin()->multiplier);
+		long to  =to_long(*itg->to.begin()->multiplier);
+		for(long i=from; i<=to; ++i)
+			vals.push_back(to_string(i));
+		return;
+		}
+	throw consistency_error("no values known for index "+*ind->name+".");
+	}
+
+std::string eval::value_string(iterator it) const
+	{
+	if(*it->name=="1") 
+		return it->multiplier->get_str();
+	return *it->name;
+	}
+
+std::string eval::rel_string(iterator it) const
+	{
+	switch(it->fl.parent_rel) {
+		case str_node::p_sub:   return "_";
+		case str_node::p_super: return "^";
+		default:                return "|";
+		}
+	}
+
+// Find the parameter for a scalar or component; dummy index names are replaced
+// with the values they have been assigned.
+
+bool eval::lookup(iterator it, const assignment_t& assign, unsigned int& par) const
+	{
+	std::string key=*it->name, defkey=*it->name;
+	sibling_iterator ch=tr.begin(it);
+	while(ch!=tr.end(it)) {
+		if(tr.number_of_children(ch)!=0) 
+			return false;
+		assignment_t::const_iterator ai=assign.find(*ch->name);
+		key+=rel_string(ch)+(ai==assign.end()?value_string(ch):ai->second);
+		defkey+=rel_string(ch)+"*";
+		++ch;
+		}
+	std::map<std::string, unsigned int>::const_iterator fnd=components.find(key);
+	if(fnd==components.end()) {
+		if(tr.number_of_children(it)==0) 
+			return false;
+		fnd=defaults.find(defkey);
+		if(fnd==defaults.end()) 
+			return false;
+		}
+	par=fnd->second;
+	return true;
+	}
+
+// Results are displayed as rational numbers. The continued fraction expansion
+// of the floating point result is cut off at the first convergent which agrees
+// with it up to rounding errors (64 units in the last place), so that e.g. 
+// 0.333333333333333 is shown as 1/3. If no convergent with a denominator below 
+// 10^6 does, the result is not a simple fraction, and it is shown exactly, as
+// the binary fraction which the floating point number represents; residues 
+// and irrational values are never disguised as nearby fractions.
+
+void eval::set_number(iterator it, double x) const
+	{
+	multiplier_t res=x;
+	if(x!=0 && std::fabs(x)<1e15) {
+		const mpz_class maxden(1000000);
+		const double    tol=64*std::numeric_limits<double>::epsilon()*std::fabs(x);
+		mpz_class h0=0, h1=1, k0=1, k1=0;
+		double r=x;
+		for(int i=0; i<64; ++i) {
+			double    a=std::floor(r);
+			mpz_class ai(a);
+			mpz_class h2=ai*h1+h0, k2=ai*k1+k0;
+			if(k2>maxden) 
+				break;
+			h0=h1; h1=h2; k0=k1; k1=k2;
+			multiplier_t conv(h1, k1);
+			if(std::fabs(conv.get_d()-x)<=tol) {
+				res=conv;
+				res.canonicalize();
+				break;
+				}
+			if(r==a) 
+				break;
+			r=1.0/(r-a);
+			}
+		}
+
+	tr.erase_children(it);
+	it->name=name_set.insert("1").first;
+	it->multiplier=rat_set.insert(res).first;
+	}
+
+algorithm::result_t eval::apply_symbolic(iterator& it)
+	{
+	contracted_cache.clear();
+
+	exptree      res;
+	assignment_t assign;
+	bool         nonzero=false;
+	try {
+		index_map_t ind_free, ind_dummy;
+		classify_indices(it, ind_free, ind_dummy);
+		if(ind_free.size()==0) 
+			nonzero=expand(it, assign, res);
+		else {
+			// Every combination of values of the free indices for which the 
+			// expression does not vanish gives a rule.
+			contracted_t freeinds;
+			index_map_t::iterator fi=ind_free.begin();
+			while(fi!=ind_free.end()) {
+				freeinds.push_back(std::make_pair(*fi->second->name, fi->second));
+				fi=ind_free.upper_bound(fi->first);
+				}
+			res.set_head(str_node("\\comma"));
+			expand_free(it, assign, freeinds, 0, res);
+			nonzero=(res.number_of_children(res.begin())>0);
+			}
+		}
+	catch(std::exception& ex) {
+		txtout << "eval: " << ex.what() << std::endl;
+		return l_error;
+		}
+
+	if(nonzero) {
+		it=tr.replace(it, res.begin());
+		cleanup_expression(tr, it);
+		}
+	else node_zero(it);
+	expression_modified=true;
+	return l_applied;
+	}
+
+// Expand a node symbolically, summing over the values of all indices which are
+// contracted at this node. Returns false if the result vanishes, in which case
+// the content of 'res' should be ignored.
+
+bool eval::expand(iterator it, assignment_t& assign, exptree& res)
+	{
+	const contracted_t& con=contracted(it);
+	if(con.size()==0)
+		return expand_node(it, assign, res);
+
+	res.set_head(str_node("\\sum", it->fl.bracket, it->fl.parent_rel));
+	expand_sum(it, assign, con, 0, res);
+	unsigned int terms=res.number_of_children(res.begin());
+	if(terms==0) 
+		return false;
+	if(terms==1) {
+		iterator top=res.begin();
+		res.flatten(top);
+		res.erase(top);
+		}
+	return true;
+	}
+
+void eval::expand_sum(iterator it, assignment_t& assign, const contracted_t& con, 
+							 unsigned int num, exptree& sum)
+	{
+	if(num==con.size()) {
+		exptree term;
+		if(expand_node(it, assign, term)) {
+			term.begin()->fl.bracket=str_node::b_none;
+			term.begin()->fl.parent_rel=str_node::p_none;
+			sum.append_child(sum.begin(), term.begin());
+			}
+		return;
+		}
+
+	std::vector<std::string> vals;
+	index_values(con[num].second, vals);
+	for(size_t i=0; i<vals.size(); ++i) {
+		assign[con[num].first]=vals[i];
+		expand_sum(it, assign, con, num+1, sum);
+		}
+	assign.erase(con[num].first);
+	}
+
+void eval::expand_free(iterator it, assignment_t& assign, const contracted_t& freeinds, 
+							  unsigned int num, exptree& rules)
+	{
+	if(num==freeinds.size()) {
+		exptree val;
+		if(expand(it, assign, val)) {
+			iterator arrow=rules.append_child(rules.begin(), str_node("\\arrow"));
+			iterator lhs=rules.append_child(arrow, it);
+			lhs->fl.bracket=str_node::b_none;
+			lhs->fl.parent_rel=str_node::p_none;
+			iterator walk=lhs, end=lhs;
+			end.skip_children();
+			++end;
+			while(walk!=end) {
+				if(walk->is_index() && rules.number_of_children(walk)==0) {
+					assignment_t::const_iterator ai=assign.find(*walk->name);
+					if(ai!=assign.end())
+						set_value(walk, ai->second);
+					}
+				++walk;
+				}
+			val.begin()->fl.bracket=str_node::b_none;
+			val.begin()->fl.parent_rel=str_node::p_none;
+			rules.append_child(arrow, val.begin());
+			}
+		return;
+		}
+
+	std::vector<std::string> vals;
+	index_values(freeinds[num].second, vals);
+	for(size_t i=0; i<vals.size(); ++i) {
+		assign[freeinds[num].first]=vals[i];
+		expand_free(it, assign, freeinds, num+1, rules);
+		}
+	assign.erase(freeinds[num].first);
+	}
+
+// Expand a node for the given values of the dummy indices. Scalars and components
+// are replaced with the right-hand sides of their rules; components for which no 
+// rule is given vanish, scalars for which no rule is given are kept.
+
+bool eval::expand_node(iterator it, assignment_t& assign, exptree& res)
+	{
+	if(*it->multiplier==0) 
+		return false;
+
+	const std::string& nm=*it->name;
+	unsigned int par;
+	if(lookup(it, assign, par)) {
+		res=exptree(rhs_nodes[par]);
+		if(*res.begin()->multiplier==0)
+			return false;
+		}
+	else if(nm=="\\sum" || nm=="\\prod") {
+		res.set_head(str_node(nm));
+		sibling_iterator sib=tr.begin(it);
+		while(sib!=tr.end(it)) {
+			exptree sub;
+			if(expand(sib, assign, sub)) 
+				res.append_child(res.begin(), sub.begin());
+			else if(nm=="\\prod")
+				return false;
+			++sib;
+			}
+		if(res.number_of_children(res.begin())==0) 
+			return false;
+		}
+	else if(is_component(it)) 
+		return false;
+	else {
+		str_node head(*it);
+		one(head.multiplier);
+		res.set_head(head);
+		sibling_iterator sib=tr.begin(it);
+		while(sib!=tr.end(it)) {
+			if(sib->is_index() && tr.number_of_children(sib)==0) {
+				iterator ind=res.append_child(res.begin(), *sib);
+				assignment_t::const_iterator ai=assign.find(*sib->name);
+				if(ai!=assign.end())
+					set_value(ind, ai->second);
+				}
+			else {
+				exptree sub;
+				if(expand(sib, assign, sub)) 
+					res.append_child(res.begin(), sub.begin());
+				else 
+					zero(res.append_child(res.begin(), str_node("1"))->multiplier);
+				}
+			++sib;
+			}
+		}
+
+	iterator top=res.begin();
+	top->fl.bracket=it->fl.bracket;
+	top->fl.parent_rel=it->fl.parent_rel;
+	multiply(top->multiplier, *it->multiplier);
+	return true;
+	}
+
+// A component is a node which carries indices only, all of which have values.
+
+bool eval::is_component(iterator it) const
+	{
+	if(tr.number_of_children(it)==0) 
+		return false;
+	sibling_iterator sib=tr.begin(it);
+	while(sib!=tr.end(it)) {
+		if(!sib->is_index() || tr.number_of_children(sib)!=0) 
+			return false;
+		++sib;
+		}
+	return true;
+	}
+
+// Give an index node the value obtained from index_values: either a number,
+// or the name of a coordinate.
+
+void eval::set_value(iterator ind, const std::string& val) const
+	{
+	if(val.size()>0 && (isdigit(val[0]) || val[0]=='-')) {
+		ind->name=name_set.insert("1").first;
+		ind->multiplier=rat_set.insert(multiplier_t(val)).first;
+		}
+	else {
+		ind->name=name_set.insert(val).first;
+		one(ind->multiplier);
+		}
+	}
+
+unsigned int eval::program::emit(opcode_t op, unsigned int arg1, unsigned int arg2, double value)
+	{
+	if((op==op_add || op==op_mul) && arg2<arg1)
+		std::swap(arg1, arg2);
+	key_t key(op, arg1, arg2, value);
+	std::map<key_t, unsigned int>::iterator fnd=emitted.find(key);
+	if(fnd!=emitted.end())
+		return fnd->second;
+
+	instruction ins;
+	ins.op=op;
+	ins.arg1=arg1;
+	ins.arg2=arg2;
+	ins.value=value;
+	code.push_back(ins);
+	emitted[key]=code.size()-1;
+	return code.size()-1;
+	}
+
+void eval::program::run(const std::vector<std::vector<double> >& params, size_t batch, 
+								std::vector<double>& slots) const
+	{
+	slots.resize(code.size()*batch);
+	for(size_t i=0; i<code.size(); ++i) {
+		const instruction& ins=code[i];
+		double       *out=&slots[i*batch];
+		const double *x=0, *y=0;
+		if(ins.op!=op_const && ins.op!=op_param) {
+			x=&slots[ins.arg1*batch];
+			y=&slots[ins.arg2*batch];
+			}
+		switch(ins.op) {
+			case op_const:
+				for(size_t b=0; b<batch; ++b) out[b]=ins.value;
+				break;
+			case op_param: {
+				const std::vector<double>& p=params[ins.arg1];
+				for(size_t b=0; b<batch; ++b) out[b]=p[p.size()==1?0:b];
+				break;
+				}
+			case op_add:
+				for(size_t b=0; b<batch; ++b) out[b]=x[b]+y[b];
+				break;
+			case op_mul:
+				for(size_t b=0; b<batch; ++b) out[b]=x[b]*y[b];
+				break;
+			case op_div:
+				for(size_t b=0; b<batch; ++b) out[b]=x[b]/y[b];
+				break;
+			case op_pow:
+				for(size_t b=0; b<batch; ++b) out[b]=std::pow(x[b], y[b]);
+				break;
+			case op_sin:
+				for(size_t b=0; b<batch; ++b) out[b]=std::sin(x[b]);
+				break;
+			case op_cos:
+				for(size_t b=0; b<batch; ++b) out[b]=std::cos(x[b]);
+				break;
+			case op_tan:
+				for(size_t b=0; b<batch; ++b) out[b]=std::tan(x[b]);
+				break;
+			case op_exp:
+				for(size_t b=0; b<batch; ++b) out[b]=std::exp(x[b]);
+				break;
+			case op_log:
+				for(size_t b=0; b<batch; ++b) out[b]=std::log(x[b]);
+				break;
+			case op_sqrt:
+				for(size_t b=0; b<batch; ++b) out[b]=std::sqrt(x[b]);
+				break;
+			}
+		}
 	}
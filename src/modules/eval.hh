@@ -22,6 +22,17 @@
 #define eval_hh_
 
 #include "algorithm.hh"
+#include <map>
+#include <tuple>
+
+/// Numerical evaluation of scalar expressions, with values for scalars
+/// and tensor components given as replacement rules. The expression is
+/// compiled once into a flat program, which is then run on all parameter
+/// points (lists of values on the right-hand sides of the rules) in one go.
+///
+/// When some of the rules have a non-numerical right-hand side, the
+/// expression is instead expanded symbolically over all index values,
+/// and free indices give a list of rules, one for every non-zero component.
 
 class eval : public algorithm {
 	public:
@@ -29,6 +40,63 @@ class eval : public algorithm {
 
 		virtual bool     can_apply(iterator);
 		virtual result_t apply(iterator&);
+
+		class program {
+			public:
+				enum opcode_t { op_const, op_param, op_add, op_mul, op_div, op_pow, 
+									 op_sin, op_cos, op_tan, op_exp, op_log, op_sqrt };
+
+				class instruction {
+					public:
+						opcode_t     op;
+						unsigned int arg1, arg2;
+						double       value;
+				};
+
+				/// Add an instruction, or return the slot of an identical one
+				/// which was emitted before.
+				unsigned int emit(opcode_t, unsigned int arg1=0, unsigned int arg2=0, double value=0);
+				/// Run all instructions on 'batch' points at once; the result of 
+				/// instruction i for point b ends up in slots[i*batch+b].
+				void         run(const std::vector<std::vector<double> >& params, size_t batch,
+									  std::vector<double>& slots) const;
+
+				std::vector<instruction>  code;
+				std::vector<unsigned int> outputs;
+			private:
+				typedef std::tuple<int, unsigned int, unsigned int, double> key_t;
+				std::map<key_t, unsigned int> emitted;
+		};
+
+	private:
+		/// Values of index names which are being summed over.
+		typedef std::map<std::string, std::string> assignment_t;
+		typedef std::vector<std::pair<std::string, iterator> > contracted_t;
+
+		std::map<std::string, unsigned int> components, defaults;
+		std::vector<std::vector<double> >   values;
+		std::vector<iterator>               rhs_nodes;
+		size_t                              batch;
+		bool                                symbolic;
+		std::map<iterator, contracted_t, exptree::iterator_base_less> contracted_cache;
+
+		unsigned int compile(program&, iterator, assignment_t&);
+		unsigned int compile_node(program&, iterator, assignment_t&);
+		unsigned int compile_sum(program&, iterator, assignment_t&, const contracted_t&, unsigned int);
+		const contracted_t& contracted(iterator);
+		void         index_values(iterator, std::vector<std::string>&) const;
+		std::string  value_string(iterator) const;
+		std::string  rel_string(iterator) const;
+		bool         lookup(iterator, const assignment_t&, unsigned int&) const;
+		void         set_number(iterator, double) const;
+
+		result_t     apply_symbolic(iterator&);
+		bool         expand(iterator, assignment_t&, exptree&);
+		bool         expand_node(iterator, assignment_t&, exptree&);
+		void         expand_sum(iterator, assignment_t&, const contracted_t&, unsigned int, exptree&);
+		void         expand_free(iterator, assignment_t&, const contracted_t&, unsigned int, exptree&);
+		bool         is_component(iterator) const;
+		void         set_value(iterator, const std::string&) const;
 };
 
 
@@ -714,6 +714,11 @@ eliminate_kronecker::eliminate_kronecker(exptree& tr, iterator it)
 	{
 	}
 
+std::shared_ptr<algorithm> eliminate_kronecker::termwise_instance(exptree& tr_, iterator it_) const
+	{
+	return create<eliminate_kronecker>(tr_, it_);
+	}
+
 bool eliminate_kronecker::can_apply(iterator st)
 	{
 	if(*st->name!="\\prod") 
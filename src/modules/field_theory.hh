@@ -142,6 +142,7 @@ class eliminate_kronecker : public algorithm {
 
 		virtual bool     can_apply(iterator);
 		virtual result_t apply(iterator&);
+		virtual std::shared_ptr<algorithm> termwise_instance(exptree&, iterator) const;
 };
 
 class reduce_gendelta : public algorithm {
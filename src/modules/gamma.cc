@@ -28,6 +28,8 @@
 #include "numerical.hh"
 #include <utility>
 #include <algorithm>
+#include <map>
+#include <mutex>
 
 void gamma_algebra::register_properties()
 	{
@@ -162,6 +164,101 @@ std::string GammaTraceless::name() const
 	return "GammaTraceless";
 	}
 
+// Tables for join{expand}. The terms produced for 'i' contracted index
+// pairs are permutations of the index lists r1 and r2 (as built by
+// join::regroup_indices_), each with a sign and a combinatorial factor.
+// As long as no index appears twice on one gamma matrix, these depend only
+// on the positions in r1 and r2, so they are computed once per
+// (num1, num2, i, gendelta) and stored as positions.
+
+namespace {
+
+class join_table {
+	public:
+		std::vector<std::vector<unsigned int> > perm1, perm2;
+		std::vector<int>                        factor1, factor2;
+};
+
+typedef std::map<std::vector<unsigned int>, join_table> join_tables_t;
+join_tables_t join_tables;
+std::mutex    join_mutex;
+
+void join_sublengths(unsigned int num1, unsigned int num2, unsigned int i, bool gendelta,
+							std::vector<unsigned int>& sub1, std::vector<unsigned int>& sub2)
+	{
+	if(num1-i>0)
+		sub1.push_back(num1-i);
+	if(num2-i>0) 
+		sub2.push_back(num2-i);
+	if(gendelta && i>0)
+		sub1.push_back(i);
+	else {
+		for(unsigned int k=0; k<i; ++k)
+			sub1.push_back(1); // the individual \deltas, antisymmetrise 'first' group
+		}
+	if(i>0) 
+		sub2.push_back(i); // the individual \deltas, do not antisymmetrise again.
+	}
+
+void fill_join_table(unsigned int num, const std::vector<unsigned int>& sublengths,
+							std::vector<std::vector<unsigned int> >& perm, std::vector<int>& factor)
+	{
+	std::vector<unsigned int> positions;
+	for(unsigned int k=0; k<num; ++k)
+		positions.push_back(k);
+
+	combin::combinations<unsigned int> c(positions);
+	c.sublengths=sublengths;
+	c.permute();
+	for(unsigned int k=0; k<c.size(); ++k) {
+		perm.push_back(c[k]);
+		factor.push_back((int)c.multiplier(k)
+							  *combin::ordersign(c[k].begin(), c[k].end(), positions.begin(), positions.end()));
+		}
+	}
+
+const join_table& get_join_table(unsigned int num1, unsigned int num2, unsigned int i, bool gendelta)
+	{
+	std::vector<unsigned int> key;
+	key.push_back(num1);
+	key.push_back(num2);
+	key.push_back(i);
+	key.push_back(gendelta);
+
+	std::lock_guard<std::mutex> lock(join_mutex);
+	join_tables_t::const_iterator it=join_tables.find(key);
+	if(it!=join_tables.end())
+		return it->second;
+
+	join_table tab;
+	std::vector<unsigned int> sub1, sub2;
+	join_sublengths(num1, num2, i, gendelta, sub1, sub2);
+	fill_join_table(num1, sub1, tab.perm1, tab.factor1);
+	fill_join_table(num2, sub2, tab.perm2, tab.factor2);
+	return join_tables.insert(std::make_pair(key, tab)).first->second;
+	}
+
+bool all_different(const std::vector<exptree>& r)
+	{
+	for(unsigned int i=0; i<r.size(); ++i)
+		for(unsigned int j=i+1; j<r.size(); ++j)
+			if(r[i]==r[j])
+				return false;
+	return true;
+	}
+
+}
+
+void join::prebuild(unsigned int maxind)
+	{
+	for(unsigned int num1=1; num1<=maxind; ++num1)
+		for(unsigned int num2=1; num2<=maxind; ++num2)
+			for(unsigned int i=0; i<=std::min(num1, num2); ++i) {
+				get_join_table(num1, num2, i, false);
+				get_join_table(num1, num2, i, true);
+				}
+	}
+
 join::join(exptree& tr_, iterator it_)
 	: algorithm(tr_, it_), expand(false), use_generalised_delta_(false)
 	{
@@ -383,21 +480,40 @@ algorithm::result_t join::apply(iterator& st)
 		if(!expand) {
 			append_prod_(r1, r2, num1, num2, i, mult, rep, top);
 			}
+		else if(!has_argument("\\comma") && all_different(r1) && all_different(r2)) {
+			const join_table& tab=get_join_table(num1, num2, i, use_generalised_delta_);
+			std::vector<std::vector<exptree> > p1(tab.perm1.size()), p2(tab.perm2.size());
+			for(unsigned int k=0; k<p1.size(); ++k)
+				for(unsigned int j=0; j<tab.perm1[k].size(); ++j)
+					p1[k].push_back(r1[tab.perm1[k][j]]);
+			for(unsigned int l=0; l<p2.size(); ++l)
+				for(unsigned int j=0; j<tab.perm2[l].size(); ++j)
+					p2[l].push_back(r2[tab.perm2[l][j]]);
+
+			multiplier_t mul=1;
+			if(use_generalised_delta_)
+				mul=combin::fact(i);
+
+			for(unsigned int k=0; k<p1.size(); ++k) {
+				for(unsigned int l=0; l<p2.size(); ++l) {
+					if(interrupted) {
+						txtout << "join interrupted while producing GammaMatrix[" << num1+num2-2*i 
+								 << "] terms." << std::endl;
+						interrupted=false;
+						st=tr.end();
+						return l_error;
+						}
+					append_prod_(p1[k], p2[l], num1, num2, i, 
+									 mul*tab.factor1[k]*tab.factor2[l], rep, top);
+					}
+				}
+			}
 		else {
+			// Repeated indices or explicit antisymmetry information: the signs and
+			// factors depend on the indices themselves, so permute them directly.
 			combin::combinations<exptree> c1(r1);
 			combin::combinations<exptree> c2(r2);
-			if(num1-i>0)
-				c1.sublengths.push_back(num1-i);
-			if(num2-i>0) 
-				c2.sublengths.push_back(num2-i);
-			if(use_generalised_delta_ && i>0)
-				c1.sublengths.push_back(i);
-			else {
-				for(unsigned int k=0; k<i; ++k)
-					c1.sublengths.push_back(1); // the individual \deltas, antisymmetrise 'first' group
-				}
-			if(i>0) 
-				c2.sublengths.push_back(i); // the individual \deltas, do not antisymmetrise again.
+			join_sublengths(num1, num2, i, use_generalised_delta_, c1.sublengths, c2.sublengths);
 
 			// Collect information about which indices to write in implicit antisymmetric form.
 			// FIXME: this should move into combinatorics.hh
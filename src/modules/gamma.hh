@@ -80,6 +80,10 @@ class join : public algorithm {
 		virtual bool     can_apply(iterator);
 		virtual result_t apply(iterator&);
 
+		/// Build the {expand} tables for all pairs of gamma matrices with up to
+		/// 'maxind' indices each, so that later calls only substitute indices.
+		static void prebuild(unsigned int maxind);
+
 		bool expand;
 		std::vector<int>     only_expand;
 		const GammaMatrix   *gm1, *gm2;
@@ -19,211 +19,447 @@
 */
 
 #include "lie.hh"
-#include "config.h"
 #include <stdlib.h>
 #include <stdexcept>
-#include <sstream>
-#include <iostream>
-#include <sys/types.h>
-#include <sys/wait.h>
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <unordered_map>
+#include <mutex>
 #include <assert.h>
-#include <cstdio>
 
-LiE::LiE_t::LiE_t(algebra_t a, unsigned int d)
-	: algebra_type(a), algebra_dim(d), lie_proc("ptywrap"), curchar(-1)
+namespace {
+
+// Weights are handled in the orthogonal basis, with all coordinates doubled
+// so that spinor weights are integral too. Type A_n uses n+1 coordinates.
+
+typedef std::vector<int> weight_t;
+
+class weight_hash {
+	public:
+		size_t operator()(const weight_t& w) const
+			{
+			size_t ret=w.size();
+			for(size_t i=0; i<w.size(); ++i)
+				ret=ret*1000003 ^ (size_t)(w[i]+0x8000);
+			return ret;
+			}
+};
+
+typedef std::unordered_map<weight_t, long, weight_hash> character_t;
+typedef std::map<weight_t, long>                        decomposition_t; // Dynkin labels -> multiplicity
+
+weight_t operator+(const weight_t& one, const weight_t& two)
 	{
+	weight_t ret(one);
+	for(size_t i=0; i<ret.size(); ++i)
+		ret[i]+=two[i];
+	return ret;
 	}
 
-LiE::LiE_t::~LiE_t()
+long dot(const weight_t& one, const weight_t& two)
 	{
-	stop();
+	long ret=0;
+	for(size_t i=0; i<one.size(); ++i)
+		ret+=one[i]*two[i];
+	return ret;
 	}
 
-LiE::LiE_t::rep_t::rep_t()
-	: multiplicity(1)
+int permutation_sign(const std::vector<unsigned int>& perm)
 	{
+	int inversions=0;
+	for(size_t i=0; i<perm.size(); ++i)
+		for(size_t j=i+1; j<perm.size(); ++j)
+			if(perm[i]>perm[j]) ++inversions;
+	return (inversions%2==0)?1:-1;
 	}
 
-void LiE::LiE_t::start()
+// Remove vanishing terms; intermediate results may be virtual representations,
+// so the check for negative multiplicities is left to the caller.
+
+void prune(decomposition_t& dec)
+	{
+	decomposition_t::iterator it=dec.begin();
+	while(it!=dec.end()) {
+		if(it->second==0) dec.erase(it++);
+		else ++it;
+		}
+	}
+
+class algebra {
+	public:
+		algebra(char type, unsigned int rank);
+
+		weight_t               to_orthogonal(const std::vector<int>& dynkin) const;
+		std::vector<int>       to_dynkin(const weight_t&) const;
+
+		/// Map a weight into the dominant chamber. Returns false if it is fixed by
+		/// a reflection, otherwise sets 'sign' to that of the Weyl group element used.
+		bool                   regular_dominant(weight_t&, int& sign) const;
+
+		unsigned long          dim(const weight_t& highest) const;
+		const character_t&     irrep(const weight_t& highest);
+		const decomposition_t& product(const weight_t&, const weight_t&);
+
+		/// Add 'mult' times the decomposition of a character, with all weights
+		/// shifted by 'shift', to 'res' (Brauer-Klimyk).
+		void                   decompose(const character_t&, const weight_t& shift, long mult, 
+												   decomposition_t& res) const;
+
+		weight_t               zero;
+		std::map<std::vector<int>, decomposition_t> results; // for LiE_t, by operation and arguments
+	private:
+		char                  type;
+		unsigned int          rank, coords;
+		weight_t              rho;
+		std::vector<weight_t> positive_roots, simple_roots;
+
+		std::map<weight_t, character_t>                          irreps;
+		std::map<std::pair<weight_t, weight_t>, decomposition_t> products;
+};
+
+algebra::algebra(char t, unsigned int r)
+	: type(t), rank(r), coords(t=='A'?r+1:r)
 	{
-	if(lie_proc.get_pid()==0) {
-		lie_proc << "lie";
-		try {
-			lie_proc.fork();
+	if(rank==0 || (type=='D' && rank<2) || (type!='A' && type!='B' && type!='C' && type!='D'))
+		throw std::logic_error("Representations of this algebra are not supported.");
+
+	zero.resize(coords, 0);
+	rho.resize(coords);
+	for(unsigned int i=0; i<coords; ++i) {
+		switch(type) {
+			case 'A': 
+			case 'C': rho[i]=2*(rank-i);   break;
+			case 'B': rho[i]=2*(rank-i)-1; break;
+			case 'D': rho[i]=2*(rank-i)-2; break;
 			}
-		catch(std::logic_error& err) {
-			throw std::logic_error("Failed to start LiE.");
+		}
+
+	for(unsigned int i=0; i<coords; ++i) {
+		for(unsigned int j=i+1; j<coords; ++j) {
+			weight_t alpha(zero);
+			alpha[i]=2;
+			alpha[j]=-2;
+			positive_roots.push_back(alpha);
+			if(j==i+1) 
+				simple_roots.push_back(alpha);
+			if(type!='A') {
+				alpha[j]=2;
+				positive_roots.push_back(alpha);
+				}
+			}
+		if(type=='B' || type=='C') {
+			weight_t alpha(zero);
+			alpha[i]=(type=='B')?2:4;
+			positive_roots.push_back(alpha);
 			}
-		pid=lie_proc.get_pid();
-		wait_prompt();
-		lie_proc.write("maxobjects 1000000\n");
-		wait_prompt();
 		}
-	else throw std::logic_error("Already running");
+	weight_t alpha(zero);
+	switch(type) {
+		case 'B': alpha[rank-1]=2; break;
+		case 'C': alpha[rank-1]=4; break;
+		case 'D': alpha[rank-2]=2; alpha[rank-1]=2; break;
+		}
+	if(type!='A')
+		simple_roots.push_back(alpha);
+	}
+
+weight_t algebra::to_orthogonal(const std::vector<int>& dynkin) const
+	{
+	if(dynkin.size()!=rank) 
+		throw std::logic_error("Weight does not match the rank of the algebra.");
+	for(unsigned int i=0; i<rank; ++i)
+		if(dynkin[i]<0)
+			throw std::logic_error("Highest weight is not dominant.");
+
+	weight_t ret(zero);
+	int i=rank-1;
+	switch(type) {
+		case 'A': ret[i]=2*dynkin[i];               break;
+		case 'B': ret[i]=dynkin[i];                 break;
+		case 'C': ret[i]=2*dynkin[i];               break;
+		case 'D': ret[i]=dynkin[i]-dynkin[i-1];
+			       --i;
+			       ret[i]=dynkin[i]+dynkin[i+1];    break;
+		}
+	for(--i; i>=0; --i)
+		ret[i]=2*dynkin[i]+ret[i+1];
+	return ret;
 	}
 
-void LiE::LiE_t::stop()
+std::vector<int> algebra::to_dynkin(const weight_t& w) const
 	{
-	if(lie_proc.get_pid()!=0) {
-		lie_proc.write("quit\n");
-		lie_proc.wait();
-		lie_proc.close();
-//		lie_proc.terminate();
+	std::vector<int> ret(rank);
+	for(unsigned int i=0; i+1<rank; ++i)
+		ret[i]=(w[i]-w[i+1])/2;
+	switch(type) {
+		case 'A': ret[rank-1]=(w[rank-1]-w[rank])/2; break;
+		case 'B': ret[rank-1]=w[rank-1];             break;
+		case 'C': ret[rank-1]=w[rank-1]/2;           break;
+		case 'D': ret[rank-1]=(w[rank-2]+w[rank-1])/2; break;
 		}
+	return ret;
 	}
 
+// The Weyl group permutes the coordinates (A), and for the other types also
+// changes their signs (an even number of them for D).
 
-void LiE::LiE_t::wait_prompt() 
+bool algebra::regular_dominant(weight_t& w, int& sign) const
 	{
-	int ch;
-	while((ch=kgetc())!=EOF)
-		if(ch=='>') 
+	int  negatives=0;
+	bool zero_present=false;
+	if(type!='A') {
+		for(unsigned int i=0; i<coords; ++i) {
+			if(w[i]<0) {
+				w[i]=-w[i];
+				++negatives;
+				}
+			else if(w[i]==0) zero_present=true;
+			}
+		}
+
+	int inversions=0;
+	for(unsigned int i=0; i<coords; ++i) 
+		for(unsigned int j=i+1; j<coords; ++j) {
+			if(w[i]==w[j]) return false;
+			if(w[i]<w[j])  ++inversions;
+			}
+	std::sort(w.begin(), w.end(), std::greater<int>());
+	sign=(inversions%2==0)?1:-1;
+
+	switch(type) {
+		case 'B':
+		case 'C':
+			if(zero_present) return false;
+			if(negatives%2==1) sign=-sign;
+			break;
+		case 'D':
+			if(negatives%2==1) w[coords-1]=-w[coords-1];
 			break;
+		}
+	return true;
 	}
 
-// Also waits for a whitespace character, so that we
-// don't read the echo of the input (assumes that all
-// output starts with a whitespace character).
-//
-void LiE::LiE_t::wait_newline()
+unsigned long algebra::dim(const weight_t& highest) const
 	{
-	int ch;
-	bool waiting_for_space=true; //false;
-	while((ch=kgetc())!=EOF) {
-		if(waiting_for_space && isspace(ch)) {
-			kungetc(ch);
-			break;
-			}
-		if(!waiting_for_space && ch=='\n')
-			waiting_for_space=true;
-		else
-			waiting_for_space=false;
+	const weight_t lr=highest+rho;
+	unsigned long num=1, den=1;
+	for(size_t i=0; i<positive_roots.size(); ++i) {
+		num*=dot(lr, positive_roots[i]);
+		den*=dot(rho, positive_roots[i]);
+		unsigned long a=num, b=den;
+		while(b!=0) { unsigned long t=a%b; a=b; b=t; }
+		num/=a;
+		den/=a;
 		}
+	assert(den==1);
+	return num;
 	}
 
-void LiE::LiE_t::eat_white()
+// Freudenthal's formula, level by level down from the highest weight. All
+// weights of level n+1 are obtained from those of level n by subtracting a
+// simple root, and their multiplicities only depend on higher levels.
+
+const character_t& algebra::irrep(const weight_t& highest)
 	{
-	int ch;
-	do {
-		ch=kgetc();
-		if(ch==EOF) break;
-		} while(isspace(ch));
+	std::map<weight_t, character_t>::iterator it=irreps.find(highest);
+	if(it!=irreps.end()) 
+		return it->second;
+
+	character_t& ch=irreps[highest];
+	ch[highest]=1;
+
+	const weight_t lr=highest+rho;
+	const long     norm=dot(lr, lr), maxlen=dot(highest, highest);
+	std::vector<weight_t> level(1, highest);
+	while(level.size()>0) {
+		std::vector<weight_t> candidates;
+		for(size_t i=0; i<level.size(); ++i) {
+			for(size_t j=0; j<simple_roots.size(); ++j) {
+				weight_t cand(level[i]);
+				for(unsigned int k=0; k<coords; ++k)
+					cand[k]-=simple_roots[j][k];
+				if(ch.find(cand)==ch.end() && std::find(candidates.begin(), candidates.end(), cand)==candidates.end())
+					candidates.push_back(cand);
+				}
+			}
+		level.clear();
+		for(size_t i=0; i<candidates.size(); ++i) {
+			const weight_t& mu=candidates[i];
+			if(dot(mu, mu)>maxlen) continue;
+			const weight_t mr=mu+rho;
+			long den=norm-dot(mr, mr);
+			if(den<=0) continue;
+			long num=0;
+			for(size_t j=0; j<positive_roots.size(); ++j) {
+				weight_t w=mu+positive_roots[j];
+				while(dot(w, w)<=maxlen) {
+					character_t::const_iterator fnd=ch.find(w);
+					if(fnd!=ch.end())
+						num+=fnd->second*dot(w, positive_roots[j]);
+					for(unsigned int k=0; k<coords; ++k)
+						w[k]+=positive_roots[j][k];
+					}
+				}
+			assert((2*num)%den==0);
+			if(num>0) {
+				ch[mu]=2*num/den;
+				level.push_back(mu);
+				}
+			}
+		}
+	return ch;
 	}
 
-int LiE::LiE_t::read_int()
+const decomposition_t& algebra::product(const weight_t& one, const weight_t& two)
 	{
-	char buf[20];
-	int bufp=0;
-	while(isspace(buf[bufp]=kgetc()));
-	++bufp;
-	while(isdigit(buf[bufp++]=kgetc()))
-		if(bufp==sizeof(buf)-1)
-			break;
-	kungetc(buf[bufp-1]);
-	buf[bufp]=0;
-	return atoi(buf);
+	std::pair<weight_t, weight_t> key=std::make_pair(std::min(one, two), std::max(one, two));
+	std::map<std::pair<weight_t, weight_t>, decomposition_t>::iterator it=products.find(key);
+	if(it!=products.end())
+		return it->second;
+
+	// Run over the weights of the smaller representation.
+	decomposition_t& res=products[key];
+	if(dim(key.first)<=dim(key.second))
+		decompose(irrep(key.first), key.second, 1, res);
+	else
+		decompose(irrep(key.second), key.first, 1, res);
+	prune(res);
+	return res;
 	}
 
-void LiE::LiE_t::kungetc(int ch)
+void algebra::decompose(const character_t& ch, const weight_t& shift, long mult, decomposition_t& res) const
 	{
-	curchar=ch;
+	const weight_t sr=shift+rho;
+	for(character_t::const_iterator it=ch.begin(); it!=ch.end(); ++it) {
+		weight_t w=it->first+sr;
+		int      sign;
+		if(regular_dominant(w, sign)) {
+			for(unsigned int k=0; k<coords; ++k)
+				w[k]-=rho[k];
+			res[to_dynkin(w)]+=sign*mult*it->second;
+			}
+		}
 	}
 
-int LiE::LiE_t::kgetc()
+void multiply(algebra& alg, const decomposition_t& one, const decomposition_t& two, decomposition_t& res)
 	{
-	char buf[2];
-	if(curchar==-1) {
-//		std::cerr << "calling read" << std::endl;
-		if(lie_proc.read(buf, 1)==0) {
-//			std::cerr << "eof" << std::endl;
-			return EOF;
+	for(decomposition_t::const_iterator it1=one.begin(); it1!=one.end(); ++it1) {
+		const weight_t w1=alg.to_orthogonal(it1->first);
+		for(decomposition_t::const_iterator it2=two.begin(); it2!=two.end(); ++it2) {
+			const decomposition_t& prod=alg.product(w1, alg.to_orthogonal(it2->first));
+			for(decomposition_t::const_iterator it=prod.begin(); it!=prod.end(); ++it)
+				res[it->first]+=it1->second*it2->second*it->second;
 			}
-//		std::cerr << buf[0] << std::flush;
 		}
-	else {
-		buf[0]=curchar;
-		curchar=-1;
+	}
+
+void add(character_t& res, const character_t& ch, long mult)
+	{
+	for(character_t::const_iterator it=ch.begin(); it!=ch.end(); ++it)
+		res[it->first]+=mult*it->second;
+	}
+
+// Adams operation: the character with all weights multiplied by k.
+
+void adams(const character_t& ch, int k, character_t& res)
+	{
+	for(character_t::const_iterator it=ch.begin(); it!=ch.end(); ++it) {
+		weight_t w(it->first);
+		for(size_t i=0; i<w.size(); ++i)
+			w[i]*=k;
+		res[w]+=it->second;
 		}
-	return buf[0];
 	}
 
-void LiE::LiE_t::read_replist(std::vector<rep_t>& reps) 
+void character(algebra& alg, const decomposition_t& dec, character_t& res)
 	{
-	char         buffer[200];
-	unsigned int bufpt=0;
-	rep_t        tmp;
-	int          ch;
+	for(decomposition_t::const_iterator it=dec.begin(); it!=dec.end(); ++it)
+		add(res, alg.irrep(alg.to_orthogonal(it->first)), it->second);
+	}
 
-	std::vector<parsemode_t> stck;
-	stck.push_back(START);
+// Symmetric (or antisymmetric) powers 0..k of a representation, from Newton's
+// identities, k h_k = sum_i psi^i h_{k-i} and k e_k = sum_i (-1)^{i-1} psi^i e_{k-i}.
+// The products are decomposed directly (psi^i is Weyl invariant), so only the
+// characters of the psi^i are ever written out.
 
-	while(stck.size()>0 && bufpt<sizeof(buffer)) {
-		ch=kgetc();
-//		std::cout << ch;
-		if(ch==EOF) break;
-		if(isspace(ch)) continue; // whitespace is never relevant in LiE
-		switch(stck.back()) {
-			case START:
-				if(ch=='>') {
-					kungetc(ch);
-					stck.clear();
-					}
-				else {
-					kungetc(ch);
-					bufpt=0;
-					stck.push_back(MULT);
-					}
-				break;
-			case MULT:
-				if(ch=='X') {
-					kgetc(); // read '[' too
-					buffer[bufpt]=0;
-					tmp.multiplicity=atoi(buffer);
-					bufpt=0;
-					tmp.weight.clear();
-					stck.pop_back();
-					stck.push_back(REP);
-					}
-				else {
-					buffer[bufpt++]=ch;
-					}
-				break;
-			case REP:
-				if(ch==']') {
-					buffer[bufpt]=0;
-					tmp.weight.push_back(atoi(buffer));
-					stck.pop_back();
-					reps.push_back(tmp);
-					}
-				else if(ch==',') {
-					buffer[bufpt++]=0;
-					tmp.weight.push_back(atoi(buffer));
-					bufpt=0;
-					}
-				else {
-					buffer[bufpt++]=ch;
-					}
-				break;
+void powers(algebra& alg, const decomposition_t& dec, unsigned int k, bool issym, 
+				std::vector<decomposition_t>& res)
+	{
+	character_t ch;
+	character(alg, dec, ch);
+
+	res.clear();
+	res.resize(k+1);
+	res[0][alg.to_dynkin(alg.zero)]=1;
+	std::vector<character_t> psi(k+1);
+	for(unsigned int j=1; j<=k; ++j) {
+		adams(ch, j, psi[j]);
+		for(unsigned int i=1; i<=j; ++i) {
+			const long sign=(issym || i%2==1)?1:-1;
+			for(decomposition_t::const_iterator it=res[j-i].begin(); it!=res[j-i].end(); ++it)
+				alg.decompose(psi[i], alg.to_orthogonal(it->first), sign*it->second, res[j]);
+			}
+		prune(res[j]);
+		for(decomposition_t::iterator it=res[j].begin(); it!=res[j].end(); ++it) {
+			assert(it->second%j==0 && it->second>0);
+			it->second/=j;
 			}
 		}
 	}
 
-void LiE::LiE_t::putreps(std::ostream& str, const std::vector<rep_t>& reps)
+std::recursive_mutex                                      lie_mutex;
+std::map<std::pair<char, unsigned int>, algebra>          algebras;
+
+algebra& get_algebra(LiE::LiE_t::algebra_t type, unsigned int rank)
+	{
+	std::pair<char, unsigned int> key((char)type, rank);
+	std::map<std::pair<char, unsigned int>, algebra>::iterator it=algebras.find(key);
+	if(it==algebras.end())
+		it=algebras.insert(std::make_pair(key, algebra(type, rank))).first;
+	return it->second;
+	}
+
+void to_decomposition(const std::vector<LiE::LiE_t::rep_t>& reps, decomposition_t& res)
 	{
-	for(unsigned int k=0; k<reps.size(); ++k) {
-		if(k>0) str << " +";
-		putrep(str, reps[k]);
+	for(unsigned int i=0; i<reps.size(); ++i)
+		res[reps[i].weight]+=reps[i].multiplicity;
+	}
+
+void to_reps(const decomposition_t& dec, std::vector<LiE::LiE_t::rep_t>& res)
+	{
+	res.clear();
+	for(decomposition_t::const_iterator it=dec.begin(); it!=dec.end(); ++it) {
+		res.push_back(LiE::LiE_t::rep_t());
+		res.back().multiplicity=it->second;
+		res.back().weight=it->first;
 		}
 	}
 
-void LiE::LiE_t::putrep(std::ostream& str, const rep_t& rep)
+// Key for the cache of results: operation, parameters and the representations.
+
+std::vector<int> result_key(int op, const std::vector<int>& params, const decomposition_t& dec)
 	{
-	str << rep.multiplicity << "X[";
-	for(unsigned int i=0; i<rep.weight.size(); ++i) {
-		if(i>0) str << ",";
-		str << rep.weight[i];
+	std::vector<int> ret(1, op);
+	ret.push_back(params.size());
+	ret.insert(ret.end(), params.begin(), params.end());
+	for(decomposition_t::const_iterator it=dec.begin(); it!=dec.end(); ++it) {
+		ret.push_back(it->second);
+		ret.insert(ret.end(), it->first.begin(), it->first.end());
 		}
-	str << "]";
+	return ret;
+	}
+
+}
+
+LiE::LiE_t::LiE_t(algebra_t a, unsigned int d)
+	: algebra_type(a), algebra_dim(d)
+	{
+	}
+
+LiE::LiE_t::rep_t::rep_t()
+	: multiplicity(1)
+	{
 	}
 
 bool LiE::LiE_t::alt_tensor(unsigned int mult, const std::vector<rep_t>& orig, std::vector<rep_t>& res)
@@ -236,29 +472,25 @@ bool LiE::LiE_t::sym_tensor(unsigned int mult, const std::vector<rep_t>& orig, s
 	return alt_sym_tensor(mult, orig, res, true);
 	}
 
-void LiE::LiE_t::putalgtype(std::ostream& str)
-	{
-	if(algebra_type==alg_D && algebra_dim==2)
-		str << ", A1A1)\n";
-	else
-		str << ", " << (char)algebra_type << algebra_dim << ")\n";
-	}
-
 bool LiE::LiE_t::alt_sym_tensor(unsigned int mult, const std::vector<rep_t>& orig, 
 										  std::vector<rep_t>& res, bool issym)
 	{
-	std::ostringstream str;
-
-	str << (issym==true?"sym":"alt") << "_tensor(" << mult << ", ";
-	putreps(str, orig);
-	putalgtype(str);
-	lie_proc.write(str.str());
-//	debugout << str.str() << std::flush;
-
-	wait_newline();
-	res.clear();
-	read_replist(res);
-	wait_prompt();
+	std::lock_guard<std::recursive_mutex> lock(lie_mutex);
+	algebra& alg=get_algebra(algebra_type, algebra_dim);
+
+	decomposition_t dec;
+	to_decomposition(orig, dec);
+	std::vector<int> params;
+	params.push_back(mult);
+	params.push_back(issym);
+	std::vector<int> key=result_key(1, params, dec);
+	std::map<std::vector<int>, decomposition_t>::iterator it=alg.results.find(key);
+	if(it==alg.results.end()) {
+		std::vector<decomposition_t> pw;
+		powers(alg, dec, mult, issym, pw);
+		it=alg.results.insert(std::make_pair(key, pw[mult])).first;
+		}
+	to_reps(it->second, res);
 
 	return true;
 	}
@@ -266,20 +498,14 @@ bool LiE::LiE_t::alt_sym_tensor(unsigned int mult, const std::vector<rep_t>& ori
 bool LiE::LiE_t::tensor(const std::vector<rep_t>& orig1, const std::vector<rep_t>& orig2, 
 								std::vector<rep_t>& res)
 	{
-	std::ostringstream str;
+	std::lock_guard<std::recursive_mutex> lock(lie_mutex);
+	algebra& alg=get_algebra(algebra_type, algebra_dim);
 
-	str << "tensor(";
-	putreps(str, orig1);
-	str << ", ";
-	putreps(str, orig2);
-	putalgtype(str);
-	lie_proc.write(str.str());
-//	debugout << str.str() << std::flush;
-
-	wait_newline();
-	res.clear();
-	read_replist(res);
-	wait_prompt();
+	decomposition_t dec1, dec2, dec;
+	to_decomposition(orig1, dec1);
+	to_decomposition(orig2, dec2);
+	multiply(alg, dec1, dec2, dec);
+	to_reps(dec, res);
 
 	return true;
 	}
@@ -297,27 +523,50 @@ bool LiE::LiE_t::plethysm(const std::vector<unsigned int>& tab, std::vector<rep_
 	return plethysm(tab, rep, res, traceless, selfdual);
 	}
 
+// The Schur functor for the shape 'tab' is computed from the symmetric powers
+// with the Jacobi-Trudi determinant, s_tab = det h_{tab[i]-i+j}.
+
 bool LiE::LiE_t::plethysm(const std::vector<unsigned int>& tab, 
 								  const std::vector<rep_t>& rep, std::vector<rep_t>& res, bool traceless,
 								  int selfdual)
 	{
-	std::ostringstream str;
+	std::lock_guard<std::recursive_mutex> lock(lie_mutex);
+	algebra& alg=get_algebra(algebra_type, algebra_dim);
+
+	decomposition_t dec;
+	to_decomposition(rep, dec);
+	std::vector<int> params(tab.begin(), tab.end());
+	std::vector<int> key=result_key(2, params, dec);
+	std::map<std::vector<int>, decomposition_t>::iterator it=alg.results.find(key);
+	if(it==alg.results.end()) {
+		const unsigned int rows=tab.size();
+		std::vector<decomposition_t> h;
+		powers(alg, dec, rows>0?tab[0]+rows-1:0, true, h);
+
+		decomposition_t schur;
+		std::vector<unsigned int> perm(rows);
+		for(unsigned int i=0; i<rows; ++i)
+			perm[i]=i;
+		do {
+			decomposition_t term(h[0]);
+			for(unsigned int i=0; i<rows && term.size()>0; ++i) {
+				int ind=tab[i]-i+perm[i];
+				if(ind<0) term.clear();
+				else {
+					decomposition_t tmp;
+					multiply(alg, term, h[ind], tmp);
+					term.swap(tmp);
+					}
+				}
+			const int sign=permutation_sign(perm);
+			for(decomposition_t::const_iterator tit=term.begin(); tit!=term.end(); ++tit)
+				schur[tit->first]+=sign*tit->second;
+			} while(std::next_permutation(perm.begin(), perm.end()));
+		prune(schur);
 
-	str << "plethysm([";
-	for(unsigned int k=0; k<tab.size(); ++k) {
-		if(k>0) str << ", ";
-		str << tab[k];
+		it=alg.results.insert(std::make_pair(key, schur)).first;
 		}
-	str << "], ";
-	putreps(str, rep);
-	putalgtype(str);
-	lie_proc.write(str.str());
-//	debugout << str.str() << std::flush;
-
-	wait_newline();
-	res.clear();
-	read_replist(res);
-	wait_prompt();
+	to_reps(it->second, res);
 
 	if(traceless)
 		keep_largest_dim(res, selfdual);
@@ -329,27 +578,18 @@ bool LiE::LiE_t::plethysm(const std::vector<unsigned int>& tab,
 
 unsigned int LiE::LiE_t::dim(const rep_t& orig)
 	{
-	std::vector<rep_t> tmp;
-	tmp.push_back(orig);
-	return dim(tmp);
+	std::lock_guard<std::recursive_mutex> lock(lie_mutex);
+	algebra& alg=get_algebra(algebra_type, algebra_dim);
+
+	return alg.dim(alg.to_orthogonal(orig.weight));
 	}
 
 unsigned int LiE::LiE_t::dim(const std::vector<rep_t>& orig)
 	{
-	std::ostringstream str;
-
-	str << "dim(";
-	for(unsigned int k=0; k<orig.size(); ++k) {
-		if(k>0) str << " +";
-		putrep(str, orig[k]);
-		}
-	putalgtype(str);
-	lie_proc.write(str.str());
-
-	wait_newline();
-	unsigned int val=read_int();
-	wait_prompt();
-	return val;
+	unsigned int ret=0;
+	for(unsigned int k=0; k<orig.size(); ++k) 
+		ret+=orig[k].multiplicity*dim(orig[k]);
+	return ret;
 	}
 
 void LiE::LiE_t::keep_largest_dim(std::vector<rep_t>& reps, int selfdual) 
@@ -22,21 +22,25 @@
 #define lie_hh__
 
 #include <vector>
-#include <modglue/process.hh>
 
 namespace LiE {
 
-	/// A frontend to use LiE algorithms from within C++. 
+	/// Representation theory of the classical Lie algebras. This used to be a
+	/// frontend to the LiE program, driven through a pipe; the computations are
+	/// now done in-process, with weights written in Dynkin labels as in LiE.
+	/// Algebras of type A, B, C and D are supported; D2 is A1A1. 
+	///
+	/// Characters of irreducible representations are computed with Freudenthal's
+	/// formula, and products are decomposed with the Brauer-Klimyk rule. Both are
+	/// cached for each algebra and rank, by highest weight(s), so repeated calls
+	/// (e.g. from \@all_contractions) only pay for new representations.
+
 	class LiE_t {
 		public:
 			enum algebra_t { alg_A='A', alg_B='B', alg_C='C', alg_D='D', alg_E='E', alg_F='F', alg_G='G' };
 
 			LiE_t(algebra_t alg=alg_D, unsigned int d=5);
-			~LiE_t();
 
-			void start();
-			void stop();
-			
 			class rep_t {
 				public:
 					rep_t();
@@ -51,7 +55,7 @@ namespace LiE {
 			algebra_t    algebra_type;
 			unsigned int algebra_dim;
 
-			/// Routines which map 1-1 to a LiE command.
+			/// Routines which map 1-1 to a LiE command. Results are sorted by weight.
 			bool         tensor(const std::vector<rep_t>&, const std::vector<rep_t>&, std::vector<rep_t>&);
 			bool         sym_tensor(unsigned int, const std::vector<rep_t>&, std::vector<rep_t>&);
 			bool         alt_tensor(unsigned int, const std::vector<rep_t>&, std::vector<rep_t>&);
@@ -70,23 +74,6 @@ namespace LiE {
 
 			/// Find the number of singlets in a list of representations.
 			unsigned int multiplicity_of_singlet(const std::vector<rep_t>&) const;
-		private:
-			modglue::child_process lie_proc; //int  fd;
-			char curchar;
-			int  pid;
-			enum parsemode_t { START, MULT, REP };
-
-			int  kgetc();
-			void kungetc(int);
-			void wait_prompt();
-			void wait_newline();
-			void eat_white();
-			void putreps(std::ostream& str, const std::vector<rep_t>& reps);
-			void putrep(std::ostream& str, const rep_t& rep);
-			void putalgtype(std::ostream& str);
-			int  read_int();
-			void read_replist(std::vector<rep_t>&);
-
 	};
 
 };
@@ -32,6 +32,7 @@
 #include <map>
 #include <vector>
 #include <algorithm>
+#include <stdint.h>
 
 #include "storage.hh"
 
@@ -44,8 +45,11 @@ bool linear::gaussian_elimination(const std::vector<std::vector<multiplier_t> >&
 	return gaussian_elimination_inplace(tmpa, tmpb);
 	}
 
-bool linear::gaussian_elimination_inplace(std::vector<std::vector<multiplier_t> >& a, 
-														std::vector<multiplier_t>& b)
+// Dense elimination, used for small systems and as a fall-back when the
+// modular solver cannot decide.
+
+static bool dense_elimination_inplace(std::vector<std::vector<multiplier_t> >& a, 
+												  std::vector<multiplier_t>& b)
 	{
 	assert(a.size() == b.size());
 
@@ -111,6 +115,309 @@ bool linear::gaussian_elimination_inplace(std::vector<std::vector<multiplier_t>
 	return true;
 	}
 
+bool linear::gaussian_elimination_inplace(std::vector<std::vector<multiplier_t> >& a, 
+														std::vector<multiplier_t>& b)
+	{
+	assert(a.size() == b.size());
+
+	unsigned int number_of_eqs = a.size();
+	unsigned int number_of_unk = a[0].size();
+
+	if((unsigned long)number_of_eqs*number_of_unk >= sparse_threshold) {
+		sparse_matrix_t sa(number_of_eqs);
+		for(unsigned int row=0; row<number_of_eqs; ++row)
+			for(unsigned int col=0; col<number_of_unk; ++col)
+				if(a[row][col]!=0)
+					sa[row][col]=a[row][col];
+		std::vector<multiplier_t> sol;
+		switch(modular_elimination(sa, number_of_unk, b, sol)) {
+			case mod_solved:
+				// Leave the system in the same reduced form as the dense routine.
+				for(unsigned int row=0; row<number_of_eqs; ++row) {
+					std::fill(a[row].begin(), a[row].end(), 0);
+					if(row<number_of_unk) {
+						a[row][row]=1;
+						b[row]=sol[row];
+						}
+					else b[row]=0;
+					}
+				return true;
+			case mod_inconsistent:
+				return false;
+			case mod_undecided:
+				break;
+			}
+		}
+	return dense_elimination_inplace(a, b);
+	}
+
+bool linear::solve(const sparse_matrix_t& a, unsigned int number_of_unk, 
+						 const std::vector<multiplier_t>& rhs, std::vector<multiplier_t>& solution)
+	{
+	assert(a.size() == rhs.size());
+
+	if((unsigned long)a.size()*number_of_unk >= sparse_threshold) {
+		switch(modular_elimination(a, number_of_unk, rhs, solution)) {
+			case mod_solved:
+				return true;
+			case mod_inconsistent:
+				return false;
+			case mod_undecided:
+				break;
+			}
+		}
+
+	std::vector<std::vector<multiplier_t> > da(a.size());
+	std::vector<multiplier_t>               db(rhs);
+	for(unsigned int row=0; row<a.size(); ++row) {
+		da[row].resize(number_of_unk, 0);
+		std::map<unsigned int, multiplier_t>::const_iterator it=a[row].begin();
+		while(it!=a[row].end()) {
+			da[row][it->first]=it->second;
+			++it;
+			}
+		}
+	if(!dense_elimination_inplace(da, db))
+		return false;
+	db.resize(std::max((size_t)number_of_unk, db.size()), 0);
+	solution.assign(db.begin(), db.begin()+number_of_unk);
+	return true;
+	}
+
+// Sparse rows modulo a prime, sorted by column. The primes are just above 2^30,
+// so residues are kept in 64 bits, where their products cannot overflow even on
+// platforms with a 32-bit long.
+
+typedef uint64_t modval_t;
+typedef std::vector<std::pair<unsigned int, modval_t> > modrow_t;
+
+static modval_t inverse_mod(modval_t a, modval_t p)
+	{
+	int64_t t0=0, t1=1;
+	int64_t r0=p, r1=a;
+	while(r1!=0) {
+		int64_t q=r0/r1, tmp;
+		tmp=r0-q*r1; r0=r1; r1=tmp;
+		tmp=t0-q*t1; t0=t1; t1=tmp;
+		}
+	return (t0<0)?t0+p:t0;
+	}
+
+static modval_t value_in_row(const modrow_t& row, unsigned int col)
+	{
+	modrow_t::const_iterator it=std::lower_bound(row.begin(), row.end(), 
+																std::make_pair(col, (modval_t)0));
+	if(it!=row.end() && it->first==col) return it->second;
+	return 0;
+	}
+
+// Solve the system modulo p. Pivots are chosen in the column with the fewest
+// non-zero entries, from the shortest row containing it, to keep fill-in low.
+
+static linear::modular_result_t solve_mod_p(const std::vector<std::vector<std::pair<unsigned int, mpz_class> > >& arows,
+														  const std::vector<mpz_class>& brows, unsigned int number_of_unk,
+														  modval_t p, std::vector<modval_t>& x)
+	{
+	unsigned int number_of_eqs=arows.size();
+	std::vector<modrow_t>                   rows(number_of_eqs);
+	std::vector<modval_t>                   rhs(number_of_eqs);
+	std::vector<bool>                       active(number_of_eqs, true);
+	std::vector<unsigned int>               colcount(number_of_unk, 0);
+	std::vector<std::vector<unsigned int> > colrows(number_of_unk);
+
+	for(unsigned int r=0; r<number_of_eqs; ++r) {
+		for(unsigned int i=0; i<arows[r].size(); ++i) {
+			modval_t v=mpz_fdiv_ui(arows[r][i].second.get_mpz_t(), p);
+			if(v!=0) {
+				unsigned int c=arows[r][i].first;
+				rows[r].push_back(std::make_pair(c, v));
+				++colcount[c];
+				colrows[c].push_back(r);
+				}
+			}
+		rhs[r]=mpz_fdiv_ui(brows[r].get_mpz_t(), p);
+		}
+
+	std::vector<bool>         pivoted(number_of_unk, false);
+	std::vector<unsigned int> pivot_col, pivot_row;
+	modrow_t                  newrow;
+	for(unsigned int step=0; step<number_of_unk; ++step) {
+		unsigned int c=number_of_unk;
+		for(unsigned int col=0; col<number_of_unk; ++col) 
+			if(!pivoted[col] && colcount[col]>0 && (c==number_of_unk || colcount[col]<colcount[c]))
+				c=col;
+		if(c==number_of_unk)
+			return linear::mod_undecided; // rank deficient, at least modulo p
+
+		unsigned int pr=number_of_eqs;
+		for(unsigned int i=0; i<colrows[c].size(); ++i) {
+			unsigned int r=colrows[c][i];
+			if(active[r] && value_in_row(rows[r], c)!=0)
+				if(pr==number_of_eqs || rows[r].size()<rows[pr].size())
+					pr=r;
+			}
+		assert(pr!=number_of_eqs);
+
+		active[pr]=false;
+		for(unsigned int i=0; i<rows[pr].size(); ++i)
+			--colcount[rows[pr][i].first];
+		modval_t inv=inverse_mod(value_in_row(rows[pr], c), p);
+		for(unsigned int i=0; i<rows[pr].size(); ++i)
+			rows[pr][i].second=(rows[pr][i].second*inv)%p;
+		rhs[pr]=(rhs[pr]*inv)%p;
+		pivoted[c]=true;
+		pivot_col.push_back(c);
+		pivot_row.push_back(pr);
+
+		// Eliminate column c from all other active rows.
+		std::vector<unsigned int> todo(colrows[c]);
+		for(unsigned int i=0; i<todo.size(); ++i) {
+			unsigned int r=todo[i];
+			if(!active[r]) continue;
+			modval_t f=value_in_row(rows[r], c);
+			if(f==0) continue;
+			f=p-f;
+			newrow.clear();
+			modrow_t::const_iterator i1=rows[r].begin(), i2=rows[pr].begin();
+			while(i1!=rows[r].end() || i2!=rows[pr].end()) {
+				if(i2==rows[pr].end() || (i1!=rows[r].end() && i1->first<i2->first)) {
+					newrow.push_back(*i1++);
+					}
+				else {
+					modval_t v=(f*i2->second)%p;
+					if(i1!=rows[r].end() && i1->first==i2->first) {
+						v=(v+i1->second)%p;
+						++i1;
+						if(v==0) --colcount[i2->first];
+						}
+					else {
+						++colcount[i2->first];
+						colrows[i2->first].push_back(r);
+						}
+					if(v!=0) 
+						newrow.push_back(std::make_pair(i2->first, v));
+					++i2;
+					}
+				}
+			rows[r].swap(newrow);
+			rhs[r]=(rhs[r]+f*rhs[pr])%p;
+			}
+		}
+
+	// All columns have a pivot; any equation left over must read 0=0.
+	for(unsigned int r=0; r<number_of_eqs; ++r)
+		if(active[r] && rhs[r]!=0)
+			return linear::mod_inconsistent;
+
+	x.assign(number_of_unk, 0);
+	for(int step=number_of_unk-1; step>=0; --step) {
+		const modrow_t& row=rows[pivot_row[step]];
+		modval_t val=rhs[pivot_row[step]];
+		for(unsigned int i=0; i<row.size(); ++i)
+			if(row[i].first!=pivot_col[step])
+				val=(val+(p-row[i].second)*x[row[i].first])%p;
+		x[pivot_col[step]]=val;
+		}
+	return linear::mod_solved;
+	}
+
+// Find the fraction n/d with |n|,|d| < sqrt(m/2) which is equal to u modulo m.
+
+static bool rational_reconstruction(const mpz_class& u, const mpz_class& m, multiplier_t& res)
+	{
+	mpz_class bound;
+	mpz_class half=m/2;
+	mpz_sqrt(bound.get_mpz_t(), half.get_mpz_t());
+	mpz_class r0=m, r1=u, t0=0, t1=1, q, tmp;
+	while(r1>bound) {
+		q=r0/r1;
+		tmp=r0-q*r1; r0=r1; r1=tmp;
+		tmp=t0-q*t1; t0=t1; t1=tmp;
+		}
+	if(abs(t1)>bound || t1==0) return false;
+	mpz_class g;
+	mpz_gcd(g.get_mpz_t(), r1.get_mpz_t(), t1.get_mpz_t());
+	if(g!=1) return false;
+	res=multiplier_t(r1, t1);
+	res.canonicalize();
+	return true;
+	}
+
+linear::modular_result_t linear::modular_elimination(const sparse_matrix_t& a, unsigned int number_of_unk, 
+																	  const std::vector<multiplier_t>& rhs, 
+																	  std::vector<multiplier_t>& solution)
+	{
+	// Clear denominators row by row.
+	std::vector<std::vector<std::pair<unsigned int, mpz_class> > > arows(a.size());
+	std::vector<mpz_class> brows(a.size());
+	for(unsigned int r=0; r<a.size(); ++r) {
+		mpz_class den=rhs[r].get_den();
+		std::map<unsigned int, multiplier_t>::const_iterator it=a[r].begin();
+		while(it!=a[r].end()) {
+			mpz_lcm(den.get_mpz_t(), den.get_mpz_t(), it->second.get_den_mpz_t());
+			++it;
+			}
+		for(it=a[r].begin(); it!=a[r].end(); ++it) {
+			if(it->second==0) continue;
+			multiplier_t scaled=it->second*den;
+			arows[r].push_back(std::make_pair(it->first, scaled.get_num()));
+			}
+		multiplier_t scaled=rhs[r]*den;
+		brows[r]=scaled.get_num();
+		}
+
+	mpz_class prime=1073741824; // 2^30
+	mpz_class modulus=1;
+	std::vector<mpz_class>     crt(number_of_unk, 0);
+	std::vector<modval_t>      x;
+	unsigned int unlucky=0;
+	for(unsigned int attempt=0; attempt<200; ++attempt) {
+		mpz_nextprime(prime.get_mpz_t(), prime.get_mpz_t());
+		modval_t p=prime.get_ui();
+		switch(solve_mod_p(arows, brows, number_of_unk, p, x)) {
+			case mod_inconsistent:
+				// All columns had a pivot, so the rank over the rationals is the
+				// same, and the system is really inconsistent.
+				return mod_inconsistent;
+			case mod_undecided:
+				if(++unlucky==3) return mod_undecided;
+				continue;
+			case mod_solved:
+				break;
+			}
+
+		// Chinese remaindering with the solutions modulo earlier primes.
+		modval_t minv=inverse_mod(mpz_fdiv_ui(modulus.get_mpz_t(), p), p);
+		for(unsigned int i=0; i<number_of_unk; ++i) {
+			modval_t cur=mpz_fdiv_ui(crt[i].get_mpz_t(), p);
+			modval_t t=((x[i]+p-cur)%p*minv)%p;
+			crt[i]+=modulus*(unsigned long)t;
+			}
+		modulus*=(unsigned long)p;
+
+		solution.resize(number_of_unk);
+		bool reconstructed=true;
+		for(unsigned int i=0; i<number_of_unk && reconstructed; ++i)
+			reconstructed=rational_reconstruction(crt[i], modulus, solution[i]);
+		if(!reconstructed) continue;
+
+		// Check the candidate solution exactly.
+		bool correct=true;
+		for(unsigned int r=0; r<a.size() && correct; ++r) {
+			multiplier_t sum=0;
+			std::map<unsigned int, multiplier_t>::const_iterator it=a[r].begin();
+			while(it!=a[r].end()) {
+				sum+=it->second*solution[it->first];
+				++it;
+				}
+			correct=(sum==rhs[r]);
+			}
+		if(correct) 
+			return mod_solved;
+		}
+	return mod_undecided;
+	}
+
 //  3 5 7   2  ->  3 5 7   2      ->  3 5 7    2
 //    8 4   1        8 4   1          
 //      2   3          1   3/2
@@ -250,7 +557,7 @@ algorithm::result_t lsolve::apply(iterator& it)
 
 
 decompose::decompose(exptree& tr, iterator it) 
-	: algorithm(tr, it)
+	: algorithm(tr, it), basis_size(0)
 	{
 	}
 
@@ -271,9 +578,9 @@ bool decompose::can_apply(iterator it)
 
 void decompose::add_element_to_basis(exptree& projterm, exptree::iterator projtermit) 
 	{
-	// Add a new column for the new term in the basis
-	for(unsigned int ii=0; ii<coefficient_matrix.size(); ++ii)
-		coefficient_matrix[ii].push_back(0);
+	// The new term in the basis gets the next column; entries which are zero
+	// are not stored.
+	unsigned int column=basis_size++;
 
 	if(*projtermit->name=="\\sum") {
 		sibling_iterator moreit=projterm.begin(projtermit);
@@ -283,7 +590,7 @@ void decompose::add_element_to_basis(exptree& projterm, exptree::iterator projte
 			bool thistermfound=false;
 			for(unsigned int ypi=0; ypi<terms_from_yp.size(); ++ypi) {
 				if(projterm.equal_subtree(terms_from_yp[ypi].begin(), (iterator)moreit)) {
-					coefficient_matrix[ypi].back()=remember_mult;
+					coefficient_matrix[ypi][column]=remember_mult;
 					thistermfound=true;
 //					txtout << "found existing monomial" << std::endl;
 					break;
@@ -293,10 +600,8 @@ void decompose::add_element_to_basis(exptree& projterm, exptree::iterator projte
 				exptree tmp(moreit);
 //				tmp.print_recursive_treeform(txtout, tmp.begin());
 				terms_from_yp.push_back(tmp);
-				std::vector<multiplier_t> crow(coefficient_matrix.size()>0?
-														 coefficient_matrix[0].size():1,0);
-				crow.back()=remember_mult;
-				coefficient_matrix.push_back(crow);
+				coefficient_matrix.push_back(std::map<unsigned int, multiplier_t>());
+				coefficient_matrix.back()[column]=remember_mult;
 //				txtout << "added new monomial" << std::endl;
 				}
 			++moreit;
@@ -308,7 +613,7 @@ void decompose::add_element_to_basis(exptree& projterm, exptree::iterator projte
 		bool thistermfound=false;
 		for(unsigned int ypi=0; ypi<terms_from_yp.size(); ++ypi) {
 			if(projterm.equal_subtree(terms_from_yp[ypi].begin(), projtermit)) {
-				coefficient_matrix[ypi].back()=remember_mult;
+				coefficient_matrix[ypi][column]=remember_mult;
 				thistermfound=true;
 				break;
 				}
@@ -316,10 +621,8 @@ void decompose::add_element_to_basis(exptree& projterm, exptree::iterator projte
 		if(!thistermfound) { // new monomial, so add a new row to the coefficient matrix
 			exptree tmp(projtermit);
 			terms_from_yp.push_back(tmp);
-			std::vector<multiplier_t> crow(coefficient_matrix.size()>0?
-													 coefficient_matrix[0].size():1,0);
-			crow.back()=remember_mult;
-			coefficient_matrix.push_back(crow);
+			coefficient_matrix.push_back(std::map<unsigned int, multiplier_t>());
+			coefficient_matrix.back()[column]=remember_mult;
 			}
 		}
 	}
@@ -351,6 +654,7 @@ algorithm::result_t decompose::apply(iterator& it)
 	projbasis.set_head(str_node("\\expression"));
 	terms_from_yp.clear();
 	coefficient_matrix.clear();
+	basis_size=0;
 
 	// Some overlap with code in all_contractions.
 	bool nontrivial_symmetries_present=false;
@@ -549,24 +853,19 @@ algorithm::result_t decompose::apply(iterator& it)
 		 // debugout << "rhs is identically zero" << std::endl;
 		 exptree res;
 		 res.set_head(str_node("\\comma"));
-		 for(unsigned int i=0; i<coefficient_matrix[0].size(); ++i) 
+		 for(unsigned int i=0; i<basis_size; ++i) 
 			  res.append_child(res.begin(), str_node("1"))->multiplier=rat_set.insert(0).first;
 		 tr.replace(it, res.begin());
 		 expression_modified=true;
 		 }
 	else {
 		 // debugout << "doing gaussian elimination" << std::endl;
-		 if(linear::gaussian_elimination_inplace(coefficient_matrix, rhs)) {
-			 // for(unsigned int i=0; i<coefficient_matrix.size(); ++i) {
-			 // 		for(unsigned int j=0; j<coefficient_matrix[i].size(); ++j)
-			 // 			 debugout << coefficient_matrix[i][j] << " ";
-			 // 		debugout << " = " << rhs[i] << std::endl;
-			 // 		}
-			  
+		 std::vector<multiplier_t> solution;
+		 if(linear::solve(coefficient_matrix, basis_size, rhs, solution)) {
 			  exptree res;
 			  res.set_head(str_node("\\comma"));
-			  for(unsigned int i=0; i<coefficient_matrix[0].size(); ++i) 
-					res.append_child(res.begin(), str_node("1"))->multiplier=rat_set.insert(rhs[i]).first;
+			  for(unsigned int i=0; i<basis_size; ++i) 
+					res.append_child(res.begin(), str_node("1"))->multiplier=rat_set.insert(solution[i]).first;
 			  it=tr.replace(it, res.begin());
 			  expression_modified=true;
 			  }
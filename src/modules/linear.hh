@@ -23,11 +23,32 @@
 
 #include "manipulator.hh"
 #include "props.hh"
+#include <map>
 
 /// Linear algebra
 namespace linear {
+	/// Matrix stored as one map from column to (non-zero) entry per row.
+	typedef std::vector<std::map<unsigned int, multiplier_t> > sparse_matrix_t;
+
 	bool gaussian_elimination(const std::vector<std::vector<multiplier_t> >&, const std::vector<multiplier_t>& );
 	bool gaussian_elimination_inplace(std::vector<std::vector<multiplier_t> >&, std::vector<multiplier_t>& );
+
+	/// Solve a sparse system for 'number_of_unk' unknowns. Systems with fewer than
+	/// sparse_threshold entries are solved with gaussian_elimination_inplace, larger
+	/// ones are first attempted with modular_elimination.
+	bool solve(const sparse_matrix_t&, unsigned int number_of_unk, 
+				  const std::vector<multiplier_t>& rhs, std::vector<multiplier_t>& solution);
+
+	enum modular_result_t { mod_solved, mod_inconsistent, mod_undecided };
+
+	/// Elimination modulo a sequence of primes, pivoting to keep fill-in low, followed 
+	/// by Chinese remaindering and rational reconstruction of the solution. Only returns
+	/// mod_solved for a unique solution which has been checked exactly.
+	modular_result_t modular_elimination(const sparse_matrix_t&, unsigned int number_of_unk, 
+													 const std::vector<multiplier_t>& rhs, 
+													 std::vector<multiplier_t>& solution);
+
+	const unsigned long sparse_threshold=400;
 };
 
 /// Solve a system of linear equations.
@@ -52,7 +73,8 @@ class decompose : public algorithm {
 	protected:
 		void add_element_to_basis(exptree&, exptree::iterator);
 		std::vector<exptree>                    terms_from_yp;
-		std::vector<std::vector<multiplier_t> > coefficient_matrix;
+		linear::sparse_matrix_t                 coefficient_matrix;
+		unsigned int                            basis_size;
 
 };
 
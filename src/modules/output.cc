@@ -20,6 +20,7 @@
 
 #include "output.hh"
 #include "props.hh"
+#include "history.hh"
 
 void output::register_properties()
 	{
@@ -248,9 +249,13 @@ algorithm::result_t memdump::apply(iterator&)
 		}
 	unsigned int numnodes=active_node::tr.size();
 	float numbytes=numnodes * sizeof(tree_node_<str_node>);
+	history::sweep(active_node::tr);
+	size_t swept=rat_set.sweep();
 	
 	txtout << "# of names      : " << name_set.size() << std::endl
-			 << "# of rationals  : " << rat_set.size() << std::endl
+			 << "# of rationals  : " << rat_set.size() 
+			 << " (" << swept << " unused now removed, " 
+			 << rat_set.reclaimed() << " in total)" << std::endl
 			 << "# of nodes      : " << numnodes
 			 << " (= ";
 	int mult=0;
@@ -277,6 +282,11 @@ algorithm::result_t memdump::apply(iterator&)
 			break;
 		}
 	txtout << ")" << std::endl
+			 << "node pool       : " << str_node_allocator::bytes_reserved()/1024 << " Kb reserved" << std::endl
+			 << "packed steps    : " << history::number_of_steps() << " ("
+			 << history::number_of_term_references() << " terms, "
+			 << history::number_of_terms() << " distinct, "
+			 << history::bytes()/1024 << " Kb)" << std::endl
 			 << "# of expressions: " << noe << std::endl;
 	
 	return l_applied;
@@ -56,6 +56,8 @@ algorithm::result_t extract_properties::apply(iterator& st)
 				if(thepropbase->preparse_arguments(proptree.begin(), keyvals)==false) 
 					throw consistency_error("Failure parsing arguments of property "+*it->name+".");
 
+				// Some properties modify their arguments while parsing, so keep a copy.
+				exptree declaration(proptree);
 				if(thepropbase->parse(tr,st,proptree.begin(), keyvals)) {
 					list_property *thelistprop=dynamic_cast<list_property *>(thepropbase);
 //					bool is_index=false;
@@ -88,6 +90,7 @@ algorithm::result_t extract_properties::apply(iterator& st)
 						if(objs.size()<2) 
 							throw consistency_error("A list property cannot be assigned to a single object.");
 
+						properties::declare(thelistprop, declaration);
 						properties::insert_list_prop(objs, thelistprop);
 						}
 					else {                              // a normal property
@@ -106,6 +109,7 @@ algorithm::result_t extract_properties::apply(iterator& st)
 									theprop->core_parse(keyvals);
 									}
 								if(sib->fl.parent_rel!=str_node::p_property) {
+									properties::declare(theprop, declaration);
 									properties::insert_prop(exptree(sib), theprop);
 									if(eo) {
 										txtout << "$";
@@ -123,6 +127,7 @@ algorithm::result_t extract_properties::apply(iterator& st)
 								}				
 							}
 						else {
+							properties::declare(theprop, declaration);
 							properties::insert_prop(exptree(st), theprop);
 							txtout << "Assigning property " << propname;
 							if( *st->name!="" ) {
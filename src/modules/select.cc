@@ -21,6 +21,7 @@
 #include "storage.hh"
 #include "combinatorics.hh"
 #include "select.hh"
+#include "history.hh"
 #include <sstream>
 
 /*
@@ -160,9 +161,11 @@ algorithm::result_t pop::apply(iterator& st)
 	tr.erase(era);
 	era =tr.active_expression(top);
 	tr.erase(era);
+	str_node_allocator::trim();
 	expression_modified=true;
 
 	st=tr.active_expression(top);
+	history::unpack(tr, st);
 	return l_applied;
 	}
 
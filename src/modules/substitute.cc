@@ -84,6 +84,31 @@ substitute::substitute(exptree& tr, iterator it)
 				++lhsit;
 				}
 
+			// Index the rule by what its lhs can match.
+			rule rl;
+			rl.arrow=arrow;
+			rl.lhs=lhs;
+			rl.conditions=tr.end();
+			if(*lhs->name=="\\conditional") {
+				rl.lhs=tr.begin(lhs);
+				rl.conditions=rl.lhs;
+				rl.conditions.skip_children();
+				++rl.conditions;
+				}
+			rl.product=(*rl.lhs->name=="\\prod");
+			rl.parent_rel=rl.lhs->fl.parent_rel;
+			rl.children=-1;
+			if(rl.lhs->is_object_wildcard() || rl.lhs->is_name_wildcard() || rl.lhs->name->size()==0)
+				wildcard_rules.push_back(i);
+			else {
+				rules_by_name[&(*rl.lhs->name)].push_back(i);
+				// The top node of an lhs which is not a pattern only matches nodes with
+				// the same number of children (see exptree_comparator::equal_subtree).
+				if(!rl.product && !rl.lhs->is_index())
+					rl.children=tr.number_of_children(rl.lhs);
+				}
+			rules.push_back(rl);
+
 			// check whether there are dummies.
 			index_map_t ind_free, ind_dummy;
 			classify_indices(lhs, ind_free, ind_dummy);
@@ -119,27 +144,34 @@ bool substitute::can_apply(iterator st)
 	if(*st->name=="\\expression" || *st->name=="\\asymimplicit") return false;
 
 	tmr.start();
-	sibling_iterator subslist=args_begin();
-	for(unsigned int i=0; i<tr.arg_size(subslist); ++i) {
-		use_rule=i;
-
-		comparator.clear();
-
-		iterator arrow=tr.arg(subslist, i);
-		iterator lhs=tr.begin(arrow);
-		if(*lhs->name=="\\conditional") {
-			lhs=tr.begin(lhs); 
-			conditions=lhs;
-			conditions.skip_children();
-			++conditions;
-			}
-		else conditions=tr.end();
-		
-//		std::cerr << *lhs->name << " - " << *st->name << std::endl;
 
-		if(lhs->name!=st->name 
-			&& !lhs->is_object_wildcard() && !lhs->is_name_wildcard() && lhs->name->size()>0) 
+	// Try, in their original order, only those rules which are indexed under
+	// the name of this node and those with a wildcard lhs.
+	static const std::vector<unsigned int> no_rules;
+	rule_index_t::const_iterator rit=rules_by_name.find(&(*st->name));
+	const std::vector<unsigned int>& named=(rit==rules_by_name.end())?no_rules:rit->second;
+	size_t ni=0, wi=0;
+	int    children=-1; // of 'st', determined when first needed
+	while(ni<named.size() || wi<wildcard_rules.size()) {
+		unsigned int i;
+		if(wi==wildcard_rules.size() || (ni<named.size() && named[ni]<wildcard_rules[wi])) i=named[ni++];
+		else                                                                             i=wildcard_rules[wi++];
+		const rule& rl=rules[i];
+
+		// The parent relation of the top node is always compared, except when
+		// matching a sub-product.
+		if(!rl.product && rl.parent_rel!=st->fl.parent_rel)
 			continue;
+		if(rl.children!=-1) {
+			if(children==-1) children=tr.number_of_children(st);
+			if(children!=rl.children)
+				continue;
+			}
+
+		use_rule=i;
+		comparator.clear();
+		iterator lhs=rl.lhs;
+		conditions=rl.conditions;
 
 		exptree_comparator::match_t ret;
 		comparator.lhs_contains_dummies=lhs_contains_dummies[i];
@@ -161,8 +193,7 @@ algorithm::result_t substitute::apply(iterator& st)
 	{
 //	prod_wrap_single_term(st);
 
-   sibling_iterator arrow=tr.arg(args_begin(), use_rule);
-   iterator lhs=tr.begin(arrow);
+   iterator lhs=tr.begin(rules[use_rule].arrow);
    iterator rhs=lhs;
    rhs.skip_children();
    ++rhs;
@@ -204,7 +235,7 @@ algorithm::result_t substitute::apply(iterator& st)
 	// Keep track of all indices which _have_ to stay what they are, in ind_forced.
 	// Keep track of insertion points of subtrees.
 	iterator it=repl.begin();
-	exptree_comparator::replacement_map_t::iterator loc;
+	const exptree *loc;
 	exptree_comparator::subtree_replacement_map_t::iterator sloc;
 	std::vector<iterator> subtree_insertion_points;
 	while(it!=repl.end()) { 
@@ -214,21 +245,19 @@ algorithm::result_t substitute::apply(iterator& st)
 //		For some reason 'a?' is not found!?! Well, that's presumably because _{a?} does not
 //      match ^{a?}. (though this does match when we write 'i' instead of a?. 
 
-		loc=comparator.replacement_map.find(exptree(it));
-		if(loc==comparator.replacement_map.end() && it->is_name_wildcard() && tr.number_of_children(it)!=0) {
-			 exptree tmp(it);
-			 tmp.erase_children(tmp.begin());
-			 loc=comparator.replacement_map.find(tmp);
+		loc=comparator.replacement_map.find(it);
+		if(loc==0 && it->is_name_wildcard() && tr.number_of_children(it)!=0) {
+			 loc=comparator.replacement_map.find(it, true);
 			 is_stripped=true;
 			 }
 
-		if(loc!=comparator.replacement_map.end()) { // name wildcards
+		if(loc!=0) { // name wildcards
 //			if((*loc).first.begin()->fl.parent_rel==str_node::p_sub)
 //				std::cerr << "_";
 //			std::cerr << "rule : " << *((*loc).first.begin()->name) << " -> " 
-//						 << *((*loc).second.begin()->name) << std::endl;
+//						 << *(loc->begin()->name) << std::endl;
 //			std::cerr << it->fl.parent_rel << " ";
-//			std::cerr << "going to replace " << *it->name << " with " << *((*loc).second.begin()->name) << std::endl;
+//			std::cerr << "going to replace " << *it->name << " with " << *(loc->begin()->name) << std::endl;
 
 			// When a replacement is made here, and the index is actually
 			// a dummy in the replacement, we screw up the ind_dummy
@@ -244,16 +273,16 @@ algorithm::result_t substitute::apply(iterator& st)
 			if(is_stripped || (it->is_name_wildcard() && !it->is_index()) ) { 
             // a?_{i j k} type patterns should only replace the head
 				// TODO: should we replace brackets here too?
-				it->name=(*loc).second.begin()->name;
-				it->multiplier=(*loc).second.begin()->multiplier;
-				it->fl=(*loc).second.begin()->fl;
+				it->name=loc->begin()->name;
+				it->multiplier=loc->begin()->multiplier;
+				it->fl=loc->begin()->fl;
 				}
 			else {
 				// Careful with the multiplier: the object has been matched to the pattern
 				// without taking into account the top-level multiplier. So keep the multiplier
 				// of the thing we are replacing.
 				multiplier_t mt=*it->multiplier;
-				it=tr.replace_index(it, (*loc).second.begin());
+				it=tr.replace_index(it, loc->begin());
 				multiply(it->multiplier, mt);
 				}
 			it->fl.bracket=remember_br;
@@ -23,6 +23,7 @@
 
 #include "algorithm.hh"
 #include "algebra.hh"
+#include <unordered_map>
 
 // STL comparators are objects which are not supposed to carry local
 // data with them. They get created afresh by the stl algorithms; you
@@ -40,6 +41,23 @@ class substitute : public algorithm {
 		virtual bool     can_apply(iterator);
 		virtual result_t apply(iterator&);
 	private:
+		/// A replacement rule, with the lhs below any \\conditional node and some
+		/// properties which a node has to have in order to possibly match it.
+		class rule {
+			public:
+				iterator               arrow, lhs, conditions;
+				bool                   product;    // matched with match_subproduct
+				str_node::parent_rel_t parent_rel;
+				int                    children;   // number of children required, or -1
+		};
+		std::vector<rule>  rules;
+
+		/// Rule numbers by name of the lhs head; rules whose lhs head is a
+		/// wildcard have to be tried on every node.
+		typedef std::unordered_map<const std::string *, std::vector<unsigned int> > rule_index_t;
+		rule_index_t              rules_by_name;
+		std::vector<unsigned int> wildcard_rules;
+
 		unsigned int    use_rule;
 
 		iterator        conditions;
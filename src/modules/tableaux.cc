@@ -441,35 +441,36 @@ void lr_tensor::do_tableau(iterator& it)
 	if(has_argument("EvenOnly"))
 		 even_only=true;
 
-	yngtab::tableau one, two;
-	yngtab::tableaux<yngtab::tableau> prod;
+	// Only the shapes are needed, so the tableaux in the product are
+	// counted rather than constructed.
+	yngtab::partition_t one, two;
 	
 	sibling_iterator sib=tr.begin(tab1);
 	while(sib!=tr.end(tab1)) {
-		one.add_row(to_long(*sib->multiplier));
+		one.push_back(to_long(*sib->multiplier));
 		++sib;
 		}
 	sib=tr.begin(tab2);
 	while(sib!=tr.end(tab2)) {
-		two.add_row(to_long(*sib->multiplier));
+		two.push_back(to_long(*sib->multiplier));
 		++sib;
 		}
-	yngtab::LR_tensor(one,two,999,prod.get_back_insert_iterator());
+	const yngtab::LR_coefficients_t& prod=yngtab::LR_coefficients(one, two, 999);
 
 	exptree rep;
 	iterator top=rep.set_head(str_node("\\sum"));
-	yngtab::tableaux<yngtab::tableau>::tableau_container_t::iterator tabit=prod.storage.begin();
-	while(tabit!=prod.storage.end()) {
+	yngtab::LR_coefficients_t::const_iterator tabit=prod.begin();
+	while(tabit!=prod.end()) {
 		// Keep only the diagrams which lead to a singlet if requested.
 		if(even_only)
-			for(unsigned int r=0; r<(*tabit).number_of_rows(); ++r) 
-				if((*tabit).row_size(r)%2!=0)
+			for(unsigned int r=0; r<tabit->first.size(); ++r) 
+				if(tabit->first[r]%2!=0)
 					goto next_tab;
 
 		{iterator tt=tr.append_child(top, str_node(tab1->name));
-		multiply(tt->multiplier, tabit->multiplicity);
-		for(unsigned int r=0; r<(*tabit).number_of_rows(); ++r) 
-			multiply(tr.append_child(tt, str_node("1"))->multiplier, (*tabit).row_size(r));
+		multiply(tt->multiplier, tabit->second);
+		for(unsigned int r=0; r<tabit->first.size(); ++r) 
+			multiply(tr.append_child(tt, str_node("1"))->multiplier, tabit->first[r]);
 			}
 
 	   next_tab:
@@ -23,6 +23,8 @@
 #include "preprocessor.hh"
 #include "display.hh"
 #include <sstream>
+#include <unordered_map>
+#include <ctype.h>
 
 std::istream& operator>>(std::istream& str, parser& pa)
 	{
@@ -74,8 +76,465 @@ str_node::parent_rel_t parser::is_link(const unsigned char& ln) const
 	return str_node::p_none;
 	}
 
-parser::parser(bool preprocess)
-	: preprocess_(preprocess)
+namespace {
+
+// One-pass parser, which builds the tree directly from the input text,
+// using precedence climbing for the infix operators. It covers the part
+// of the input language which is used in practice; as soon as it sees
+// anything else (factorials, wedges, quoted strings, labels, dangling
+// links, nested single-element brackets, ...) it gives up, removes
+// what it has built and lets the caller fall back to the preprocessor.
+// The trees it builds are identical to those of the preprocessor route,
+// including all bracket types and the '0' in front of a unary minus.
+
+class direct_parser {
+	public:
+		direct_parser(exptree&, exptree::iterator top, const std::string&);
+
+		bool parse();
+
+	private:
+		class unsupported {};
+
+		typedef exptree::iterator iterator;
+
+		// Limit which lets all operators through.
+		static const unsigned int all_orders=preprocessor::order_tilde+1;
+
+		exptree&           tr;
+		iterator           top;
+		const std::string& str;
+		unsigned int       pos;
+		unsigned int       in_index; // non-zero inside '_{...}' and '^{...}'
+
+		// Names looked up in name_set during this parse.
+		std::unordered_map<std::string, nset_t::iterator> interned;
+		std::string                                       key;
+
+		nset_t::iterator intern(unsigned int from, unsigned int to);
+		nset_t::iterator intern(const char *);
+
+		char peek(unsigned int p) const { return p<str.size()?str[p]:0; }
+		void skip_space();
+		bool is_space(char) const;
+		bool is_name_char(char) const;
+		bool starts_operand(char) const;
+		str_node::bracket_t opening_bracket(char) const;
+		char                closing_bracket(char) const;
+
+		bool     infix_operator(unsigned int p, unsigned int& order, unsigned int& len) const;
+		bool     next_operator(unsigned int& order, unsigned int& len);
+
+		iterator expression(iterator parent, unsigned int limit, bool& bracketed, bool& isop,
+								  std::vector<iterator> *bracketed_children=0);
+		iterator operand(iterator parent, unsigned int limit, bool& bracketed);
+		iterator group(iterator parent, bool& bracketed);
+		iterator atom(iterator parent, str_node::parent_rel_t rel);
+		void     argument_group(iterator it);
+		void     index_group(iterator it, str_node::parent_rel_t rel);
+		void     property(iterator it);
+};
+
+direct_parser::direct_parser(exptree& t, exptree::iterator tp, const std::string& s)
+	: tr(t), top(tp), str(s), pos(0), in_index(0)
+	{
+	}
+
+nset_t::iterator direct_parser::intern(unsigned int from, unsigned int to)
+	{
+	key.assign(str, from, to-from);
+	std::unordered_map<std::string, nset_t::iterator>::const_iterator it=interned.find(key);
+	if(it!=interned.end()) 
+		return it->second;
+	nset_t::iterator nit=name_set.insert(key).first;
+	interned.insert(std::make_pair(key, nit));
+	return nit;
+	}
+
+nset_t::iterator direct_parser::intern(const char *nm)
+	{
+	key=nm;
+	std::unordered_map<std::string, nset_t::iterator>::const_iterator it=interned.find(key);
+	if(it!=interned.end()) 
+		return it->second;
+	nset_t::iterator nit=name_set.insert(key).first;
+	interned.insert(std::make_pair(key, nit));
+	return nit;
+	}
+
+bool direct_parser::is_space(char c) const
+	{
+	return (c==' ' || c=='\t' || c=='\n' || c=='\r');
+	}
+
+void direct_parser::skip_space()
+	{
+	while(pos<str.size() && is_space(str[pos]))
+		++pos;
+	}
+
+bool direct_parser::is_name_char(char c) const
+	{
+	if(c<=' ' || (c&0x80)) return false;
+	switch(c) {
+		case '+': case '-': case '*': case '/': case '=': case ',': case ':': 
+		case '<': case '>': case '|': case '~': case '!': case '^': case '_': 
+		case '$': case '&': case '.': case '(': case ')': case '{': case '}': 
+		case '[': case ']': case '"': case '\\': case '@':
+			return false;
+		}
+	return true;
+	}
+
+bool direct_parser::starts_operand(char c) const
+	{
+	return (is_name_char(c) || c=='\\' || c=='@' || opening_bracket(c)!=str_node::b_no);
+	}
+
+str_node::bracket_t direct_parser::opening_bracket(char c) const
+	{
+	if(c=='(') return str_node::b_round;
+	if(c=='[') return str_node::b_square;
+	if(c=='{') return str_node::b_none;
+	return str_node::b_no;
+	}
+
+char direct_parser::closing_bracket(char c) const
+	{
+	if(c=='(') return ')';
+	if(c=='[') return ']';
+	return '}';
+	}
+
+// Determine whether an infix operator starts at position p, and if so, 
+// return its order (see preprocessor::order_labels) and length.
+
+bool direct_parser::infix_operator(unsigned int p, unsigned int& order, unsigned int& len) const
+	{
+	len=1;
+	switch(peek(p)) {
+		case '*': 
+			if(peek(p+1)=='*') { order=preprocessor::order_pow; len=2; }
+			else                 order=preprocessor::order_prod;
+			return true;
+		case '/': order=preprocessor::order_frac;        return true;
+		case '+': order=preprocessor::order_plus;        return true;
+		case '=': order=preprocessor::order_equals;      return true;
+		case '<': order=preprocessor::order_less_than;   return true;
+		case '>': order=preprocessor::order_greater_than;return true;
+		case '|': order=preprocessor::order_conditions;  return true;
+		case ',': order=preprocessor::order_comma;       return true;
+		case '~': order=preprocessor::order_tilde;       return true;
+		case '-':
+			if(peek(p+1)=='>') { order=preprocessor::order_arrow; len=2; }
+			else                 order=preprocessor::order_minus;
+			return true;
+		case '.':
+			if(peek(p+1)!='.') throw unsupported();
+			order=preprocessor::order_dot; len=2;
+			return true;
+		case '!':
+			if(peek(p+1)!='=') throw unsupported(); // factorial
+			order=preprocessor::order_unequals; len=2;
+			return true;
+		case ':':
+			if(peek(p+1)=='=')      { order=preprocessor::order_colon; len=2; }
+			else if(peek(p+1)=='>') { order=preprocessor::order_set_option; len=2; }
+			else throw unsupported(); // property link or lone colon
+			return true;
+		}
+	return false;
+	}
+
+// Find the operator which follows the operand just read, skipping 
+// whitespace. Two operands without an operator in between are multiplied.
+
+bool direct_parser::next_operator(unsigned int& order, unsigned int& len)
+	{
+	unsigned int p=pos;
+	while(p<str.size() && is_space(str[p]))
+		++p;
+	if(p==str.size()) return false;
+	char c=str[p];
+	if(c==')' || c==']' || c=='}') return false;
+	if(infix_operator(p, order, len)) {
+		pos=p;
+		return true;
+		}
+	if(starts_operand(c)) {
+		pos=p;
+		order=preprocessor::order_prod;
+		len=0;
+		return true;
+		}
+	throw unsupported();
+	}
+
+// Read a sequence of operands joined by operators which bind more 
+// strongly than 'limit', and append the result as a child of 'parent'.
+// Sequences of the same operator give a single node with many children.
+// On return 'isop' says whether an operator node was made here, and
+// 'bracketed' whether the result is a single bracketed operand. The
+// children of the top operator node which are bracketed operands are
+// stored in 'bracketed_children' if that is non-zero.
+
+direct_parser::iterator direct_parser::expression(iterator parent, unsigned int limit, 
+																  bool& bracketed, bool& isop,
+																  std::vector<iterator> *bracketed_children)
+	{
+	isop=false;
+	iterator it=operand(parent, limit, bracketed);
+	unsigned int order, len;
+	while(next_operator(order, len) && order<limit) {
+		iterator opnode=tr.wrap(it, str_node(intern(preprocessor::order_names[order])));
+		if(bracketed_children) {
+			bracketed_children->clear();
+			if(bracketed) bracketed_children->push_back(it);
+			}
+		bracketed=false;
+		isop=true;
+		unsigned int nextorder;
+		do {
+			pos+=len;
+			bool chbracketed, chisop;
+			iterator ch=expression(opnode, order, chbracketed, chisop);
+			if(chbracketed && bracketed_children) 
+				bracketed_children->push_back(ch);
+			} while(next_operator(nextorder, len) && nextorder==order);
+		it=opnode;
+		}
+	return it;
+	}
+
+direct_parser::iterator direct_parser::operand(iterator parent, unsigned int limit, bool& bracketed)
+	{
+	bracketed=false;
+	skip_space();
+	char c=peek(pos);
+	iterator it;
+	if(c=='-' && peek(pos+1)!='>') {
+		// A minus sign without anything in front is read as '0-'.
+		if(preprocessor::order_minus>=limit) throw unsupported();
+		return tr.append_child(parent, str_node(intern("0")));
+		}
+	if(opening_bracket(c)!=str_node::b_no) {
+		if(in_index) throw unsupported();
+		it=group(parent, bracketed);
+		}
+	else if(c=='\\' || c=='@' || is_name_char(c)) 
+		it=atom(parent, str_node::p_none);
+	else throw unsupported();
+
+	if(peek(pos)==':' && peek(pos+1)==':') {
+		if(bracketed) throw unsupported();
+		property(it);
+		}
+	return it;
+	}
+
+// A bracketed sub-expression which is not the argument of anything. If it
+// contains an infix operator, the bracket type ends up on the children of 
+// that operator, otherwise it stays on the single operand.
+
+direct_parser::iterator direct_parser::group(iterator parent, bool& bracketed)
+	{
+	char open=str[pos];
+	str_node::bracket_t br=opening_bracket(open);
+	++pos;
+	skip_space();
+	if(peek(pos)==closing_bracket(open)) throw unsupported();
+
+	bool chbracketed, isop;
+	std::vector<iterator> brch;
+	iterator it=expression(parent, all_orders, chbracketed, isop, &brch);
+	skip_space();
+	if(peek(pos)!=closing_bracket(open)) throw unsupported();
+	++pos;
+
+	if(isop) {
+		for(unsigned int i=0; i<brch.size(); ++i)
+			if(brch[i]->fl.bracket!=br) throw unsupported();
+		exptree::sibling_iterator sib=tr.begin(it);
+		while(sib!=tr.end(it)) {
+			sib->fl.bracket=br;
+			++sib;
+			}
+		bracketed=false;
+		}
+	else {
+		if(chbracketed) throw unsupported();
+		it->fl.bracket=br;
+		bracketed=true;
+		}
+	char c=peek(pos);
+	if(opening_bracket(c)!=str_node::b_no || c=='_' || c=='^' || c=='$' || c=='&') 
+		throw unsupported();
+	return it;
+	}
+
+direct_parser::iterator direct_parser::atom(iterator parent, str_node::parent_rel_t rel)
+	{
+	unsigned int start=pos;
+	bool number=false;
+	char c=str[pos];
+	if(c=='@') {
+		++pos;
+		if(isdigit(peek(pos))) throw unsupported(); // equation label
+		while(pos<str.size()) {
+			c=str[pos];
+			if(is_name_char(c) || c=='_' || c=='^' || c=='@' || (c=='!' && peek(pos+1)!='=')) ++pos;
+			else break;
+			}
+		}
+	else if(c=='\\') {
+		++pos;
+		if(!isalpha(peek(pos))) throw unsupported();
+		while(pos<str.size() && is_name_char(str[pos])) 
+			++pos;
+		}
+	else if(isdigit(c)) {
+		number=true;
+		while(pos<str.size() && (isdigit(str[pos]) || (str[pos]=='.' && isdigit(peek(pos+1)))))
+			++pos;
+		}
+	else {
+		while(pos<str.size() && is_name_char(str[pos])) 
+			++pos;
+		}
+	iterator it=tr.append_child(parent, str_node(intern(start, pos), str_node::b_none, rel));
+	if(number) return it;
+
+	// Indices and arguments.
+	for(;;) {
+		c=peek(pos);
+		if(c=='_' || c=='^') {
+			str_node::parent_rel_t lrel=(c=='_'?str_node::p_sub:str_node::p_super);
+			++pos;
+			c=peek(pos);
+			if(c=='{') 
+				index_group(it, lrel);
+			else {
+				// A link without brackets only takes a single character or
+				// a single backslashed name; nothing may be attached to it.
+				start=pos;
+				if(c=='\\') {
+					++pos;
+					if(!isalpha(peek(pos))) throw unsupported();
+					while(pos<str.size() && is_name_char(str[pos])) 
+						++pos;
+					}
+				else if(isalnum(c) && !in_index) ++pos;
+				else throw unsupported();
+				tr.append_child(it, str_node(intern(start, pos), str_node::b_none, lrel));
+				c=peek(pos);
+				if(opening_bracket(c)!=str_node::b_no || c=='_' || c=='^' || c=='$' || c=='&' || c==':')
+					throw unsupported();
+				return it;
+				}
+			}
+		else if(opening_bracket(c)!=str_node::b_no) 
+			argument_group(it);
+		else if(c=='$' || c=='&') 
+			throw unsupported();
+		else break;
+		}
+	return it;
+	}
+
+void direct_parser::argument_group(iterator it)
+	{
+	char open=str[pos];
+	str_node::bracket_t br=opening_bracket(open);
+	++pos;
+	skip_space();
+	if(peek(pos)==closing_bracket(open)) throw unsupported();
+
+	unsigned int keep_index=in_index;
+	in_index=0;
+	bool bracketed, isop;
+	iterator ch=expression(it, all_orders, bracketed, isop);
+	if(bracketed) throw unsupported();
+	ch->fl.bracket=br;
+	in_index=keep_index;
+
+	skip_space();
+	if(peek(pos)!=closing_bracket(open)) throw unsupported();
+	++pos;
+	}
+
+// Indices in curly brackets, separated by whitespace; each of them 
+// becomes a child of 'it'.
+
+void direct_parser::index_group(iterator it, str_node::parent_rel_t rel)
+	{
+	++pos;
+	skip_space();
+	if(peek(pos)=='}') throw unsupported();
+
+	++in_index;
+	for(;;) {
+		skip_space();
+		char c=peek(pos);
+		if(c=='}') break;
+		if(c=='\\' || c=='@' || is_name_char(c)) atom(it, rel);
+		else throw unsupported();
+		c=peek(pos);
+		if(!(c=='}' || c=='\\' || is_space(c) || is_name_char(c))) 
+			throw unsupported();
+		}
+	--in_index;
+	++pos;
+	}
+
+// A property declaration 'obj::Property' or 'obj::Property(arguments)', 
+// which has to end the input.
+
+void direct_parser::property(iterator it)
+	{
+	pos+=2;
+	unsigned int start=pos;
+	if(!isalpha(peek(pos))) throw unsupported();
+	while(pos<str.size() && is_name_char(str[pos])) 
+		++pos;
+	iterator prop=tr.append_child(it, str_node(intern(start, pos), str_node::b_none, str_node::p_property));
+	if(opening_bracket(peek(pos))!=str_node::b_no)
+		argument_group(prop);
+	skip_space();
+	if(pos!=str.size()) throw unsupported();
+	}
+
+bool direct_parser::parse()
+	{
+	unsigned int existing=tr.number_of_children(top);
+	try {
+		skip_space();
+		if(pos==str.size()) throw unsupported();
+		if(peek(pos)==':' && peek(pos+1)==':') {
+			// Global properties, '::Property(...)'.
+			iterator it=tr.append_child(top, str_node(intern(""), str_node::b_none, str_node::p_none));
+			property(it);
+			}
+		else {
+			bool bracketed, isop;
+			iterator it=expression(top, all_orders, bracketed, isop);
+			// Outer brackets are removed.
+			if(bracketed) it->fl.bracket=str_node::b_none;
+			}
+		skip_space();
+		if(pos!=str.size()) throw unsupported();
+		}
+	catch(unsupported& ex) {
+		while(tr.number_of_children(top)>existing)
+			tr.erase(tr.child(top, existing));
+		return false;
+		}
+	return true;
+	}
+
+}
+
+parser::parser(bool preprocess, bool direct)
+	: preprocess_(preprocess), direct_(direct)
 	{
 	tree.set_head(str_node("\\expression", str_node::b_none, str_node::p_none));
 	parts=tree.begin();
@@ -124,6 +583,11 @@ bool parser::string2tree(const std::string& inp)
 		return true;
 
 	if(preprocess_) {
+		if(direct_) {
+			direct_parser dp(tree, parts, inp);
+			if(dp.parse()) 
+				return true;
+			}
 		std::stringstream ss(inp), ss2;
 		preprocessor pp;
 		ss >> pp;
@@ -24,6 +24,12 @@
   and turns it into a tree. The output of preprocessor.hh is assumed to be
   valid and consistent, so the code here is rather simple.
 
+  When the parser is asked to preprocess its input, it first tries to 
+  build the tree directly from the input text in a single pass. This
+  handles the common part of the input language and produces the same
+  tree as the preprocessor route; anything else is handed to the
+  preprocessor and string2tree as before.
+
 */
 
 #ifndef parser_hh_
@@ -35,7 +41,7 @@
 
 class parser { 
 	public:
-		parser(bool preprocess=false);
+		parser(bool preprocess=false, bool direct=true);
 	  
 		void erase();
 
@@ -47,6 +53,7 @@ class parser {
 		exptree tree;
 	private:
 		bool              preprocess_;
+		bool              direct_;     // try the one-pass parser before the preprocessor
 		exptree::iterator parts;
 		std::string       str;
 
@@ -23,10 +23,13 @@
 #include <stdlib.h>
 #include <typeinfo>
 #include <iostream>
+#include <unordered_map>
 
 properties::property_map_t            properties::props;
 properties::pattern_map_t             properties::pats;
+properties::declaration_map_t         properties::declarations;
 properties::registered_property_map_t properties::registered_properties;
+std::atomic<unsigned long>            properties::generation(1);
 
 void properties::register_properties()
 	{
@@ -170,6 +173,182 @@ void properties::clear()
 		 }
 	props.clear();
 	pats.clear();
+	declarations.clear();
+	invalidate_cache();
+	}
+
+// The get_composite cache. Pattern matching only looks at the names, multipliers,
+// brackets and parent relations in the subtree (and at other properties), so these,
+// together with the property type and the lookup flags, form the key. Keys of
+// subtrees with more than max_cached_nodes nodes are not worth building.
+// Names and rationals enter the key through their addresses; rset_t::sweep
+// invalidates the cache whenever it frees rationals.
+//
+// Every thread has its own cache, so lookups never take a lock. A thread notices
+// that the properties have changed by comparing the generation counter, and then
+// starts afresh.
+
+namespace {
+	const unsigned int max_cached_nodes =32;
+	const size_t       max_cache_entries=1<<16;
+
+	struct lookup_entry {
+		std::vector<uintptr_t> key;
+		const void            *ret;
+		int                    serialnum;
+	};
+	typedef std::unordered_multimap<size_t, lookup_entry> lookup_cache_t;
+
+	thread_local lookup_cache_t lookup_cache;
+	thread_local unsigned long  lookup_generation=0;
+
+	/// Feed the words describing the subtree at 'it' to 'f', in pre-order, with
+	/// a marker after the children of every node. Returns false if the subtree
+	/// is too large to be cached. The multiplier of the top node is not used
+	/// when matching, so it is left out.
+	template<class F>
+	bool subtree_shape(exptree::iterator it, F& f, unsigned int& nodes, bool top=true)
+		{
+		if(++nodes>max_cached_nodes)
+			return false;
+		f(reinterpret_cast<uintptr_t>(&(*it->name)));
+		f(top?0:reinterpret_cast<uintptr_t>(&(*it->multiplier)));
+		f((it->fl.bracket<<4) | it->fl.parent_rel);
+		exptree::sibling_iterator sib=it.begin();
+		while(sib!=it.end()) {
+			if(!subtree_shape(sib, f, nodes, false))
+				return false;
+			++sib;
+			}
+		f(~uintptr_t(0));
+		return true;
+		}
+
+	class shape_hasher {
+		public:
+			shape_hasher() : hash(14695981039346656037ULL) {};
+			void operator()(uintptr_t w) { hash=(hash^w)*1099511628211ULL; };
+			unsigned long long hash;
+	};
+
+	class shape_collector {
+		public:
+			void operator()(uintptr_t w) { key.push_back(w); };
+			std::vector<uintptr_t> key;
+	};
+
+	class shape_comparer {
+		public:
+			shape_comparer(const std::vector<uintptr_t>& k) : key(k), pos(2), same(true) {};
+			void operator()(uintptr_t w) { if(same) same=(pos<key.size() && key[pos++]==w); };
+			const std::vector<uintptr_t>& key;
+			size_t                        pos;
+			bool                          same;
+	};
+}
+
+namespace {
+	std::vector<property_types::caster_t>& caster_table()
+		{
+		static std::vector<property_types::caster_t> table;
+		return table;
+		}
+}
+
+unsigned int property_types::register_type(caster_t fun)
+	{
+	caster_table().push_back(fun);
+	return caster_table().size()-1;
+	}
+
+const std::vector<property_types::caster_t>& property_types::casters()
+	{
+	return caster_table();
+	}
+
+void properties::resolve_casts(const property_base *pb)
+	{
+	const std::vector<property_types::caster_t>& fun=property_types::casters();
+	pb->casts.resize(fun.size());
+	for(size_t i=0; i<fun.size(); ++i)
+		pb->casts[i]=fun[i](pb);
+	}
+
+void properties::invalidate_cache()
+	{
+	++generation;
+	}
+
+properties::lookup_key::lookup_key(unsigned int ty, exptree::iterator i, bool ignore_parent_rel, bool doserial)
+	: it(i), type(ty), flags((ignore_parent_rel?1:0) | (doserial?2:0))
+	{
+	shape_hasher hs;
+	hs(type);
+	hs(flags);
+	unsigned int nodes=0;
+	cacheable=subtree_shape(it, hs, nodes);
+	hash=hs.hash;
+	}
+
+bool properties::lookup_key::find(const void *& ret, int& serialnum) const
+	{
+	if(!cacheable) 
+		return false;
+
+	const unsigned long gen=generation;
+	if(lookup_generation!=gen) {
+		lookup_cache.clear();
+		lookup_generation=gen;
+		return false;
+		}
+
+	std::pair<lookup_cache_t::const_iterator, lookup_cache_t::const_iterator> range=lookup_cache.equal_range(hash);
+	while(range.first!=range.second) {
+		const lookup_entry& entry=range.first->second;
+		if(entry.key[0]==type && entry.key[1]==flags) {
+			shape_comparer cmp(entry.key);
+			unsigned int nodes=0;
+			subtree_shape(it, cmp, nodes);
+			if(cmp.same && cmp.pos==entry.key.size()) {
+				ret=entry.ret;
+				if(ret && (flags&2))
+					serialnum=entry.serialnum;
+				return true;
+				}
+			}
+		++range.first;
+		}
+	return false;
+	}
+
+void properties::lookup_key::store(const void *ret, int serialnum) const
+	{
+	// Do not store results computed while the properties were changing.
+	if(!cacheable || lookup_generation!=generation) 
+		return;
+
+	if(lookup_cache.size()>=max_cache_entries)
+		lookup_cache.clear();
+
+	lookup_entry entry;
+	shape_collector col;
+	col(type);
+	col(flags);
+	unsigned int nodes=0;
+	subtree_shape(it, col, nodes);
+	entry.key.swap(col.key);
+	entry.ret=ret;
+	entry.serialnum=(ret && (flags&2))?serialnum:0;
+	lookup_cache.insert(lookup_cache_t::value_type(hash, entry));
+	}
+
+void properties::declare(const property_base *pr, const exptree& args)
+	{
+	static unsigned long serial=0;
+
+	declaration_t& decl=declarations[pr];
+	decl.serial=serial++;
+	decl.args=args;
 	}
 
 void properties::register_property(property_base* (*fun)())
@@ -340,6 +519,7 @@ void properties::insert_prop(const exptree& et, const property *pr)
 					const property_base *oldprop=pit.first->second.second;
 					props.erase(pit.first);
 					pats.erase(oldprop);
+					declarations.erase(oldprop);
 					delete oldpat;
 					delete oldprop;
 					break;
@@ -349,8 +529,10 @@ void properties::insert_prop(const exptree& et, const property *pr)
 		++pit.first;
 		}
 
+	resolve_casts(pr);
 	pats.insert(pattern_map_t::value_type(pr, pat));
 	properties::props.insert(property_map_t::value_type(pat->obj.begin()->name_only(), pat_prop_pair_t(pat,pr)));
+	invalidate_cache();
 	}
 
 void properties::insert_list_prop(const std::vector<exptree>& its, const list_property *pr)
@@ -384,6 +566,7 @@ void properties::insert_list_prop(const std::vector<exptree>& its, const list_pr
 		}
 	if(to_delete_property) {
 		pats.erase(to_delete_property);
+		declarations.erase(to_delete_property);
 		property_map_t::iterator it=props.begin();
 		while(it!=props.end()) {
 			property_map_t::iterator nxt=it;
@@ -395,6 +578,7 @@ void properties::insert_list_prop(const std::vector<exptree>& its, const list_pr
 	
 	
 	// Now register the list property.
+	resolve_casts(pr);
 
 	for(unsigned int i=0; i<its.size(); ++i) {
 		pattern *pat=new pattern(its[i]);
@@ -443,6 +627,7 @@ void properties::insert_list_prop(const std::vector<exptree>& its, const list_pr
 		pats.insert(pattern_map_t::value_type(pr, pat));
 		properties::props.insert(property_map_t::value_type(pat->obj.begin()->name_only(), pat_prop_pair_t(pat,pr)));
 		}
+	invalidate_cache();
 	}
 
 
@@ -568,7 +753,7 @@ bool Indices::parse(exptree& tr, exptree::iterator pat, exptree::iterator prop,
 			else throw consistency_error("Position type should be fixed, free or independent.");
 			}
 		else if(ki->first=="values") {
-			values=*ki->second;
+			values=exptree(ki->second);
 			if(*values.begin()->name!="\\comma") 
 				throw consistency_error("Key 'values' of property 'Indices' needs a list as value.");
 			}
@@ -30,6 +30,7 @@
 
 #include <map>
 #include <list>
+#include <vector>
 #include "storage.hh"
 
 class pattern { 
@@ -66,6 +67,32 @@ class keyval_t {
 		kvlist_t keyvals;
 };
 
+class property_base;
+
+/// Every type T for which properties are looked up (with properties::get<T> and
+/// friends) gets a small number, property_type<T>::id(). All types are numbered
+/// during static initialisation, and every property keeps a table with the result
+/// of casting itself to each of them, which is filled in when the property is
+/// registered. Lookups then index this table instead of doing a dynamic_cast
+/// through the virtual inheritance hierarchy below.
+
+class property_types {
+	public:
+		typedef const void *(*caster_t)(const property_base *);
+
+		static unsigned int                 register_type(caster_t);
+		static const std::vector<caster_t>& casters();
+};
+
+template<class T>
+class property_type {
+	public:
+		static unsigned int id();
+		static const void  *cast(const property_base *);
+	private:
+		static const unsigned int registered_;
+};
+
 /// Base class for all properties, handling argument parsing and defining the
 /// interface.
 class property_base {
@@ -86,10 +113,33 @@ class property_base {
 		//   exact_match: these properties are exactly identical
 		enum match_t { no_match, id_match, exact_match };
 		virtual match_t equals(const property_base *) const;
+
+		/// This property cast to each of the types numbered by property_type; set by
+		/// properties::resolve_casts.
+		mutable std::vector<const void *> casts;
 	private:
 		bool                parse_one_argument(exptree::iterator arg, keyval_t& keyvals);
 };
 
+template<class T>
+unsigned int property_type<T>::id()
+	{
+	static const unsigned int num=property_types::register_type(&property_type<T>::cast);
+	(void)&registered_;
+	return num;
+	}
+
+template<class T>
+const void *property_type<T>::cast(const property_base *pb)
+	{
+	return dynamic_cast<const T *>(pb);
+	}
+
+// Referring to this from id() makes sure that all types are numbered before main()
+// runs, and hence before any property is registered.
+template<class T>
+const unsigned int property_type<T>::registered_=property_type<T>::id();
+
 /// Placeholder.
 /// \bug Should be merged with property_base.
 class property : public property_base {
@@ -165,6 +215,10 @@ class properties {
 		typedef std::multimap<const property_base *, pattern *>                 pattern_map_t;
 
 		static void            insert_prop(const exptree&, const property *);
+		/// Fill the table of casts of a property; done by the insert functions.
+		static void            resolve_casts(const property_base *);
+		/// Cast a registered property to T, or return zero if it does not have type T.
+		template<class T> static const T* cast(const property_base *);
 		static void            insert_list_prop(const std::vector<exptree>&, const list_property *);
 		static void            clear();
 
@@ -175,6 +229,39 @@ class properties {
 		static property_map_t  props;
 		static pattern_map_t   pats;   // for list properties, objects are stored here in order
 
+		/// The argument tree (property name plus arguments) from which each property 
+		/// object was created, and a serial number giving the order of creation, so 
+		/// that properties can be re-created when a saved state is loaded.
+		class declaration_t {
+			public:
+				unsigned long serial;
+				exptree       args;
+		};
+		typedef std::map<const property_base *, declaration_t>                  declaration_map_t;
+		static declaration_map_t declarations;
+		static void              declare(const property_base *, const exptree& args);
+
+		/// Results of get_composite are cached per thread, keyed on the property type and
+		/// the shape of the subtree. Every change to the property maps has to increase the
+		/// generation counter, which makes all threads drop their cached results.
+		static std::atomic<unsigned long> generation;
+		static void                       invalidate_cache();
+
+		class lookup_key {
+			public:
+				lookup_key(unsigned int type, exptree::iterator, bool ignore_parent_rel, bool doserial);
+
+				/// Find a cached result; sets 'serialnum' only when a serial number was requested.
+				bool find(const void *& ret, int& serialnum) const;
+				void store(const void *ret, int serialnum) const;
+
+			private:
+				exptree::iterator it;
+				uintptr_t         type, flags;
+				size_t            hash;
+				bool              cacheable;
+		};
+
 		// Normal search: given a pattern, get its property if any.
 		template<class T> static const T*  get(exptree::iterator, bool ignore_parent_rel=false); // Shorthand for get_composite
 		template<class T> static const T*  get();
@@ -207,6 +294,15 @@ class properties {
 //																	  property_map_t::iterator=props.begin());		
 };
 
+template<class T>
+const T* properties::cast(const property_base *pb)
+	{
+	const unsigned int id=property_type<T>::id();
+	if(id<pb->casts.size())
+		return static_cast<const T *>(pb->casts[id]);
+	return dynamic_cast<const T *>(pb);
+	}
+
 template<class T>
 const T* properties::get(exptree::iterator it, bool ignore_parent_rel)
 	{
@@ -227,6 +323,13 @@ const T* properties::get_composite(exptree::iterator it, int& serialnum, bool do
 	bool inherits=false;
 
 	std::pair<property_map_t::iterator, property_map_t::iterator> pit=props.equal_range(it->name_only());
+	if(pit.first==pit.second)
+		return 0;
+
+	lookup_key key(property_type<T>::id(), it, ignore_parent_rel, doserial);
+	const void *cached;
+	if(key.find(cached, serialnum))
+		return static_cast<const T *>(cached);
 	
 	// First look for properties of the node itself. Go through the loop twice:
 	// once looking for patterns which do not have wildcards, and then looking
@@ -240,7 +343,7 @@ const T* properties::get_composite(exptree::iterator it, int& serialnum, bool do
 //				std::cout << "comparing " << *(walk->second.first->obj.begin()->name) << std::endl;
 				if((*walk).second.first->match(it, ignore_parent_rel)) { // match found
 //					std::cout << "found match" << std::endl;
-					ret=dynamic_cast<const T *>((*walk).second.second);
+					ret=cast<T>((*walk).second.second);
 					if(ret) { // found! determine serial number
 //						std::cout << "found property" << std::endl;
 						if(doserial) {
@@ -257,9 +360,9 @@ const T* properties::get_composite(exptree::iterator it, int& serialnum, bool do
 						break;
 						}
 //					else 						std::cout << "NOT found property" << std::endl;
-					if(dynamic_cast<const PropertyInherit *>((*walk).second.second)) 
+					if(cast<PropertyInherit>((*walk).second.second)) 
 						inherits=true;
-					else if(dynamic_cast<const Inherit<T> *>((*walk).second.second)) 
+					else if(cast<Inherit<T> >((*walk).second.second)) 
 						inherits=true;
 					}
 //				else std::cout << "NOT found match" << std::endl;
@@ -289,6 +392,7 @@ const T* properties::get_composite(exptree::iterator it, int& serialnum, bool do
 			}
 		}
 
+	key.store(ret, serialnum);
 	return ret;
 	}
 
@@ -315,7 +419,7 @@ const T* properties::get_composite(exptree::iterator it, int& serialnum, const s
 		while(walk!=pit.second) {
 			if(wildcards==(*walk).second.first->children_wildcard()) {
 				if((*walk).second.first->match(it)) { // match found
-					ret=dynamic_cast<const T *>((*walk).second.second);
+					ret=cast<T>((*walk).second.second);
 					if(ret) { // found! determine serial number
 						if(ret->label!=label && ret->label!="all") 
 							ret=0;
@@ -325,9 +429,9 @@ const T* properties::get_composite(exptree::iterator it, int& serialnum, const s
 							break;
 							}
 						}
-					if(dynamic_cast<const PropertyInherit *>((*walk).second.second))
+					if(cast<PropertyInherit>((*walk).second.second))
 						inherits=true;
-					else if(dynamic_cast<const Inherit<T> *>((*walk).second.second)) 
+					else if(cast<Inherit<T> >((*walk).second.second)) 
 						inherits=true;
 					}
 				}
@@ -373,12 +477,12 @@ const T* properties::get_composite(exptree::iterator it1, exptree::iterator it2,
 	property_map_t::iterator walk1=pit1.first;
 	while(walk1!=pit1.second) {
 		if((*walk1).second.first->match(it1, ignore_parent_rel)) { // match for object 1 found
-			ret1=dynamic_cast<const T *>((*walk1).second.second);
+			ret1=cast<T>((*walk1).second.second);
 			if(ret1) { // property of the right type found for object 1
 				property_map_t::iterator walk2=pit2.first;
 				while(walk2!=pit2.second) {
 					if((*walk2).second.first->match(it2, ignore_parent_rel)) { // match for object 1 found
-						ret2=dynamic_cast<const T *>((*walk2).second.second);
+						ret2=cast<T>((*walk2).second.second);
 						if(ret2) { // property of the right type found for object 2
 							if(ret1==ret2) { 
 								serialnum1=serial_number( (*walk1).second.second, (*walk1).second.first );
@@ -388,12 +492,12 @@ const T* properties::get_composite(exptree::iterator it1, exptree::iterator it2,
 								}
 							}
 						}
-					if(dynamic_cast<const PropertyInherit *>((*walk2).second.second))
+					if(cast<PropertyInherit>((*walk2).second.second))
 						inherits2=true;
 					++walk2;
 					}
 				}
-			if(dynamic_cast<const PropertyInherit *>((*walk1).second.second))
+			if(cast<PropertyInherit>((*walk1).second.second))
 				inherits1=true;
 			}
 		++walk1;
@@ -438,7 +542,7 @@ const T* properties::get()
 	std::pair<property_map_t::iterator, property_map_t::iterator> pit=
 		props.equal_range(nit);
 	while(pit.first!=pit.second) {
-		ret=dynamic_cast<const T *>((*pit.first).second.second);
+		ret=cast<T>((*pit.first).second.second);
 		if(ret) break;
 		++pit.first;
 		}
@@ -23,6 +23,8 @@
 void settings::register_properties()
 	{
 	properties::register_property(&create_property<KeepHistory>);
+	properties::register_property(&create_property<Threads>);
+	properties::register_property(&create_property<TermBudget>);
 	properties::register_property(&create_property<PreDefaultRules>);
 	properties::register_property(&create_property<PostDefaultRules>);
 	}
@@ -40,12 +42,82 @@ bool KeepHistory::parse(exptree& tr, exptree::iterator pat, exptree::iterator pr
 		if(*ki->second->name=="false")
 			value=false;
 
+	depth=0;
+	ki=keyvals.find("depth");
+	if(ki!=keyvals.end()) {
+		if(!ki->second->is_integer() || *ki->second->multiplier<1) {
+			txtout << name() << ": depth should be a positive integer." << std::endl;
+			return false;
+			}
+		depth=to_long(*ki->second->multiplier);
+		}
+
 	return true;
 	}
 
 void KeepHistory::display(std::ostream& str) const
 	{
-	str << name() << "(" << (value?"true":"false") << ")";
+	str << name() << "(" << (value?"true":"false");
+	if(depth>0)
+		str << ", depth=" << depth;
+	str << ")";
+	}
+
+std::string Threads::name() const
+	{
+	return "Threads";
+	}
+
+bool Threads::parse(exptree& tr, exptree::iterator pat, exptree::iterator prop, keyval_t& keyvals)
+	{
+	keyval_t::const_iterator ki=keyvals.find("number");
+	value=1;
+	if(ki!=keyvals.end()) {
+		if(!ki->second->is_integer() || *ki->second->multiplier<1) {
+			txtout << name() << ": argument should be a positive integer." << std::endl;
+			return false;
+			}
+		value=to_long(*ki->second->multiplier);
+		}
+
+	return true;
+	}
+
+void Threads::display(std::ostream& str) const
+	{
+	str << name() << "(" << value << ")";
+	}
+
+std::string TermBudget::name() const
+	{
+	return "TermBudget";
+	}
+
+bool TermBudget::parse(exptree& tr, exptree::iterator pat, exptree::iterator prop, keyval_t& keyvals)
+	{
+	keyval_t::const_iterator ki=keyvals.find("number");
+	if(ki==keyvals.end() || !ki->second->is_integer() || *ki->second->multiplier<1) {
+		txtout << name() << ": argument should be a positive integer." << std::endl;
+		return false;
+		}
+	value=to_long(*ki->second->multiplier);
+
+	abort=false;
+	ki=keyvals.find("action");
+	if(ki!=keyvals.end()) {
+		if(*ki->second->name=="abort")     abort=true;
+		else if(*ki->second->name!="warn") {
+			txtout << name() << ": action should be either 'warn' or 'abort'." << std::endl;
+			return false;
+			}
+		}
+
+	return true;
+	}
+
+void TermBudget::display(std::ostream& str) const
+	{
+	str << name() << "(" << value << ", action=" << (abort?"abort":"warn") << ")";
 	}
 
 std::string PreDefaultRules::name() const
@@ -36,7 +36,29 @@ class KeepHistory : public property {
 		virtual void   display(std::ostream&) const;
 		virtual std::string unnamed_argument() const { return "set"; };
 
-		bool value;
+		bool           value;
+		unsigned int   depth; // maximal number of previous steps kept, 0 for all
+};
+
+class Threads : public property {
+	public:
+		virtual        std::string name() const;
+		bool           parse(exptree& tr, exptree::iterator pat, exptree::iterator prop, keyval_t&);
+		virtual void   display(std::ostream&) const;
+		virtual std::string unnamed_argument() const { return "number"; };
+
+		unsigned int   value;
+};
+
+class TermBudget : public property {
+	public:
+		virtual        std::string name() const;
+		bool           parse(exptree& tr, exptree::iterator pat, exptree::iterator prop, keyval_t&);
+		virtual void   display(std::ostream&) const;
+		virtual std::string unnamed_argument() const { return "number"; };
+
+		unsigned long  value;
+		bool           abort; // refuse to expand, instead of only warning
 };
 
 class DefRules : public property {
@@ -0,0 +1,542 @@
+/*
+
+	Cadabra: a field-theory motivated computer algebra system.
+	Copyright (C) 2001-2011  Kasper Peeters <kasper.peeters@aei.mpg.de>
+
+   This program is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation, either version 3 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "snapshot.hh"
+#include "props.hh"
+#include "history.hh"
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <vector>
+#include <unordered_map>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+extern thread_local std::ostream *fake_txtout;
+#define txtout (*fake_txtout)
+
+namespace {
+
+const char          magic[8]={ 'C','D','B','S','T','A','T','E' };
+const unsigned long format_version=1;
+
+// Encoder for the body of the file; the name and rational tables are
+// written in front of it once all trees have been encoded.
+
+class writer {
+	public:
+		writer();
+
+		void varint(unsigned long);
+		void string(const std::string&);
+		void tree(exptree::iterator);
+
+		std::string                                          body;
+		std::vector<const multiplier_t *>                    rationals;
+	private:
+		std::unordered_map<const std::string *, unsigned long>  name_index;
+		std::unordered_map<const multiplier_t *, unsigned long> rat_index;
+};
+
+writer::writer()
+	{
+	unsigned long num=0;
+	for(nset_t::const_iterator it=name_set.begin(); it!=name_set.end(); ++it)
+		name_index[&(*it)]=num++;
+	}
+
+void writer::varint(unsigned long val)
+	{
+	while(val>=0x80) {
+		body+=(char)((val&0x7f)|0x80);
+		val>>=7;
+		}
+	body+=(char)val;
+	}
+
+void writer::string(const std::string& str)
+	{
+	varint(str.size());
+	body+=str;
+	}
+
+void writer::tree(exptree::iterator top)
+	{
+	exptree::pre_order_iterator it=top, stop=top;
+	stop.skip_children();
+	++stop;
+	while(it!=stop) {
+		varint(name_index[&(*it->name)]);
+		const multiplier_t *mult=&(*it->multiplier);
+		std::pair<std::unordered_map<const multiplier_t *, unsigned long>::iterator, bool> ins=
+			rat_index.insert(std::make_pair(mult, rationals.size()));
+		if(ins.second)
+			rationals.push_back(mult);
+		varint(ins.first->second);
+		body+=(char)it->packed_flags();
+		varint(exptree::number_of_children(it));
+		++it;
+		}
+	}
+
+// Decoder working directly on the mapped file.
+
+class reader {
+	public:
+		reader(const char *start, size_t len);
+
+		class corrupt {};
+
+		unsigned long varint();
+		std::string   string();
+		void          tree(exptree&, exptree::iterator parent);
+
+		std::vector<nset_t::iterator> names;
+		std::vector<rset_t::iterator> rationals;
+		const char                   *pos, *end;
+	private:
+		str_node      node(unsigned long& children);
+};
+
+reader::reader(const char *start, size_t len)
+	: pos(start), end(start+len)
+	{
+	}
+
+unsigned long reader::varint()
+	{
+	unsigned long val=0;
+	unsigned int  shift=0;
+	for(;;) {
+		if(pos==end || shift>=8*sizeof(unsigned long)) throw corrupt();
+		unsigned char c=*pos++;
+		val|=((unsigned long)(c&0x7f))<<shift;
+		if((c&0x80)==0) break;
+		shift+=7;
+		}
+	return val;
+	}
+
+std::string reader::string()
+	{
+	unsigned long len=varint();
+	if(len>(unsigned long)(end-pos)) throw corrupt();
+	std::string ret(pos, len);
+	pos+=len;
+	return ret;
+	}
+
+str_node reader::node(unsigned long& children)
+	{
+	unsigned long nm=varint();
+	unsigned long rat=varint();
+	if(nm>=names.size() || rat>=rationals.size() || pos==end) throw corrupt();
+	str_node ret(names[nm]);
+	ret.multiplier=rationals[rat];
+	ret.unpack_flags(*pos++);
+	children=varint();
+	// Every node takes at least four bytes, which bounds the number of children.
+	if(children>(unsigned long)(end-pos)/4) throw corrupt();
+	return ret;
+	}
+
+void reader::tree(exptree& tr, exptree::iterator parent)
+	{
+	std::vector<std::pair<exptree::iterator, unsigned long> > todo;
+	unsigned long children;
+
+	str_node nd=node(children);
+	exptree::iterator it;
+	if(parent==tr.end()) it=tr.insert(tr.end(), nd);
+	else                 it=tr.append_child(parent, nd);
+	if(children>0) todo.push_back(std::make_pair(it, children));
+
+	while(todo.size()>0) {
+		nd=node(children);
+		it=tr.append_child(todo.back().first, nd);
+		if(--todo.back().second==0)
+			todo.pop_back();
+		if(children>0)
+			todo.push_back(std::make_pair(it, children));
+		}
+	}
+
+// A property as stored in the snapshot, together with the objects
+// re-created from it on load.
+
+struct property_record {
+		exptree                declaration;
+		property_base         *prop;
+		std::vector<pattern *> patterns;
+};
+
+// Order in which the properties were declared; properties without a
+// recorded declaration go first.
+
+class declaration_order {
+	public:
+		bool operator()(const property_base *one, const property_base *two) const
+			{
+			return serial(one)<serial(two);
+			}
+	private:
+		unsigned long serial(const property_base *pr) const
+			{
+			properties::declaration_map_t::const_iterator dit=properties::declarations.find(pr);
+			if(dit==properties::declarations.end()) return 0;
+			return dit->second.serial+1;
+			}
+};
+
+// Re-create a property by parsing its arguments again. Messages printed
+// while parsing are collected in 'messages'.
+
+bool recreate_property(property_record& rec, std::string& error, std::ostringstream& messages)
+	{
+	const std::string& propname=*rec.declaration.begin()->name;
+	properties::registered_property_map_t::iterator fit=
+		properties::registered_properties.store.find(propname);
+	if(fit==properties::registered_properties.store.end()) {
+		error="property \""+propname+"\" is not registered";
+		return false;
+		}
+	rec.prop=(*fit).second();
+
+	// List properties were declared on a list of objects, the others are
+	// parsed on the one object they are attached to.
+	exptree objs;
+	if(dynamic_cast<list_property *>(rec.prop)==0)
+		objs=rec.patterns[0]->obj;
+	else {
+		objs.set_head(str_node("\\comma"));
+		for(unsigned long j=0; j<rec.patterns.size(); ++j)
+			objs.append_child(objs.begin(), rec.patterns[j]->obj.begin());
+		}
+
+	std::ostream *remember_txtout=fake_txtout;
+	fake_txtout=&messages;
+	bool ok=false;
+	keyval_t keyvals;
+	try {
+		if(rec.prop->preparse_arguments(rec.declaration.begin(), keyvals) &&
+			rec.prop->parse(objs, objs.begin(), rec.declaration.begin(), keyvals)) {
+			property *theprop=dynamic_cast<property *>(rec.prop);
+			if(theprop)
+				theprop->core_parse(keyvals);
+			ok=true;
+			}
+		else error="arguments of property \""+propname+"\" are not accepted";
+		}
+	catch(std::exception& ex) {
+		error=ex.what();
+		}
+	fake_txtout=remember_txtout;
+
+	if(!ok) {
+		delete rec.prop;
+		rec.prop=0;
+		}
+	return ok;
+	}
+
+// Re-create all properties and register them. Since the arguments of a
+// property can refer to other properties (e.g. Depends), each property
+// is registered as soon as it has been created, and properties which
+// fail are tried again after the others, until no more progress is
+// made. On failure, the objects which have not been registered are
+// deleted.
+
+bool recreate_properties(std::vector<property_record>& records, std::string& error)
+	{
+	std::vector<unsigned long> todo;
+	for(unsigned long i=0; i<records.size(); ++i)
+		todo.push_back(i);
+
+	std::ostringstream messages;
+	while(todo.size()>0) {
+		std::vector<unsigned long> failed;
+		messages.str("");
+		for(unsigned long i=0; i<todo.size(); ++i) {
+			property_record& rec=records[todo[i]];
+			if(recreate_property(rec, error, messages)==false) {
+				failed.push_back(todo[i]);
+				continue;
+				}
+			properties::resolve_casts(rec.prop);
+			for(unsigned long j=0; j<rec.patterns.size(); ++j) {
+				pattern *pat=rec.patterns[j];
+				properties::pats.insert(properties::pattern_map_t::value_type(rec.prop, pat));
+				properties::props.insert(properties::property_map_t::value_type(pat->obj.begin()->name_only(), 
+																									 properties::pat_prop_pair_t(pat, rec.prop)));
+				}
+			properties::declare(rec.prop, rec.declaration);
+			properties::invalidate_cache();
+			}
+		if(failed.size()==todo.size()) {
+			txtout << messages.str();
+			for(unsigned long i=0; i<failed.size(); ++i)
+				for(unsigned long j=0; j<records[failed[i]].patterns.size(); ++j)
+					delete records[failed[i]].patterns[j];
+			return false;
+			}
+		todo.swap(failed);
+		}
+	return true;
+	}
+
+void delete_patterns(std::vector<property_record>& records)
+	{
+	for(unsigned long i=0; i<records.size(); ++i)
+		for(unsigned long j=0; j<records[i].patterns.size(); ++j)
+			delete records[i].patterns[j];
+	}
+
+}
+
+bool snapshot::save(const std::string& filename, const exptree& expressions,
+						  unsigned int last_used_equation_number, std::string& error)
+	{
+	writer wr;
+
+	wr.varint(last_used_equation_number);
+
+	// Expressions.
+	unsigned long num=0;
+	exptree::sibling_iterator sib=expressions.begin();
+	while(sib!=expressions.end()) {
+		++num;
+		++sib;
+		}
+	wr.varint(num);
+	sib=expressions.begin();
+	while(sib!=expressions.end()) {
+		if(*sib->name=="\\history") {
+			// Packed steps are written out in full, and packed again on load.
+			exptree full(sib);
+			history::unpack_all(full);
+			wr.tree(full.begin());
+			}
+		else wr.tree(sib);
+		++sib;
+		}
+
+	// Properties, in the order in which they were declared, each with its
+	// patterns in the order of the pattern map.
+	std::map<const pattern *, std::pair<unsigned long, unsigned long> > pattern_pos;
+	std::vector<const property_base *> order;
+	properties::pattern_map_t::const_iterator pit=properties::pats.begin();
+	while(pit!=properties::pats.end()) {
+		if(order.size()==0 || order.back()!=pit->first)
+			order.push_back(pit->first);
+		++pit;
+		}
+	std::stable_sort(order.begin(), order.end(), declaration_order());
+	wr.varint(order.size());
+	for(unsigned long i=0; i<order.size(); ++i) {
+		properties::declaration_map_t::const_iterator dit=properties::declarations.find(order[i]);
+		if(dit!=properties::declarations.end())
+			wr.tree(dit->second.args.begin());
+		else {
+			exptree decl(str_node(order[i]->name(), str_node::b_none, str_node::p_property));
+			wr.tree(decl.begin());
+			}
+		std::pair<properties::pattern_map_t::const_iterator, properties::pattern_map_t::const_iterator>
+			range=properties::pats.equal_range(order[i]);
+		wr.varint(std::distance(range.first, range.second));
+		num=0;
+		while(range.first!=range.second) {
+			pattern_pos[range.first->second]=std::make_pair(i, num++);
+			wr.tree(range.first->second->obj.begin());
+			++range.first;
+			}
+		}
+
+	// The property map, as references into the list above.
+	wr.varint(properties::props.size());
+	properties::property_map_t::const_iterator prit=properties::props.begin();
+	while(prit!=properties::props.end()) {
+		std::map<const pattern *, std::pair<unsigned long, unsigned long> >::const_iterator
+			pp=pattern_pos.find(prit->second.first);
+		if(pp==pattern_pos.end()) {
+			error="property map refers to an unknown pattern";
+			return false;
+			}
+		wr.varint(pp->second.first);
+		wr.varint(pp->second.second);
+		++prit;
+		}
+
+	// Tables and header in front of the body.
+	writer tables;
+	tables.body.append(magic, sizeof(magic));
+	tables.varint(format_version);
+	tables.varint(name_set.size());
+	for(nset_t::const_iterator it=name_set.begin(); it!=name_set.end(); ++it)
+		tables.string(*it);
+	tables.varint(wr.rationals.size());
+	for(unsigned long i=0; i<wr.rationals.size(); ++i)
+		tables.string(wr.rationals[i]->get_str());
+
+	std::ofstream str(filename.c_str(), std::ios::out|std::ios::binary|std::ios::trunc);
+	if(!str.is_open()) {
+		error="cannot open \""+filename+"\" for writing";
+		return false;
+		}
+	str.write(tables.body.data(), tables.body.size());
+	str.write(wr.body.data(), wr.body.size());
+	str.close();
+	if(!str) {
+		error="error while writing \""+filename+"\"";
+		return false;
+		}
+	return true;
+	}
+
+bool snapshot::load(const std::string& filename, exptree& expressions,
+						  unsigned int& last_used_equation_number, std::string& error)
+	{
+	int fd=open(filename.c_str(), O_RDONLY);
+	if(fd<0) {
+		error="cannot open \""+filename+"\"";
+		return false;
+		}
+	struct stat st;
+	if(fstat(fd, &st)!=0 || st.st_size<(off_t)sizeof(magic)) {
+		close(fd);
+		error="\""+filename+"\" is not a saved state";
+		return false;
+		}
+	size_t len=st.st_size;
+	void *map=mmap(0, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map==MAP_FAILED) {
+		error="cannot map \""+filename+"\" into memory";
+		return false;
+		}
+
+	reader rd((const char *)map, len);
+	exptree                      newexp;
+	unsigned long                newlast=0;
+	std::vector<property_record> records;
+	std::vector<std::pair<unsigned long, unsigned long> > propmap;
+	try {
+		if(std::string(rd.pos, sizeof(magic))!=std::string(magic, sizeof(magic))) 
+			error="\""+filename+"\" is not a saved state";
+		else {
+			rd.pos+=sizeof(magic);
+			if(rd.varint()!=format_version) 
+				error="\""+filename+"\" was written by an incompatible version";
+			}
+		if(error.size()>0) {
+			munmap(map, len);
+			return false;
+			}
+
+		unsigned long num=rd.varint();
+		for(unsigned long i=0; i<num; ++i)
+			rd.names.push_back(name_set.insert(rd.string()).first);
+		num=rd.varint();
+		for(unsigned long i=0; i<num; ++i) {
+			multiplier_t mult;
+			if(mult.set_str(rd.string(), 10)!=0) throw reader::corrupt();
+			rd.rationals.push_back(rat_set.insert(mult).first);
+			}
+
+		newlast=rd.varint();
+		num=rd.varint();
+		for(unsigned long i=0; i<num; ++i)
+			rd.tree(newexp, newexp.end());
+
+		num=rd.varint();
+		for(unsigned long i=0; i<num; ++i) {
+			records.push_back(property_record());
+			property_record& rec=records.back();
+			rec.prop=0;
+			rd.tree(rec.declaration, rec.declaration.end());
+			unsigned long pnum=rd.varint();
+			if(pnum==0) throw reader::corrupt();
+			for(unsigned long j=0; j<pnum; ++j) {
+				exptree pat;
+				rd.tree(pat, pat.end());
+				rec.patterns.push_back(new pattern(pat));
+				}
+			}
+
+		num=rd.varint();
+		for(unsigned long i=0; i<num; ++i) {
+			unsigned long rec=rd.varint();
+			unsigned long pat=rd.varint();
+			if(rec>=records.size() || pat>=records[rec].patterns.size()) throw reader::corrupt();
+			propmap.push_back(std::make_pair(rec, pat));
+			}
+		if(rd.pos!=rd.end) throw reader::corrupt();
+		}
+	catch(reader::corrupt& ex) {
+		error="\""+filename+"\" is truncated or corrupt";
+		delete_patterns(records);
+		munmap(map, len);
+		return false;
+		}
+	munmap(map, len);
+
+	// Build the new properties while the current ones are set aside, so 
+	// that they can be put back if any of the properties fails to parse.
+	properties::property_map_t    old_props;
+	properties::pattern_map_t     old_pats;
+	properties::declaration_map_t old_declarations;
+	old_props.swap(properties::props);
+	old_pats.swap(properties::pats);
+	old_declarations.swap(properties::declarations);
+
+	if(recreate_properties(records, error)==false) {
+		properties::clear();
+		old_props.swap(properties::props);
+		old_pats.swap(properties::pats);
+		old_declarations.swap(properties::declarations);
+		properties::invalidate_cache();
+		return false;
+		}
+
+	// Delete the old properties.
+	old_props.swap(properties::props);
+	old_pats.swap(properties::pats);
+	old_declarations.swap(properties::declarations);
+	properties::clear();
+	properties::pats.swap(old_pats);
+	properties::declarations.swap(old_declarations);
+
+	// Restore the exact order of the property map.
+	for(unsigned long i=0; i<propmap.size(); ++i) {
+		pattern *pat=records[propmap[i].first].patterns[propmap[i].second];
+		properties::props.insert(properties::property_map_t::value_type(pat->obj.begin()->name_only(),
+											 properties::pat_prop_pair_t(pat, records[propmap[i].first].prop)));
+		}
+	properties::invalidate_cache();
+
+	expressions.clear();
+	expressions.move_in(expressions.end(), newexp);
+	history::sweep(expressions);
+	history::pack_all(expressions);
+	last_used_equation_number=newlast;
+	return true;
+	}
@@ -0,0 +1,67 @@
+/*
+
+	Cadabra: a field-theory motivated computer algebra system.
+	Copyright (C) 2001-2011  Kasper Peeters <kasper.peeters@aei.mpg.de>
+
+   This program is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation, either version 3 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/**
+
+  Binary snapshots of the kernel state, as written by \@save_state and
+  read back by \@load_state. A snapshot contains the expression tree,
+  all properties together with the patterns to which they are attached,
+  and the names and rationals used by them.
+
+  All names and rationals are written once, in a table at the start of
+  the file; tree nodes refer to them by their position in that table.
+  Trees are written in pre-order, each node as its name index,
+  multiplier index, flag byte and number of children. All integers are
+  stored as variable-length (7 bits per byte) unsigned numbers.
+
+  Properties cannot be written out as they are, since they are
+  arbitrary C++ objects. Instead, the argument tree from which each
+  property was created is stored (see properties::declarations), and
+  the property is re-created on load by parsing those arguments again,
+  in the order of the original declarations. The order of the entries
+  in properties::props and properties::pats is restored exactly, so
+  that lookups and serial numbers of list properties are unchanged.
+
+  Snapshots are read through mmap, and the existing state is only
+  replaced once the entire file has been decoded successfully.
+
+*/
+
+#ifndef snapshot_hh_
+#define snapshot_hh_
+
+#include "storage.hh"
+#include <string>
+
+class snapshot {
+	public:
+		/// Write the expressions tree and all properties to the given file. Returns
+		/// false and sets 'error' if the file could not be written.
+		static bool save(const std::string& filename, const exptree& expressions,
+							  unsigned int last_used_equation_number, std::string& error);
+
+		/// Replace the expressions tree and all properties with those stored in
+		/// the given file. Returns false and sets 'error', leaving the current state
+		/// untouched, if the file could not be read.
+		static bool load(const std::string& filename, exptree& expressions,
+							  unsigned int& last_used_equation_number, std::string& error);
+};
+
+#endif
@@ -21,12 +21,15 @@
 #include "storage.hh"
 #include "combinatorics.hh"
 #include "props.hh"
+#include <algorithm>
 #include <iomanip>
 #include <sstream>
 #include <pcrecpp.h>
 
 nset_t    name_set;
 rset_t    rat_set;
+std::atomic<bool> pools_shared(false);
+thread_local unsigned long exptree_structure_changes=0;
 
 long to_long(multiplier_t mul)
 	{
@@ -40,18 +43,149 @@ std::string to_string(long num)
 	return str.str();
 	}
 
+thread_local str_node_allocator::free_node *str_node_allocator::free_list=0;
+thread_local str_node_allocator::size_type  str_node_allocator::free_count=0;
+thread_local str_node_allocator::size_type  str_node_allocator::free_after_trim=0;
+str_node_allocator::free_node              *str_node_allocator::spare_list=0;
+str_node_allocator::size_type               str_node_allocator::spare_count=0;
+std::vector<str_node_allocator::free_node *> str_node_allocator::blocks;
+std::mutex                                  str_node_allocator::spare_mutex;
+std::atomic<size_t>                         str_node_allocator::bytes_reserved_(0);
+
+str_node_allocator::pointer str_node_allocator::allocate(size_type n, const void *)
+	{
+	if(n!=1) 
+		return static_cast<pointer>(::operator new(n*sizeof(value_type)));
+
+	if(free_list==0) {
+		// Take over whatever nodes finished worker threads have left behind.
+		std::lock_guard<std::mutex> lock(spare_mutex);
+		free_list=spare_list;
+		free_count=spare_count;
+		spare_list=0;
+		spare_count=0;
+		}
+	if(free_list==0) {
+		// Thread the nodes of a fresh block onto the free list.
+		free_node *block=static_cast<free_node *>(::operator new(nodes_per_block*sizeof(free_node)));
+		bytes_reserved_+=nodes_per_block*sizeof(free_node);
+		for(size_type i=0; i<nodes_per_block-1; ++i)
+			block[i].next=&block[i+1];
+		block[nodes_per_block-1].next=0;
+		free_list=block;
+		free_count=nodes_per_block;
+		std::lock_guard<std::mutex> lock(spare_mutex);
+		blocks.push_back(block);
+		}
+	free_node *ret=free_list;
+	free_list=ret->next;
+	--free_count;
+	if(free_count<free_after_trim)
+		free_after_trim=free_count;
+	return reinterpret_cast<pointer>(ret);
+	}
+
+void str_node_allocator::deallocate(pointer p, size_type n)
+	{
+	if(n!=1) {
+		::operator delete(p);
+		return;
+		}
+	free_node *fn=reinterpret_cast<free_node *>(p);
+	fn->next=free_list;
+	free_list=fn;
+	++free_count;
+	}
+
+size_t str_node_allocator::bytes_reserved()
+	{
+	return bytes_reserved_;
+	}
+
+void str_node_allocator::release_thread_cache()
+	{
+	if(free_list==0) return;
+
+	free_node *last=free_list;
+	while(last->next!=0)
+		last=last->next;
+
+	std::lock_guard<std::mutex> lock(spare_mutex);
+	last->next=spare_list;
+	spare_list=free_list;
+	spare_count+=free_count;
+	free_list=0;
+	free_count=0;
+	free_after_trim=0;
+	}
+
+void str_node_allocator::trim()
+	{
+	std::lock_guard<std::mutex> lock(spare_mutex);
+	if(free_count+spare_count < free_after_trim+nodes_per_block) 
+		return;
+
+	// Count the free nodes in every block; blocks are found by bisection
+	// in the sorted list of block addresses.
+	std::less<free_node *> before;
+	std::sort(blocks.begin(), blocks.end(), before);
+	std::vector<size_type> num_free(blocks.size(), 0);
+	free_node *lists[2]={ free_list, spare_list };
+	for(unsigned int l=0; l<2; ++l) {
+		for(free_node *fn=lists[l]; fn!=0; fn=fn->next) {
+			size_t bl=std::upper_bound(blocks.begin(), blocks.end(), fn, before)-blocks.begin()-1;
+			++num_free[bl];
+			}
+		}
+
+	// Rebuild the free list without the nodes of the blocks which go back.
+	free_node  *kept=0;
+	free_node **tail=&kept;
+	size_type   kept_count=0;
+	for(unsigned int l=0; l<2; ++l) {
+		free_node *fn=lists[l];
+		while(fn!=0) {
+			free_node *next=fn->next;
+			size_t bl=std::upper_bound(blocks.begin(), blocks.end(), fn, before)-blocks.begin()-1;
+			if(num_free[bl]!=nodes_per_block) {
+				*tail=fn;
+				tail=&fn->next;
+				++kept_count;
+				}
+			fn=next;
+			}
+		}
+	*tail=0;
+
+	size_t bl=0;
+	for(size_t i=0; i<blocks.size(); ++i) {
+		if(num_free[i]==nodes_per_block) {
+			::operator delete(blocks[i]);
+			bytes_reserved_-=nodes_per_block*sizeof(free_node);
+			}
+		else blocks[bl++]=blocks[i];
+		}
+	blocks.resize(bl);
+
+	free_list=kept;
+	free_count=kept_count;
+	free_after_trim=kept_count;
+	spare_list=0;
+	spare_count=0;
+	}
+
 exptree::exptree()
-	: tree<str_node>()
+	: tree<str_node, str_node_allocator>()
 	{
 	}
 
-exptree::exptree(tree<str_node>::iterator it)
-	: tree<str_node>(it)
+exptree::exptree(tree<str_node, str_node_allocator>::iterator it)
+	: tree<str_node, str_node_allocator>(it)
 	{
 	}
 
 exptree::exptree(const str_node& x)
-	: tree<str_node>(x)
+	: tree<str_node, str_node_allocator>(x)
 	{
 	}
 
@@ -159,7 +293,9 @@ exptree::iterator exptree::named_parent(exptree::iterator it, const std::string&
 exptree::iterator exptree::erase_expression(exptree::iterator it) 
 	{
 	it=named_parent(it, "\\history");
-	return erase(it);
+	it=erase(it);
+	str_node_allocator::trim();
+	return it;
 	}
 
 exptree::iterator exptree::keep_only_last(exptree::iterator it)
@@ -182,6 +318,7 @@ exptree::iterator exptree::keep_only_last(exptree::iterator it)
 				else
 					++prev;
 				}
+			str_node_allocator::trim();
 			return expit;
 			}
 		--expit;
@@ -196,7 +333,8 @@ hashval_t exptree::calc_hash(iterator it) const
 	// the correct thing to do?)
 	//
 	// If this algorithm is changed, factorise::calc_restricted_hash in 
-	// modules/algebra.cc should also be modified!
+	// modules/algebra.cc and cached_hash in algorithm.cc should also be 
+	// modified!
 
 	hashval_t ret=(hashval_t)(&(*it->name));
 
@@ -795,6 +933,19 @@ void str_node::flip_parent_rel()
 	else throw std::logic_error("flip_parent_rel called on non-index");
 	}
 
+unsigned char str_node::packed_flags() const
+	{
+	return (fl.keep_after_eval?1:0) | (fl.bracket<<1) | (fl.parent_rel<<4) | (fl.line_per_node?0x80:0);
+	}
+
+void str_node::unpack_flags(unsigned char c)
+	{
+	fl.keep_after_eval=(c&1);
+	fl.bracket        =(bracket_t)((c>>1)&7);
+	fl.parent_rel     =(parent_rel_t)((c>>4)&7);
+	fl.line_per_node  =(c&0x80);
+	}
+
 bool str_node::is_zero() const
 	{
 	if(*multiplier==0) return true;
@@ -1015,6 +1166,144 @@ bool nset_it_less::operator()(nset_t::iterator first, nset_t::iterator second) c
 	}
 
 
+std::pair<nset_t::iterator, bool> nset_t::insert(const std::string& nm)
+	{
+	std::unique_lock<std::mutex> lock(mutex_, std::defer_lock);
+	if(pools_shared) lock.lock();
+
+	return std::set<std::string>::insert(nm);
+	}
+
+rset_t::rset_t()
+	: reclaimed_(0)
+	{
+	}
+
+size_t rset_t::hash::operator()(const multiplier_t& mul) const
+	{
+	mpz_srcptr num=mpq_numref(mul.get_mpq_t());
+	mpz_srcptr den=mpq_denref(mul.get_mpq_t());
+
+	size_t ret=mpz_sgn(num);
+	for(size_t i=0; i<mpz_size(num); ++i)
+		ret=ret*31+mpz_getlimbn(num, i);
+	for(size_t i=0; i<mpz_size(den); ++i)
+		ret=ret*17+mpz_getlimbn(den, i);
+	return ret;
+	}
+
+std::pair<rset_t::iterator, bool> rset_t::insert(const multiplier_t& mul)
+	{
+	std::unique_lock<std::mutex> lock(mutex_, std::defer_lock);
+	if(pools_shared) lock.lock();
+
+	store_t::iterator it=store.find(mul);
+	if(it!=store.end())
+		return std::pair<iterator, bool>(iterator(&(*it)), false);
+	it=store.emplace(std::piecewise_construct, std::forward_as_tuple(mul), std::forward_as_tuple(0)).first;
+	return std::pair<iterator, bool>(iterator(&(*it)), true);
+	}
+
+size_t rset_t::size() const
+	{
+	return store.size();
+	}
+
+size_t rset_t::sweep()
+	{
+	size_t removed=0;
+	store_t::iterator it=store.begin();
+	while(it!=store.end()) {
+		if(it->second.load(std::memory_order_relaxed)==0) {
+			it=store.erase(it);
+			++removed;
+			}
+		else ++it;
+		}
+	reclaimed_+=removed;
+
+	// Cached property lookups are keyed on the addresses of rationals, and
+	// the storage of the removed ones may now be reused for other values.
+	if(removed>0)
+		properties::invalidate_cache();
+	return removed;
+	}
+
+size_t rset_t::reclaimed() const
+	{
+	return reclaimed_;
+	}
+
+rset_t::iterator::iterator()
+	: entry(0)
+	{
+	}
+
+rset_t::iterator::iterator(store_t::value_type *ent)
+	: entry(ent)
+	{
+	retain(entry);
+	}
+
+rset_t::iterator::iterator(const iterator& other)
+	: entry(other.entry)
+	{
+	if(entry) retain(entry);
+	}
+
+rset_t::iterator::~iterator()
+	{
+	if(entry) release(entry);
+	}
+
+rset_t::iterator& rset_t::iterator::operator=(const iterator& other)
+	{
+	// Take the new reference first, so that self-assignment is harmless.
+	if(other.entry) retain(other.entry);
+	if(entry)       release(entry);
+	entry=other.entry;
+	return *this;
+	}
+
+// Reference counts only need atomic read-modify-write operations while the
+// pool is shared between threads; otherwise plain loads and stores suffice.
+
+void rset_t::iterator::retain(store_t::value_type *ent)
+	{
+	if(pools_shared.load(std::memory_order_relaxed))
+		ent->second.fetch_add(1, std::memory_order_relaxed);
+	else
+		ent->second.store(ent->second.load(std::memory_order_relaxed)+1, std::memory_order_relaxed);
+	}
+
+void rset_t::iterator::release(store_t::value_type *ent)
+	{
+	if(pools_shared.load(std::memory_order_relaxed))
+		ent->second.fetch_sub(1, std::memory_order_relaxed);
+	else
+		ent->second.store(ent->second.load(std::memory_order_relaxed)-1, std::memory_order_relaxed);
+	}
+
+const multiplier_t& rset_t::iterator::operator*() const
+	{
+	return entry->first;
+	}
+
+const multiplier_t* rset_t::iterator::operator->() const
+	{
+	return &(entry->first);
+	}
+
+bool rset_t::iterator::operator==(const iterator& other) const
+	{
+	return entry==other.entry;
+	}
+
+bool rset_t::iterator::operator!=(const iterator& other) const
+	{
+	return entry!=other.entry;
+	}
+
 void multiply(rset_t::iterator& num, multiplier_t fac) 
 	{
 	fac*=*num;
@@ -1263,6 +1552,91 @@ bool operator==(const exptree& first, const exptree& second)
 	}
 
 
+// Names are compared literally, so equivalent keys have the same names and
+// shape; parent relations and multipliers are left out of the hash as they
+// are not always compared.
+
+size_t exptree_comparator::replacement_map_t::hash(exptree::iterator it, bool without_children)
+	{
+	// A node looked up without its children hashes as a key without children.
+	size_t ret=(size_t)(&(*it->name));
+	if(without_children) return ret*1000003;
+
+	exptree::iterator stop=it;
+	stop.skip_children();
+	++stop;
+	ret=ret*1000003 ^ exptree::number_of_children(it);
+	++it;
+	while(it!=stop) {
+		ret=ret*1000003 ^ (size_t)(&(*it->name));
+		ret=ret*1000003 ^ exptree::number_of_children(it);
+		++it;
+		}
+	return ret;
+	}
+
+const exptree *exptree_comparator::replacement_map_t::find(exptree::iterator key, bool without_children) const
+	{
+	size_t hs=hash(key, without_children);
+	std::vector<entry>::const_reverse_iterator it=entries.rbegin();
+	while(it!=entries.rend()) {
+		if(it->hash==hs) {
+			exptree::iterator top=it->key.begin();
+			if(without_children) {
+				// Same comparison as in subtree_compare for a node without children.
+				if(exptree::number_of_children(top)==0 && top->name==key->name) {
+					if(top->fl.parent_rel==key->fl.parent_rel || !top->is_index() || !key->is_index())
+						return &it->value;
+					const Indices *ind1=properties::get<Indices>(top, true);
+					const Indices *ind2=properties::get<Indices>(key, true);
+					if(ind1==0 || ind1!=ind2 || ind1->position_type==Indices::free)
+						return &it->value;
+					}
+				}
+			else if(subtree_compare(top, key, -2, true, 0, true)==0)
+				return &it->value;
+			}
+		++it;
+		}
+	return 0;
+	}
+
+void exptree_comparator::replacement_map_t::set(const exptree& key, const exptree& value)
+	{
+	entries.push_back(entry());
+	entries.back().hash=hash(key.begin(), false);
+	entries.back().key=key;
+	entries.back().value=value;
+	}
+
+size_t exptree_comparator::replacement_map_t::size() const
+	{
+	return entries.size();
+	}
+
+void exptree_comparator::replacement_map_t::truncate(size_t num)
+	{
+	entries.resize(num);
+	}
+
+void exptree_comparator::replacement_map_t::clear()
+	{
+	entries.clear();
+	}
+
+void exptree_comparator::replacement_map_t::current(std::vector<const entry *>& ret) const
+	{
+	for(size_t i=0; i<entries.size(); ++i) {
+		bool shadowed=false;
+		for(size_t j=i+1; j<entries.size() && !shadowed; ++j)
+			if(entries[j].hash==entries[i].hash
+				&& subtree_compare(entries[j].key.begin(), entries[i].key.begin(), -2, true, 0, true)==0)
+				shadowed=true;
+		if(!shadowed)
+			ret.push_back(&entries[i]);
+		}
+	}
+
 void exptree_comparator::clear()
 	{
 	replacement_map.clear();
@@ -1355,30 +1729,27 @@ exptree_comparator::match_t exptree_comparator::compare(const exptree::iterator&
 		// triggering a rule for an upper index, we simply store both rules (see
 		// below) so that searching for rules can remain simple.
 
-		replacement_map_t::iterator loc=replacement_map.find(one);
+		const exptree *loc=replacement_map.find(one);
 
 		bool tested_full=true;
 
 		// If this is a pattern with a non-zero number of children, 
 		// also search the pattern without the children.
-		if(loc == replacement_map.end() && exptree::number_of_children(one)!=0) {
-			exptree tmp1(one);
-			tmp1.erase_children(tmp1.begin());
-			loc = replacement_map.find(tmp1);
+		if(loc==0 && exptree::number_of_children(one)!=0) {
+			loc=replacement_map.find(one, true);
 			tested_full=false;
 			}
 
-		if(loc!=replacement_map.end()) {
+		if(loc!=0) {
 //			std::cerr << "found!" << std::endl;
 			// If this is an index/pattern, try to match the whole index/pattern.
 			int cmp;
 
 			if(tested_full) 
-				cmp=subtree_compare((*loc).second.begin(), two, -2 /* KP: do not switch this to -2 (kk.cdb fails) */); 
+				cmp=subtree_compare(loc->begin(), two, -2 /* KP: do not switch this to -2 (kk.cdb fails) */); 
 			else {
-				exptree tmp2(two);
-				tmp2.erase_children(tmp2.begin());
-				cmp=subtree_compare((*loc).second.begin(), tmp2.begin(), -2 /* KP: see above */); 
+				exptree tmp2(*two); // the node only, without its children
+				cmp=subtree_compare(loc->begin(), tmp2.begin(), -2 /* KP: see above */); 
 				}
 //			std::cerr << " pattern " << *two->name
 //						 << " should be " << *((*loc).second.begin()->name)  
@@ -1419,7 +1790,7 @@ exptree_comparator::match_t exptree_comparator::compare(const exptree::iterator&
 //			if(two->fl.parent_rel==str_node::p_sub)   std::cerr << "_";
 //			std::cerr << *two->name << std::endl;
 
-			replacement_map[one]=two;
+			replacement_map.set(one, two);
 			
 			// if this is an index, also store the pattern with the parent_rel flipped
 			if(one->is_index()) {
@@ -1428,7 +1799,7 @@ exptree_comparator::match_t exptree_comparator::compare(const exptree::iterator&
 				cmptree1.begin()->flip_parent_rel();
 				if(two->is_index())
 					cmptree2.begin()->flip_parent_rel();
-				replacement_map[cmptree1]=cmptree2;
+				replacement_map.set(cmptree1, cmptree2);
 				}
 			
 			// if this is a pattern and the pattern has a non-zero number of children,
@@ -1437,14 +1808,14 @@ exptree_comparator::match_t exptree_comparator::compare(const exptree::iterator&
 				exptree tmp1(one), tmp2(two);
 				tmp1.erase_children(tmp1.begin());
 				tmp2.erase_children(tmp2.begin());
-				replacement_map[tmp1]=tmp2;
+				replacement_map.set(tmp1, tmp2);
 				}
 			// and if this is a pattern also insert the one without the parent_rel
 			if(one->is_name_wildcard()) {
 				exptree tmp1(one), tmp2(two);
 				tmp1.begin()->fl.parent_rel=str_node::p_none;
 				tmp2.begin()->fl.parent_rel=str_node::p_none;
-				replacement_map[tmp1]=tmp2;
+				replacement_map.set(tmp1, tmp2);
 				}
 			}
 		
@@ -1498,7 +1869,7 @@ exptree_comparator::match_t exptree_comparator::match_subproduct(exptree::siblin
 																					  exptree::sibling_iterator tofind, 
 																					  exptree::sibling_iterator st)
 	{
-	replacement_map_t         backup_replacements(replacement_map);
+	size_t                    backup_replacements=replacement_map.size();
 	subtree_replacement_map_t backup_subtree_replacements(subtree_replacement_map);
 
 	exptree::sibling_iterator start=st.begin();
@@ -1512,7 +1883,7 @@ exptree_comparator::match_t exptree_comparator::match_subproduct(exptree::siblin
 					sign=exptree_ordering::can_move_adjacent(st, factor_locations.back(), start);
 					}
 				if(sign==0) { // object found, but we cannot move it in the right order
-					replacement_map=backup_replacements;
+					replacement_map.truncate(backup_replacements);
 					subtree_replacement_map=backup_subtree_replacements;
 					}
 				else {
@@ -1528,7 +1899,7 @@ exptree_comparator::match_t exptree_comparator::match_subproduct(exptree::siblin
 //						txtout << tofind.node << "found factor useless " << start.node << std::endl;
 							factor_locations.pop_back();
 							factor_moving_signs.pop_back();
-							replacement_map=backup_replacements;
+							replacement_map.truncate(backup_replacements);
 							subtree_replacement_map=backup_subtree_replacements;
 							}
 						}
@@ -1537,7 +1908,7 @@ exptree_comparator::match_t exptree_comparator::match_subproduct(exptree::siblin
 				}
 			else {
 //				txtout << tofind.node << "does not match" << std::endl;
-				replacement_map=backup_replacements;
+				replacement_map.truncate(backup_replacements);
 				subtree_replacement_map=backup_subtree_replacements;
 				}
 			}
@@ -1625,6 +1996,203 @@ bool exptree_ordering::should_swap(exptree::iterator obj, int subtree_comparison
 	return false;
 	}
 
+// Same as above, but using SortOrder information which has been looked up
+// beforehand.
+//
+bool exptree_ordering::should_swap(const sort_key& one, const sort_key& two, int subtree_comparison)
+	{
+	if(one.so==0 || two.so==0) { // No sort order known
+		if(subtree_comparison<0) return true;
+		return false;
+		}
+	else if(abs(subtree_comparison)<=1) { // Identical up to index names
+		if(subtree_comparison==-1) return true;
+		return false;
+		}
+	else {
+		if(one.so==two.so) {
+			if(one.num>two.num) return true;
+			return false;
+			}
+		}
+
+	return false;
+	}
+
+int exptree_ordering::sort_children(exptree& tr, exptree::iterator parent, bool track_sign, bool& modified,
+												int mod_prel, int compare_multiplier, bool literal_wildcards)
+	{
+	modified=false;
+
+	// The SortOrder lookups only depend on the child itself, so do them once
+	// instead of once for every comparison.
+	sort_keys_t keys;
+	exptree::sibling_iterator sib=tr.begin(parent);
+	while(sib!=tr.end(parent)) {
+		sort_key key;
+		key.it=sib;
+		key.so=properties::get_composite<SortOrder>(sib, key.num);
+		key.pos=keys.size();
+		keys.push_back(key);
+		++sib;
+		}
+	if(keys.size()<2) return 1;
+
+	// Children in a SortOrder list are only ordered with respect to members of the
+	// same list, which is not a transitive ordering, so they cannot be merge-sorted.
+	std::vector<bool> in_block(keys.size(), false);
+	for(size_t i=0; i<keys.size(); ++i)
+		if(keys[i].so!=0) 
+			in_block[i]=true;
+
+	sort_keys_t free, block, buffer(keys.size());
+	for(size_t i=0; i<keys.size(); ++i)
+		(in_block[i]?block:free).push_back(keys[i]);
+	sort_keys_t sorted(free);
+	int sign=merge_sort(sorted, buffer, 0, sorted.size(), track_sign, mod_prel, compare_multiplier, literal_wildcards);
+	if(track_sign && (sign==0 || block.size()>0)) {
+		// Two factors which do not commute had to be exchanged, or may have to be
+		// exchanged with a block factor. Every factor which does not commute with
+		// some other factor is therefore sorted by adjacent exchanges as well.
+		// Note that can_swap does not use the comparison result, hence the zero.
+		for(size_t i=0; i<keys.size(); ++i)
+			for(size_t j=i+1; j<keys.size(); ++j)
+				if(!(in_block[i] && in_block[j]) && can_swap(keys[i].it, keys[j].it, 0)==0)
+					in_block[i]=in_block[j]=true;
+		free.clear();
+		block.clear();
+		for(size_t i=0; i<keys.size(); ++i)
+			(in_block[i]?block:free).push_back(keys[i]);
+		sorted=free;
+		sign=merge_sort(sorted, buffer, 0, sorted.size(), track_sign, mod_prel, compare_multiplier, literal_wildcards);
+		assert(sign!=0);
+		}
+
+	if(block.size()>0) {
+		sign*=adjacent_sort(block, track_sign, mod_prel, compare_multiplier, literal_wildcards);
+		free.swap(sorted);
+		merge_block(free, block, sorted, mod_prel, compare_multiplier, literal_wildcards);
+
+		// Free children which have moved past a block child contribute to the sign too.
+		if(track_sign) {
+			std::vector<size_t> final_pos(keys.size());
+			for(size_t i=0; i<sorted.size(); ++i)
+				final_pos[sorted[i].pos]=i;
+			for(size_t i=0; i<free.size() && sign!=0; ++i) {
+				for(size_t j=0; j<block.size(); ++j) {
+					const sort_key& f=free[i];
+					const sort_key& b=block[j];
+					if( (f.pos<b.pos) != (final_pos[f.pos]<final_pos[b.pos]) ) {
+						const sort_key& left =(f.pos<b.pos)?f:b;
+						const sort_key& right=(f.pos<b.pos)?b:f;
+						sign*=can_swap(left.it, right.it, 
+											subtree_compare(left.it, right.it, mod_prel, true, compare_multiplier, literal_wildcards));
+						}
+					}
+				}
+			}
+		}
+
+	for(size_t i=0; i<sorted.size(); ++i)
+		if(sorted[i].pos!=i) 
+			modified=true;
+
+	// Only now move the nodes themselves; iterators to the children stay valid.
+	// Chain every child in front of its successor, starting from the back.
+	if(modified) 
+		for(size_t i=sorted.size()-1; i>0; --i) 
+			tr.move_before(sorted[i].it, sorted[i-1].it);
+
+	return sign;
+	}
+
+// Sort the range [from, to) of 'keys'. Whenever an element of the second half is
+// taken before the remaining elements of the first half, it has to move through
+// all of those, so (for factors) this is where the commutation sign is collected.
+// The pairs for which can_swap gets called are thus exactly the pairs which a
+// bubble sort would have exchanged. Returns zero as soon as one of these pairs
+// does not commute.
+//
+int exptree_ordering::merge_sort(sort_keys_t& keys, sort_keys_t& buffer, size_t from, size_t to, 
+											bool track_sign, int mod_prel, int compare_multiplier, bool literal_wildcards)
+	{
+	if(to-from<2) return 1;
+
+	size_t mid=from+(to-from)/2;
+	int sign=merge_sort(keys, buffer, from, mid, track_sign, mod_prel, compare_multiplier, literal_wildcards);
+	if(sign==0) return 0;
+	sign*=merge_sort(keys, buffer, mid, to, track_sign, mod_prel, compare_multiplier, literal_wildcards);
+	if(sign==0) return 0;
+
+	size_t i=from, j=mid, k=from;
+	while(i<mid && j<to) {
+		int es=subtree_compare(keys[i].it, keys[j].it, mod_prel, true, compare_multiplier, literal_wildcards);
+		if(should_swap(keys[i], keys[j], es)) {
+			if(track_sign) {
+				for(size_t m=i; m<mid; ++m) {
+					sign*=can_swap(keys[m].it, keys[j].it, es);
+					if(sign==0) return 0;
+					}
+				}
+			buffer[k++]=keys[j++];
+			}
+		else buffer[k++]=keys[i++];
+		}
+	while(i<mid) buffer[k++]=keys[i++];
+	while(j<to)  buffer[k++]=keys[j++];
+	for(k=from; k<to; ++k)
+		keys[k]=buffer[k];
+
+	return sign;
+	}
+
+// Bubble sort, in which pairs of factors that do not commute are left as they are.
+//
+int exptree_ordering::adjacent_sort(sort_keys_t& keys, bool track_sign, 
+												int mod_prel, int compare_multiplier, bool literal_wildcards)
+	{
+	int sign=1;
+	for(size_t i=1; i<keys.size(); ++i) {
+		for(size_t j=0; j+i<keys.size(); ++j) {
+			int es=subtree_compare(keys[j].it, keys[j+1].it, mod_prel, true, compare_multiplier, literal_wildcards);
+			if(should_swap(keys[j], keys[j+1], es)) {
+				int canswap=track_sign?can_swap(keys[j].it, keys[j+1].it, es):1;
+				if(canswap!=0) {
+					std::swap(keys[j], keys[j+1]);
+					sign*=canswap;
+					}
+				}
+			}
+		}
+	return sign;
+	}
+
+// Merge the sorted free children with the block children, which keep their order.
+// Children which compare equal stay in their original order.
+//
+void exptree_ordering::merge_block(const sort_keys_t& free, const sort_keys_t& block, sort_keys_t& result,
+											  int mod_prel, int compare_multiplier, bool literal_wildcards)
+	{
+	result.clear();
+	size_t i=0, j=0;
+	while(i<free.size() && j<block.size()) {
+		bool take_block;
+		if(should_swap(free[i], block[j], 
+							subtree_compare(free[i].it, block[j].it, mod_prel, true, compare_multiplier, literal_wildcards)))
+			take_block=true;
+		else if(should_swap(block[j], free[i], 
+								  subtree_compare(block[j].it, free[i].it, mod_prel, true, compare_multiplier, literal_wildcards)))
+			take_block=false;
+		else 
+			take_block=(block[j].pos<free[i].pos);
+
+		if(take_block) result.push_back(block[j++]);
+		else           result.push_back(free[i++]);
+		}
+	while(i<free.size())  result.push_back(free[i++]);
+	while(j<block.size()) result.push_back(block[j++]);
+	}
+
 // Various tests about whether two non-elementary objects can be swapped.
 //
 int exptree_ordering::can_swap_prod_obj(exptree::iterator prod, exptree::iterator obj, 
@@ -1848,27 +2416,24 @@ bool exptree_comparator::satisfies_conditions(exptree::iterator conditions, std:
 			// those rules give a different result. But first check that there are rules
 			// to start with.
 //			std::cerr << *lhs->name  << " !=? " << *rhs->name << std::endl;
-			if(replacement_map.find(exptree(lhs))==replacement_map.end() ||
-				replacement_map.find(exptree(rhs))==replacement_map.end()) return true;
+			const exptree *lhsrep=replacement_map.find(lhs), *rhsrep=replacement_map.find(rhs);
+			if(lhsrep==0 || rhsrep==0) return true;
 //			std::cerr << *lhs->name  << " !=?? " << *rhs->name << std::endl;
-			if(tree_exact_equal(replacement_map[exptree(lhs)], replacement_map[exptree(rhs)])) {
+			if(tree_exact_equal(*lhsrep, *rhsrep)) {
 				return false;
 				}
 			}
 		else if(*cond->name=="\\indexpairs") {
 			int countpairs=0;
-			replacement_map_t::const_iterator it=replacement_map.begin(),it2;
-			while(it!=replacement_map.end()) {
-				it2=it;
-				++it2;
-				while(it2!=replacement_map.end()) {
-					if(tree_exact_equal(it->second, it2->second)) {
+			std::vector<const replacement_map_t::entry *> reps;
+			replacement_map.current(reps);
+			for(size_t i=0; i<reps.size(); ++i) {
+				for(size_t j=i+1; j<reps.size(); ++j) {
+					if(tree_exact_equal(reps[i]->value, reps[j]->value)) {
 						++countpairs;
 						break;
 						}
-					++it2;
 					}
-				++it;
 				}
 //			txtout << countpairs << " pairs" << std::endl;
 			if(countpairs!=*(cond.begin()->multiplier))
@@ -1884,7 +2449,8 @@ bool exptree_comparator::satisfies_conditions(exptree::iterator conditions, std:
 //			txtout << "matching " << *comp.replacement_map[lhs->name]
 //					 << " with pattern " << pat << std::endl;
 			pcrecpp::RE reg(pat);
-			if(reg.FullMatch(*(replacement_map[exptree(lhs)].begin()->name))==false)
+			const exptree *lhsrep=replacement_map.find(lhs);
+			if(lhsrep==0 || reg.FullMatch(*(lhsrep->begin()->name))==false)
 				return false;
 			}
 		else if(*cond->name=="\\hasprop") {
@@ -1902,9 +2468,9 @@ bool exptree_comparator::satisfies_conditions(exptree::iterator conditions, std:
 			const property_base *aprop=pit->second();
 
 			subtree_replacement_map_t::iterator subfind=subtree_replacement_map.find(lhs->name);
-			replacement_map_t::iterator         patfind=replacement_map.find(exptree(lhs));
+			const exptree                      *patfind=replacement_map.find(lhs);
 
-			if(subfind==subtree_replacement_map.end() && patfind==replacement_map.end()) {
+			if(subfind==subtree_replacement_map.end() && patfind==0) {
 				std::ostringstream str;
 				str << "Pattern " << *lhs->name << " in \\hasprop did not occur in match." << std::endl;
 				delete aprop;
@@ -1914,7 +2480,7 @@ bool exptree_comparator::satisfies_conditions(exptree::iterator conditions, std:
 			
 			bool ret=false;
 			if(subfind==subtree_replacement_map.end()) 
-				 ret=properties::has(aprop, (*patfind).second.begin());
+				 ret=properties::has(aprop, patfind->begin());
 			else
 				 ret=properties::has(aprop, (*subfind).second);
 			delete aprop;
@@ -34,16 +34,87 @@
 #include <vector>
 #include <set>
 #include <map>
+#include <unordered_map>
+#include <atomic>
+#include <mutex>
 #include <stdint.h>
 #include <assert.h>
 
 #include "tree.hh"
 
 typedef mpq_class               multiplier_t;
-typedef std::set<std::string>   nset_t;
-typedef std::set<multiplier_t>  rset_t;
 typedef uintptr_t               hashval_t;
 
+/// Set while algorithms run on several private exptrees in separate threads
+/// (see algorithm::apply_termwise_parallel). The name and rational pools then
+/// serialise insertions and keep their reference counts atomically.
+extern std::atomic<bool> pools_shared;
+
+/// Pool of interned names, used for the name field of str_node.
+
+class nset_t : public std::set<std::string> {
+	public:
+		std::pair<iterator, bool> insert(const std::string&);
+
+	private:
+		std::mutex mutex_;
+};
+
+/// Pool of interned rational numbers, used for the multiplier field of str_node.
+/// Every iterator into the pool holds a reference to the rational it points to,
+/// so the pool knows which entries are still in use by nodes (or by anything
+/// else). Entries whose reference count has dropped to zero are only removed
+/// when sweep() is called; lookup goes through a hash table.
+
+class rset_t {
+	private:
+		class hash {
+			public:
+				size_t operator()(const multiplier_t&) const;
+		};
+		typedef std::unordered_map<multiplier_t, std::atomic<unsigned long>, hash> store_t;
+
+	public:
+		class iterator {
+			public:
+				iterator();
+				iterator(const iterator&);
+				~iterator();
+
+				iterator& operator=(const iterator&);
+				const multiplier_t& operator*() const;
+				const multiplier_t* operator->() const;
+				bool operator==(const iterator&) const;
+				bool operator!=(const iterator&) const;
+
+			private:
+				friend class rset_t;
+				explicit iterator(store_t::value_type *);
+
+				static void retain(store_t::value_type *);
+				static void release(store_t::value_type *);
+
+				store_t::value_type *entry;
+		};
+		typedef iterator const_iterator;
+
+		rset_t();
+
+		std::pair<iterator, bool> insert(const multiplier_t&);
+		size_t size() const;
+
+		/// Remove all rationals which are no longer referenced, and return the
+		/// number of entries removed.
+		size_t sweep();
+		/// Total number of entries removed by sweep() since startup.
+		size_t reclaimed() const;
+
+	private:
+		store_t    store;
+		size_t     reclaimed_;
+		std::mutex mutex_;
+};
+
 long        to_long(multiplier_t);
 std::string to_string(long);
 
@@ -80,6 +151,11 @@ class str_node { // size: 9 bytes (32 bit arch), can be reduced to 5 bytes.
 		/// when this is not an index).
 		void flip_parent_rel();
 
+		/// The flags packed into a single byte, for the compact tree encodings
+		/// of snapshots and packed history steps.
+		unsigned char packed_flags() const;
+		void          unpack_flags(unsigned char);
+
 		bool is_zero() const;
 		bool is_identity() const;
 		bool is_rational() const;
@@ -113,10 +189,73 @@ void     one(rset_t::iterator&);
 void     flip_sign(rset_t::iterator&);
 void     half(rset_t::iterator&);
 
-class exptree : public tree<str_node> {
+/// Number of changes to the structure of expression trees made by the calling
+/// thread. Caches which are keyed on node addresses compare this with the value
+/// at which they were filled, since nodes which get freed may be handed out again
+/// at the same address.
+extern thread_local unsigned long exptree_structure_changes;
+
+template<>
+class tree_change_observer<str_node> {
+	public:
+		static void changed() { ++exptree_structure_changes; }
+};
+
+/// Allocator for the nodes of an exptree. Nodes are carved out of large blocks
+/// and recycled through a free list, instead of being obtained from the heap one
+/// at a time. Every thread keeps its own free list, so nodes can be allocated 
+/// without locking. Blocks of which all nodes are free are given back to the 
+/// system by trim().
+
+class str_node_allocator {
+	public:
+		typedef tree_node_<str_node> value_type;
+		typedef value_type*          pointer;
+		typedef const value_type*    const_pointer;
+		typedef size_t               size_type;
+		typedef ptrdiff_t            difference_type;
+
+		pointer allocate(size_type n, const void *hint=0);
+		void    deallocate(pointer p, size_type n);
+
+		template<class... Args>
+		void    construct(pointer p, Args&&... args) { new(p) value_type(std::forward<Args>(args)...); }
+		void    destroy(pointer p)                   { p->~value_type(); }
+
+		bool    operator==(const str_node_allocator&) const { return true; }
+		bool    operator!=(const str_node_allocator&) const { return false; }
+
+		/// Number of bytes obtained from the system for node storage, by all threads.
+		static size_t bytes_reserved();
+		/// Hand the free nodes of the calling thread over to the other threads;
+		/// to be called by worker threads just before they finish.
+		static void   release_thread_cache();
+		/// Return blocks which contain only free nodes to the system. Only the
+		/// free nodes of the calling thread and those left behind by finished
+		/// threads are considered. Does nothing unless at least a block's worth 
+		/// of nodes has been freed since the previous call, so it is cheap to 
+		/// call whenever expressions get erased.
+		static void   trim();
+
+	private:
+		union free_node {
+				free_node *next;
+				char       storage[sizeof(value_type)];
+		};
+		static const size_type nodes_per_block=4096;
+		static thread_local free_node *free_list;
+		static thread_local size_type  free_count, free_after_trim;
+		static free_node              *spare_list;
+		static size_type               spare_count;
+		static std::vector<free_node *> blocks;
+		static std::mutex              spare_mutex;
+		static std::atomic<size_t>     bytes_reserved_;
+};
+
+class exptree : public tree<str_node, str_node_allocator> {
 	public:
 		exptree();
-		exptree(tree<str_node>::iterator);
+		exptree(tree<str_node, str_node_allocator>::iterator);
 		exptree(const str_node&);
 
 		std::ostream& print_entire_tree(std::ostream& str) const;
@@ -347,8 +486,39 @@ class exptree_comparator {
 										 exptree::sibling_iterator st);
 		bool    satisfies_conditions(exptree::iterator conditions, std::string& error);
 
-		// Maps for replacement of nodes (indices, patterns) and subtrees (object patterns) respectively.
-		typedef std::map<exptree, exptree, tree_exact_less_no_wildcards_obj>  replacement_map_t;
+		/// Replacements for nodes (indices, patterns). Keys are equivalent when
+		/// tree_exact_less_no_wildcards_obj considers them equal, but are looked up
+		/// through a hash of their names and shape, directly on a node of a tree
+		/// so that no subtrees need to be copied. Entries are only ever added; an
+		/// entry for a key which is present already shadows the earlier one, so
+		/// that an earlier state can be restored by truncating the table.
+		class replacement_map_t {
+			public:
+				class entry {
+					public:
+						size_t  hash;
+						exptree key, value;
+				};
+
+				/// Return the replacement for the given node, or 0 if there is none.
+				/// With 'without_children' set, the node is looked up as if it had
+				/// no child nodes.
+				const exptree *find(exptree::iterator key, bool without_children=false) const;
+				void           set(const exptree& key, const exptree& value);
+
+				size_t         size() const;
+				void           truncate(size_t);
+				void           clear();
+
+				/// All entries which are not shadowed by a later one.
+				void           current(std::vector<const entry *>&) const;
+
+			private:
+				std::vector<entry> entries;
+
+				static size_t  hash(exptree::iterator, bool without_children);
+		};
+		// Map for replacement of subtrees (object patterns).
 		typedef std::map<nset_t::iterator, exptree::iterator, nset_it_less>   subtree_replacement_map_t;
 
 		replacement_map_t                      replacement_map;
@@ -375,6 +545,8 @@ class exptree_is_less {
 };
 
 
+class SortOrder;
+
 /// A set of routines to determine natural orders of factors in products.
 
 class exptree_ordering {
@@ -390,6 +562,37 @@ class exptree_ordering {
 									bool ignore_implicit_indices=false);
 		static int  can_move_adjacent(exptree::iterator prod, 
 												exptree::sibling_iterator one, exptree::sibling_iterator two) ;
+
+		/// Sort the children of a sum or product node, using the same ordering as
+		/// should_swap. When 'track_sign' is set the children are treated as factors,
+		/// and the sign of the permutation is determined with can_swap on every pair
+		/// that gets exchanged; that sign is returned. Children which commute with all
+		/// others are put in order with a stable merge sort. Factors which do not commute
+		/// with some other factor, and children with a SortOrder property, are sorted
+		/// among themselves by adjacent exchanges, as a bubble sort would do; the
+		/// merge-sorted children are then merged in between them.
+		static int  sort_children(exptree& tr, exptree::iterator parent, bool track_sign, bool& modified,
+										  int mod_prel=-2, int compare_multiplier=-2, bool literal_wildcards=false);
+
+	private:
+		/// Per-child information which does not depend on the object it is compared with,
+		/// computed once before sorting.
+		class sort_key {
+			public:
+				exptree::sibling_iterator it;
+				const SortOrder          *so;
+				int                       num;
+				size_t                    pos; // position before sorting
+		};
+		typedef std::vector<sort_key> sort_keys_t;
+
+		static bool should_swap(const sort_key&, const sort_key&, int subtree_comparison);
+		static int  merge_sort(sort_keys_t&, sort_keys_t& buffer, size_t from, size_t to, bool track_sign, 
+										int mod_prel, int compare_multiplier, bool literal_wildcards);
+		static int  adjacent_sort(sort_keys_t&, bool track_sign, 
+										  int mod_prel, int compare_multiplier, bool literal_wildcards);
+		static void merge_block(const sort_keys_t& free, const sort_keys_t& block, sort_keys_t& result,
+										int mod_prel, int compare_multiplier, bool literal_wildcards);
 };
 
 
@@ -0,0 +1,102 @@
+/*
+
+	Cadabra: a field-theory motivated computer algebra system.
+	Copyright (C) 2001-2011  Kasper Peeters <kasper.peeters@aei.mpg.de>
+
+   This program is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation, either version 3 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Check the framing of cas_session output against a mock program which,
+// like maxima and maple in some configurations, echoes its input and
+// quotes commands in error messages. The mock also remembers a value
+// between statements, to check that every call starts from a reset
+// program, and can be told to ignore the quit command.
+
+#include "modules/convert.hh"
+#include <iostream>
+#include <fstream>
+#include <cassert>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// The converter module expects the globals normally defined in main.cc;
+// these are in test_globals.cc.
+
+const char *mock_script=
+	"#!/bin/sh\n"
+	"value=none; stubborn=no\n"
+	"while IFS= read -r line; do\n"
+	"  printf '%s\\n' \"> $line\"\n"
+	"  case \"$line\" in\n"
+	"    quit*)            [ $stubborn = yes ] || exit 0 ;;\n"
+	"    reset*)           value=none; printf 'reset done\\n' ;;\n"
+	"    *'\"batch_end\"'*) printf '  cadabra_batch_end  \\n' ;;\n"
+	"    bad*)             printf 'Error, (in cadabra_batch_end) invalid input\\n' ;;\n"
+	"    set*)             value=${line#set }; value=${value%;}; printf 'result of %s\\n' \"$line\" ;;\n"
+	"    get*)             printf 'value is %s\\n' \"$value\" ;;\n"
+	"    stubborn*)        stubborn=yes; printf 'result of %s\\n' \"$line\" ;;\n"
+	"    *)                printf 'result of %s\\n' \"$line\" ;;\n"
+	"  esac\n"
+	"done\n";
+
+int main(int, char **)
+	{
+	char name[]="/tmp/cdbmockXXXXXX";
+	int fd=mkstemp(name);
+	assert(fd>=0);
+	close(fd);
+	std::ofstream script(name);
+	script << mock_script;
+	script.close();
+	chmod(name, S_IRWXU);
+
+	cas_session session(name, "init;\n", "reset;\n", 
+							  "printf(\"%s_%s\\n\",\"cadabra\",\"batch_end\");\n", "quit;\n");
+	assert(session.start());
+
+	std::vector<std::string> in, out;
+	in.push_back("one");
+	in.push_back("f(cadabra_batch_end)");
+	in.push_back("bad");
+	in.push_back("set 42");
+	in.push_back("get");
+	assert(session.evaluate(in, out));
+	assert(out.size()==5);
+	assert(out[0].find("result of one;")!=std::string::npos);
+	assert(out[0].find("reset done")==std::string::npos);
+	assert(out[1].find("result of f(cadabra_batch_end);")!=std::string::npos);
+	assert(out[2].find("Error, (in cadabra_batch_end)")!=std::string::npos);
+	assert(out[4].find("value is 42")!=std::string::npos);
+	assert(out[4].find("one")==std::string::npos);
+
+	// A second batch on the same session should neither see leftovers of the
+	// output of the first, nor the value set there.
+	in.clear();
+	in.push_back("get");
+	assert(session.evaluate(in, out));
+	assert(out.size()==1);
+	assert(out[0].find("value is none")!=std::string::npos);
+	assert(out[0].find("42")==std::string::npos);
+
+	// A program which does not quit when asked should not make stop() hang.
+	in.clear();
+	in.push_back("stubborn");
+	assert(session.evaluate(in, out));
+	session.stop();
+	unlink(name);
+	std::cout << "cas_session framing ok" << std::endl;
+	return 0;
+	}
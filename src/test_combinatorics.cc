@@ -22,6 +22,7 @@
 #include "combinatorics.hh"
 #include <iostream>
 #include <vector>
+#include <ctime>
 
 using namespace std;
 
@@ -173,6 +174,77 @@ bool test_val_permute()
 	return true;
 	}
 
+bool test_sign_tracking()
+	{
+	// The signs computed while generating should agree with a direct
+	// computation using ordersign.
+	combinations<string> cm;
+	cm.original.push_back("a");
+	cm.original.push_back("b");
+	cm.original.push_back("c");
+	cm.original.push_back("d");
+	cm.original.push_back("e");
+	cm.set_unit_sublengths();
+	cm.permute();
+	for(unsigned int i=0; i<cm.size(); ++i) 
+		assert(cm.ordersign(i)==ordersign(cm[0].begin(), cm[0].end(), cm[i].begin(), cm[i].end()));
+	cout << cm.size() << " signs checked" << endl;
+	return true;
+	}
+
+class counter : public combinations_visitor<unsigned int> {
+	public:
+		counter(unsigned int stop_after=0) : total_sign(0), stop_after_(stop_after) {};
+
+		long total_sign;
+	protected:
+		virtual bool visit(const std::vector<unsigned int>&, int sign) 
+			{
+			total_sign+=sign;
+			return stop_after_==0 || size()<stop_after_;
+			}
+	private:
+		unsigned int stop_after_;
+};
+
+bool test_visitor_throughput()
+	{
+	const unsigned int n=9;
+
+	std::clock_t start=std::clock();
+	combinations<unsigned int> stored;
+	for(unsigned int i=0; i<n; ++i)
+		stored.original.push_back(i);
+	stored.set_unit_sublengths();
+	stored.permute();
+	long stored_sign=0;
+	for(unsigned int i=0; i<stored.size(); ++i)
+		stored_sign+=stored.ordersign(i);
+	double stored_time=double(std::clock()-start)/CLOCKS_PER_SEC;
+
+	start=std::clock();
+	counter cnt;
+	for(unsigned int i=0; i<n; ++i)
+		cnt.original.push_back(i);
+	cnt.set_unit_sublengths();
+	cnt.permute();
+	double visitor_time=double(std::clock()-start)/CLOCKS_PER_SEC;
+
+	assert(stored.size()==cnt.size());
+	assert(stored_sign==cnt.total_sign);
+	cout << cnt.size() << " permutations of " << n << " elements: stored " 
+		  << stored_time << "s, visitor " << visitor_time << "s" << endl;
+
+	counter early(10);
+	for(unsigned int i=0; i<n; ++i)
+		early.original.push_back(i);
+	early.set_unit_sublengths();
+	early.permute();
+	assert(early.size()==10);
+	cout << "visitor stopped after " << early.size() << " permutations" << endl;
+	return true;
+	}
+
 bool test_sym_asym()
 	{
 	symmetriser<string> sm;
@@ -192,6 +264,10 @@ int main(int, char **)
 	test_input_asym();
 	cout << endl << "non-unit block length test:" << endl;
 	test_non_unit_block_length();
+	cout << endl << "sign tracking test:" << endl;
+	test_sign_tracking();
+	cout << endl << "visitor throughput test:" << endl;
+	test_visitor_throughput();
 	cout << endl << "symmetriser test:" << endl;
 	test_symmetriser();
 	cout << endl << "val permute test:" << endl;
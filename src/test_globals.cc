@@ -0,0 +1,47 @@
+/*
+
+	Cadabra: a field-theory motivated computer algebra system.
+	Copyright (C) 2001-2011  Kasper Peeters <kasper.peeters@aei.mpg.de>
+
+   This program is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation, either version 3 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// The globals normally defined in main.cc, for test programs which link
+// against the algorithm and module code but have their own main().
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <modglue/pipe.hh>
+
+modglue::ipipe commands("stdin");
+modglue::opipe raw_txtout("stdout");
+modglue::opipe texout("stderr");
+std::ofstream  debugout;
+std::ofstream  nullout("/dev/null",std::ios::app);
+
+std::ostream  *real_txtout=&std::cout;
+thread_local std::ostream  *fake_txtout=&std::cout;
+std::ostream  *real_forcedout=&std::cout;
+thread_local std::ostream  *fake_forcedout=&std::cout;
+
+bool           interrupted=false;
+unsigned int   size_x, size_y;
+bool           loginput=false;
+bool           nowarnings=false;
+bool           silentfail=false;
+
+std::vector<std::string> cmdline_arguments;
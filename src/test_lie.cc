@@ -41,8 +41,6 @@ int main(int, char **)
 	{
 	LiE_t lie;
 
-	lie.start();
-
 	LiE_t::rep_t r1;
 	r1.multiplicity=1;
 	r1.weight.push_back(1);
@@ -87,7 +85,50 @@ int main(int, char **)
 				 << lie.dim(res3) << std::endl;
 	assert(lie.dim(res3)==770);
 
-	lie.stop();
+	// Two Weyl spinors of SO(10): 16 x 16 = 10 + 120 + 126.
+	LiE_t::rep_t sp;
+	sp.weight.resize(5, 0);
+	sp.weight[4]=1;
+	std::vector<LiE_t::rep_t> sps, res4;
+	sps.push_back(sp);
+	lie.tensor(sps, sps, res4);
+	print_reps(res4);
+	std::cout << std::endl;
+	assert(res4.size()==3 && lie.dim(res4)==256);
+	assert(res4[0].weight[4]==2 && res4[1].weight[2]==1 && res4[2].weight[0]==1);
+
+	// Antisymmetric square of the vector of SO(7) is the adjoint.
+	LiE_t lieb(LiE_t::alg_B, 3);
+	LiE_t::rep_t v7;
+	v7.weight.resize(3, 0);
+	v7.weight[0]=1;
+	std::vector<LiE_t::rep_t> v7s, res5;
+	v7s.push_back(v7);
+	lieb.alt_tensor(2, v7s, res5);
+	print_reps(res5);
+	std::cout << std::endl;
+	assert(res5.size()==1 && res5[0].weight[1]==1 && lieb.dim(res5)==21);
+
+	// D2 is A1A1; the vector is [1,1].
+	LiE_t lied(LiE_t::alg_D, 2);
+	std::vector<LiE_t::rep_t> res6;
+	lied.plethysm(std::vector<unsigned int>(1, 2), res6, false);
+	print_reps(res6);
+	std::cout << std::endl;
+	assert(lied.dim(res6)==10 && lied.multiplicity_of_singlet(res6)==1);
+
+	// Quark and antiquark of SU(3).
+	LiE_t liea(LiE_t::alg_A, 2);
+	LiE_t::rep_t q, qb;
+	q.weight.push_back(1);
+	q.weight.push_back(0);
+	qb.weight.push_back(0);
+	qb.weight.push_back(1);
+	std::vector<LiE_t::rep_t> qs(1, q), qbs(1, qb), res7;
+	liea.tensor(qs, qbs, res7);
+	print_reps(res7);
+	std::cout << std::endl;
+	assert(liea.dim(res7)==9 && liea.multiplicity_of_singlet(res7)==1);
 
 	return 0;
 	}
@@ -0,0 +1,98 @@
+/*
+
+	Cadabra: a field-theory motivated computer algebra system.
+	Copyright (C) 2001-2011  Kasper Peeters <kasper.peeters@aei.mpg.de>
+
+   This program is free software: you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation, either version 3 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Parse throughput: feed large generated expressions through the parser,
+// once via the preprocessor and once via the one-pass parser, time both
+// and check that the resulting trees are identical.
+//
+// Usage: test_parse_throughput [number of terms]
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <stdlib.h>
+#include "parser.hh"
+#include "stopwatch.hh"
+
+// The parser needs the property and algorithm code, which in turn
+// expect the globals normally defined in main.cc; these are in test_globals.cc.
+
+std::string generate(unsigned int terms)
+	{
+	static const char *idx[]={ "m", "n", "p", "q", "r", "s" };
+	std::ostringstream str;
+	str << "ex:= ";
+	srandom(42);
+	for(unsigned int i=0; i<terms; ++i) {
+		const char *i1=idx[random()%6], *i2=idx[random()%6], *i3=idx[random()%6];
+		if(i>0) str << (random()%3==0?" - ":" + ");
+		str << random()%9+1 << "/3 A_{" << i1 << " " << i2 << "} B^{" << i2 << "} "
+			 << "\\partial_{" << i1 << "}{C_{" << i3 << " r}} (x + y**2)";
+		}
+	return str.str();
+	}
+
+bool same_tree(const exptree& t1, const exptree& t2)
+	{
+	exptree::iterator it1=t1.begin(), it2=t2.begin();
+	while(it1!=t1.end() && it2!=t2.end()) {
+		if(*it1->name!=*it2->name || *it1->multiplier!=*it2->multiplier
+			|| it1->fl.bracket!=it2->fl.bracket || it1->fl.parent_rel!=it2->fl.parent_rel
+			|| t1.depth(it1)!=t2.depth(it2))
+			return false;
+		++it1; ++it2;
+		}
+	return it1==t1.end() && it2==t2.end();
+	}
+
+void time_parse(const std::string& input, bool direct, parser& pa)
+	{
+	stopwatch sw;
+	std::istringstream str(input);
+	sw.start();
+	str >> pa;
+	sw.stop();
+	std::cout << (direct?"one-pass    : ":"preprocessor: ") << sw << std::endl;
+	}
+
+int main(int argc, char **argv)
+	{
+	unsigned int terms=(argc>1)?atoi(argv[1]):5000;
+
+	std::string input=generate(terms);
+	std::cout << terms << " terms, " << input.size() << " characters" << std::endl;
+
+	parser old_pa(true, false), new_pa(true, true);
+	try {
+		time_parse(input, false, old_pa);
+		time_parse(input, true,  new_pa);
+		}
+	catch(std::exception& ex) {
+		std::cerr << ex.what() << std::endl;
+		exit(1);
+		}
+
+	if(same_tree(old_pa.tree, new_pa.tree)) {
+		std::cout << "trees are identical" << std::endl;
+		return 0;
+		}
+	std::cout << "trees are NOT identical" << std::endl;
+	return 1;
+	}
@@ -20,6 +20,7 @@
 
 #include "youngtab.hh"
 #include <iostream>
+#include <cassert>
 
 using namespace yngtab;
 using namespace combin;
@@ -260,6 +261,55 @@ void tst3()
 	print(sym);
 	}
 
+// Compare the counted Littlewood-Richardson coefficients with the
+// multiplicities of the explicitly constructed product tableaux.
+
+void test_LR_coefficients()
+	{
+	std::vector<partition_t> shapes;
+	unsigned int rows[][4] = { {1,0,0,0}, {2,0,0,0}, {1,1,0,0}, {2,1,0,0}, {2,2,0,0}, 
+										{3,2,1,0}, {3,1,1,0}, {2,2,1,1}, {4,2,0,0} };
+	for(unsigned int i=0; i<sizeof(rows)/sizeof(rows[0]); ++i) {
+		partition_t shp;
+		for(unsigned int r=0; r<4 && rows[i][r]>0; ++r)
+			shp.push_back(rows[i][r]);
+		shapes.push_back(shp);
+		}
+
+	for(unsigned int i=0; i<shapes.size(); ++i) {
+		for(unsigned int j=0; j<shapes.size(); ++j) {
+			tableau one, two;
+			for(unsigned int r=0; r<shapes[i].size(); ++r) one.add_row(shapes[i][r]);
+			for(unsigned int r=0; r<shapes[j].size(); ++r) two.add_row(shapes[j][r]);
+			tableaux<tableau> prod;
+			LR_tensor(one, two, 4, prod.get_back_insert_iterator());
+
+			LR_coefficients_t counted;
+			tableaux<tableau>::tableau_container_t::const_iterator it=prod.storage.begin();
+			while(it!=prod.storage.end()) {
+				++counted[shape(*it)];
+				++it;
+				}
+			assert(counted==LR_coefficients(shapes[i], shapes[j], 4));
+			}
+		}
+
+	partition_t sq(2,2), res;
+	res.push_back(3);
+	res.push_back(2);
+	res.push_back(2);
+	res.push_back(1);
+	assert(LR_coefficient(sq, sq, res)==1);
+	partition_t hook, prod;
+	hook.push_back(2);
+	hook.push_back(1);
+	prod.push_back(3);
+	prod.push_back(2);
+	prod.push_back(1);
+	std::cout << "c^{321}_{21,21} = " << LR_coefficient(hook, hook, prod) << std::endl;
+	assert(LR_coefficient(hook, hook, prod)==2);
+	}
+
 int main(int, char **)
 	{
 	tst1();
@@ -279,6 +329,8 @@ int main(int, char **)
 	test_garnir();
 	std::cout << "-----" << std::endl;
 	test_input_asym();
+	std::cout << "-----" << std::endl;
+	test_LR_coefficients();
 	}
 
 
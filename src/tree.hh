@@ -35,6 +35,15 @@
 #include <algorithm>
 #include <cstddef>
 
+/// Hook through which users of a tree can be told that the structure of a tree
+/// is about to change: nodes get added, removed or moved. The default does nothing;
+/// specialise it for a node type to keep caches keyed on node addresses up to date.
+/// Note that changes to the data stored at a node are not reported.
+template<class T>
+class tree_change_observer {
+	public:
+		static void changed() {}
+};
 
 /// A node in the tree, combining links to other nodes as well as the actual data.
 template<class T>
@@ -576,6 +585,7 @@ void tree<T, tree_node_allocator>::head_initialise_()
 template <class T, class tree_node_allocator>
 tree<T,tree_node_allocator>& tree<T, tree_node_allocator>::operator=(const tree<T, tree_node_allocator>& other)
 	{
+	tree_change_observer<T>::changed();
 	if(this != &other)
 		copy_(other);
 	return *this;
@@ -584,6 +594,7 @@ tree<T,tree_node_allocator>& tree<T, tree_node_allocator>::operator=(const tree<
 template <class T, class tree_node_allocator>
 tree<T,tree_node_allocator>& tree<T, tree_node_allocator>::operator=(tree<T, tree_node_allocator>&& x)
 	{
+	tree_change_observer<T>::changed();
 	if(this != &x) {
 		head->next_sibling=x.head->next_sibling;
 		feet->prev_sibling=x.head->prev_sibling;
@@ -626,6 +637,7 @@ void tree<T, tree_node_allocator>::copy_(const tree<T, tree_node_allocator>& oth
 template <class T, class tree_node_allocator>
 void tree<T, tree_node_allocator>::clear()
 	{
+	tree_change_observer<T>::changed();
 	if(head)
 		while(head->next_sibling!=feet)
 			erase(pre_order_iterator(head->next_sibling));
@@ -634,6 +646,7 @@ void tree<T, tree_node_allocator>::clear()
 template<class T, class tree_node_allocator> 
 void tree<T, tree_node_allocator>::erase_children(const iterator_base& it)
 	{
+	tree_change_observer<T>::changed();
 //	std::cout << "erase_children " << it.node << std::endl;
 	if(it.node==0) return;
 
@@ -656,6 +669,7 @@ void tree<T, tree_node_allocator>::erase_children(const iterator_base& it)
 template<class T, class tree_node_allocator> 
 void tree<T, tree_node_allocator>::erase_right_siblings(const iterator_base& it)
 	{
+	tree_change_observer<T>::changed();
 	if(it.node==0) return;
 
 	tree_node *cur=it.node->next_sibling;
@@ -677,6 +691,7 @@ void tree<T, tree_node_allocator>::erase_right_siblings(const iterator_base& it)
 template<class T, class tree_node_allocator> 
 void tree<T, tree_node_allocator>::erase_left_siblings(const iterator_base& it)
 	{
+	tree_change_observer<T>::changed();
 	if(it.node==0) return;
 
 	tree_node *cur=it.node->prev_sibling;
@@ -699,6 +714,7 @@ template<class T, class tree_node_allocator>
 template<class iter>
 iter tree<T, tree_node_allocator>::erase(iter it)
 	{
+	tree_change_observer<T>::changed();
 	tree_node *cur=it.node;
 	assert(cur!=head);
 	iter ret=it;
@@ -941,6 +957,7 @@ template <class T, class tree_node_allocator>
 template <typename iter>
 iter tree<T, tree_node_allocator>::append_child(iter position)
  	{
+	tree_change_observer<T>::changed();
 	assert(position.node!=head);
 	assert(position.node!=feet);
 	assert(position.node);
@@ -968,6 +985,7 @@ template <class T, class tree_node_allocator>
 template <typename iter>
 iter tree<T, tree_node_allocator>::prepend_child(iter position)
  	{
+	tree_change_observer<T>::changed();
 	assert(position.node!=head);
 	assert(position.node!=feet);
 	assert(position.node);
@@ -995,6 +1013,7 @@ template <class T, class tree_node_allocator>
 template <class iter>
 iter tree<T, tree_node_allocator>::append_child(iter position, const T& x)
 	{
+	tree_change_observer<T>::changed();
 	// If your program fails here you probably used 'append_child' to add the top
 	// node to an empty tree. From version 1.45 the top element should be added
 	// using 'insert'. See the documentation for further information, and sorry about
@@ -1026,6 +1045,7 @@ template <class T, class tree_node_allocator>
 template <class iter>
 iter tree<T, tree_node_allocator>::append_child(iter position, T&& x)
 	{
+	tree_change_observer<T>::changed();
 	assert(position.node!=head);
 	assert(position.node!=feet);
 	assert(position.node);
@@ -1054,6 +1074,7 @@ template <class T, class tree_node_allocator>
 template <class iter>
 iter tree<T, tree_node_allocator>::prepend_child(iter position, const T& x)
 	{
+	tree_change_observer<T>::changed();
 	assert(position.node!=head);
 	assert(position.node!=feet);
 	assert(position.node);
@@ -1081,6 +1102,7 @@ template <class T, class tree_node_allocator>
 template <class iter>
 iter tree<T, tree_node_allocator>::prepend_child(iter position, T&& x)
 	{
+	tree_change_observer<T>::changed();
 	assert(position.node!=head);
 	assert(position.node!=feet);
 	assert(position.node);
@@ -1109,6 +1131,7 @@ template <class T, class tree_node_allocator>
 template <class iter>
 iter tree<T, tree_node_allocator>::append_child(iter position, iter other)
 	{
+	tree_change_observer<T>::changed();
 	assert(position.node!=head);
 	assert(position.node!=feet);
 	assert(position.node);
@@ -1121,6 +1144,7 @@ template <class T, class tree_node_allocator>
 template <class iter>
 iter tree<T, tree_node_allocator>::prepend_child(iter position, iter other)
 	{
+	tree_change_observer<T>::changed();
 	assert(position.node!=head);
 	assert(position.node!=feet);
 	assert(position.node);
@@ -1133,6 +1157,7 @@ template <class T, class tree_node_allocator>
 template <class iter>
 iter tree<T, tree_node_allocator>::append_children(iter position, sibling_iterator from, sibling_iterator to)
 	{
+	tree_change_observer<T>::changed();
 	assert(position.node!=head);
 	assert(position.node!=feet);
 	assert(position.node);
@@ -1150,6 +1175,7 @@ template <class T, class tree_node_allocator>
 template <class iter>
 iter tree<T, tree_node_allocator>::prepend_children(iter position, sibling_iterator from, sibling_iterator to)
 	{
+	tree_change_observer<T>::changed();
 	assert(position.node!=head);
 	assert(position.node!=feet);
 	assert(position.node);
@@ -1168,6 +1194,7 @@ iter tree<T, tree_node_allocator>::prepend_children(iter position, sibling_itera
 template <class T, class tree_node_allocator>
 typename tree<T, tree_node_allocator>::pre_order_iterator tree<T, tree_node_allocator>::set_head(const T& x)
 	{
+	tree_change_observer<T>::changed();
 	assert(head->next_sibling==feet);
 	return insert(iterator(feet), x);
 	}
@@ -1175,6 +1202,7 @@ typename tree<T, tree_node_allocator>::pre_order_iterator tree<T, tree_node_allo
 template <class T, class tree_node_allocator>
 typename tree<T, tree_node_allocator>::pre_order_iterator tree<T, tree_node_allocator>::set_head(T&& x)
 	{
+	tree_change_observer<T>::changed();
 	assert(head->next_sibling==feet);
 	return insert(iterator(feet), x);
 	}
@@ -1183,6 +1211,7 @@ template <class T, class tree_node_allocator>
 template <class iter>
 iter tree<T, tree_node_allocator>::insert(iter position, const T& x)
 	{
+	tree_change_observer<T>::changed();
 	if(position.node==0) {
 		position.node=feet; // Backward compatibility: when calling insert on a null node,
 		                    // insert before the feet.
@@ -1213,6 +1242,7 @@ template <class T, class tree_node_allocator>
 template <class iter>
 iter tree<T, tree_node_allocator>::insert(iter position, T&& x)
 	{
+	tree_change_observer<T>::changed();
 	if(position.node==0) {
 		position.node=feet; // Backward compatibility: when calling insert on a null node,
 		                    // insert before the feet.
@@ -1240,6 +1270,7 @@ iter tree<T, tree_node_allocator>::insert(iter position, T&& x)
 template <class T, class tree_node_allocator>
 typename tree<T, tree_node_allocator>::sibling_iterator tree<T, tree_node_allocator>::insert(sibling_iterator position, const T& x)
 	{
+	tree_change_observer<T>::changed();
 	tree_node* tmp = alloc_.allocate(1,0);
 	alloc_.construct(tmp, x);
 //	kp::constructor(&tmp->data, x);
@@ -1271,6 +1302,7 @@ template <class T, class tree_node_allocator>
 template <class iter>
 iter tree<T, tree_node_allocator>::insert_after(iter position, const T& x)
 	{
+	tree_change_observer<T>::changed();
 	tree_node* tmp = alloc_.allocate(1,0);
 	alloc_.construct(tmp, x);
 //	kp::constructor(&tmp->data, x);
@@ -1296,6 +1328,7 @@ template <class T, class tree_node_allocator>
 template <class iter>
 iter tree<T, tree_node_allocator>::insert_after(iter position, T&& x)
 	{
+	tree_change_observer<T>::changed();
 	tree_node* tmp = alloc_.allocate(1,0);
 	alloc_.construct(tmp);
 	std::swap(tmp->data, x); // move semantics
@@ -1322,6 +1355,7 @@ template <class T, class tree_node_allocator>
 template <class iter>
 iter tree<T, tree_node_allocator>::insert_subtree(iter position, const iterator_base& subtree)
 	{
+	tree_change_observer<T>::changed();
 	// insert dummy
 	iter it=insert(position, value_type());
 	// replace dummy with subtree
@@ -1332,6 +1366,7 @@ template <class T, class tree_node_allocator>
 template <class iter>
 iter tree<T, tree_node_allocator>::insert_subtree_after(iter position, const iterator_base& subtree)
 	{
+	tree_change_observer<T>::changed();
 	// insert dummy
 	iter it=insert_after(position, value_type());
 	// replace dummy with subtree
@@ -1352,6 +1387,7 @@ template <class T, class tree_node_allocator>
 template <class iter>
 iter tree<T, tree_node_allocator>::replace(iter position, const T& x)
 	{
+	tree_change_observer<T>::changed();
 //	kp::destructor(&position.node->data);
 //	kp::constructor(&position.node->data, x);
 	position.node->data=x;
@@ -1364,6 +1400,7 @@ template <class T, class tree_node_allocator>
 template <class iter>
 iter tree<T, tree_node_allocator>::replace(iter position, const iterator_base& from)
 	{
+	tree_change_observer<T>::changed();
 	assert(position.node!=head);
 	tree_node *current_from=from.node;
 	tree_node *start_from=from.node;
@@ -1434,6 +1471,7 @@ typename tree<T, tree_node_allocator>::sibling_iterator tree<T, tree_node_alloca
 	sibling_iterator new_begin, 
 	sibling_iterator new_end)
 	{
+	tree_change_observer<T>::changed();
 	tree_node *orig_first=orig_begin.node;
 	tree_node *new_first=new_begin.node;
 	tree_node *orig_last=orig_first;
@@ -1476,6 +1514,7 @@ template <class T, class tree_node_allocator>
 template <typename iter>
 iter tree<T, tree_node_allocator>::flatten(iter position)
 	{
+	tree_change_observer<T>::changed();
 	if(position.node->first_child==0)
 		return position;
 
@@ -1504,6 +1543,7 @@ template <class T, class tree_node_allocator>
 template <typename iter>
 iter tree<T, tree_node_allocator>::reparent(iter position, sibling_iterator begin, sibling_iterator end)
 	{
+	tree_change_observer<T>::changed();
 	tree_node *first=begin.node;
 	tree_node *last=first;
 
@@ -1552,6 +1592,7 @@ iter tree<T, tree_node_allocator>::reparent(iter position, sibling_iterator begi
 template <class T, class tree_node_allocator>
 template <typename iter> iter tree<T, tree_node_allocator>::reparent(iter position, iter from)
 	{
+	tree_change_observer<T>::changed();
 	if(from.node->first_child==0) return position;
 	return reparent(position, from.node->first_child, end(from));
 	}
@@ -1559,6 +1600,7 @@ template <typename iter> iter tree<T, tree_node_allocator>::reparent(iter positi
 template <class T, class tree_node_allocator>
 template <typename iter> iter tree<T, tree_node_allocator>::wrap(iter position, const T& x)
 	{
+	tree_change_observer<T>::changed();
 	assert(position.node!=0);
 	sibling_iterator fr=position, to=position;
 	++to;
@@ -1570,6 +1612,7 @@ template <typename iter> iter tree<T, tree_node_allocator>::wrap(iter position,
 template <class T, class tree_node_allocator>
 template <typename iter> iter tree<T, tree_node_allocator>::wrap(iter from, iter to, const T& x)
 	{
+	tree_change_observer<T>::changed();
 	assert(from.node!=0);
 	iter ret = insert(from, x);
 	reparent(ret, from, to);
@@ -1579,6 +1622,7 @@ template <typename iter> iter tree<T, tree_node_allocator>::wrap(iter from, iter
 template <class T, class tree_node_allocator>
 template <typename iter> iter tree<T, tree_node_allocator>::move_after(iter target, iter source)
    {
+   tree_change_observer<T>::changed();
    tree_node *dst=target.node;
    tree_node *src=source.node;
    assert(dst);
@@ -1608,6 +1652,7 @@ template <typename iter> iter tree<T, tree_node_allocator>::move_after(iter targ
 template <class T, class tree_node_allocator>
 template <typename iter> iter tree<T, tree_node_allocator>::move_before(iter target, iter source)
    {
+   tree_change_observer<T>::changed();
    tree_node *dst=target.node;
    tree_node *src=source.node;
    assert(dst);
@@ -1639,6 +1684,7 @@ template <class T, class tree_node_allocator>
 typename tree<T, tree_node_allocator>::sibling_iterator tree<T, tree_node_allocator>::move_before(sibling_iterator target, 
 																													  sibling_iterator source)
 	{
+	tree_change_observer<T>::changed();
 	tree_node *dst=target.node;
 	tree_node *src=source.node;
 	tree_node *dst_prev_sibling;
@@ -1675,6 +1721,7 @@ typename tree<T, tree_node_allocator>::sibling_iterator tree<T, tree_node_alloca
 template <class T, class tree_node_allocator>
 template <typename iter> iter tree<T, tree_node_allocator>::move_ontop(iter target, iter source)
 	{
+	tree_change_observer<T>::changed();
 	tree_node *dst=target.node;
 	tree_node *src=source.node;
 	assert(dst);
@@ -1715,6 +1762,7 @@ template <typename iter> iter tree<T, tree_node_allocator>::move_ontop(iter targ
 template <class T, class tree_node_allocator>
 tree<T, tree_node_allocator> tree<T, tree_node_allocator>::move_out(iterator source)
 	{
+	tree_change_observer<T>::changed();
 	tree ret;
 
 	// Move source node into the 'ret' tree.
@@ -1739,6 +1787,7 @@ tree<T, tree_node_allocator> tree<T, tree_node_allocator>::move_out(iterator sou
 template <class T, class tree_node_allocator>
 template<typename iter> iter tree<T, tree_node_allocator>::move_in(iter loc, tree& other)
 	{
+	tree_change_observer<T>::changed();
 	if(other.head->next_sibling==other.feet) return loc; // other tree is empty
 
 	tree_node *other_first_head = other.head->next_sibling;
@@ -1771,6 +1820,7 @@ template<typename iter> iter tree<T, tree_node_allocator>::move_in(iter loc, tre
 template <class T, class tree_node_allocator>
 template<typename iter> iter tree<T, tree_node_allocator>::move_in_as_nth_child(iter loc, size_t n, tree& other)
 	{
+	tree_change_observer<T>::changed();
 	if(other.head->next_sibling==other.feet) return loc; // other tree is empty
 
 	tree_node *other_first_head = other.head->next_sibling;
@@ -1832,6 +1882,7 @@ void tree<T, tree_node_allocator>::merge(sibling_iterator to1,   sibling_iterato
 														sibling_iterator from1, sibling_iterator from2,
 														bool duplicate_leaves)
 	{
+	tree_change_observer<T>::changed();
 	sibling_iterator fnd;
 	while(from1!=from2) {
 		if((fnd=std::find(to1, to2, (*from1))) != to2) { // element found
@@ -1854,6 +1905,7 @@ void tree<T, tree_node_allocator>::merge(sibling_iterator to1,   sibling_iterato
 template <class T, class tree_node_allocator>
 void tree<T, tree_node_allocator>::sort(sibling_iterator from, sibling_iterator to, bool deep)
 	{
+	tree_change_observer<T>::changed();
 	std::less<T> comp;
 	sort(from, to, comp, deep);
 	}
@@ -1863,6 +1915,7 @@ template <class StrictWeakOrdering>
 void tree<T, tree_node_allocator>::sort(sibling_iterator from, sibling_iterator to, 
 													 StrictWeakOrdering comp, bool deep)
 	{
+	tree_change_observer<T>::changed();
 	if(from==to) return;
 	// make list of sorted nodes
 	// CHECK: if multiset stores equivalent nodes in the order in which they
@@ -2125,6 +2178,7 @@ unsigned int tree<T, tree_node_allocator>::number_of_siblings(const iterator_bas
 template <class T, class tree_node_allocator>
 void tree<T, tree_node_allocator>::swap(sibling_iterator it)
 	{
+	tree_change_observer<T>::changed();
 	tree_node *nxt=it.node->next_sibling;
 	if(nxt) {
 		if(it.node->prev_sibling)
@@ -2146,6 +2200,7 @@ void tree<T, tree_node_allocator>::swap(sibling_iterator it)
 template <class T, class tree_node_allocator>
 void tree<T, tree_node_allocator>::swap(iterator one, iterator two)
 	{
+	tree_change_observer<T>::changed();
 	// if one and two are adjacent siblings, use the sibling swap
 	if(one.node->next_sibling==two.node) swap(one);
 	else if(two.node->next_sibling==one.node) swap(two);
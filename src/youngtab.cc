@@ -20,9 +20,150 @@
 
 #include "youngtab.hh"
 #include <cassert>
+#include <mutex>
 
 namespace yngtab {
 
+namespace {
+
+std::mutex                      young_mutex;
+std::map<partition_t, yngint_t> hook_products;
+
+typedef std::pair<std::pair<partition_t, partition_t>, unsigned int> LR_key_t;
+std::map<LR_key_t, LR_coefficients_t> LR_cache;
+
+// Enumerates the Littlewood-Richardson fillings of nu/lambda with content mu
+// row by row, counting them per shape nu. Rows of the filling are weakly
+// increasing, columns strictly increasing, and the labels read right to left,
+// top to bottom, form a lattice word.
+
+class LR_counter {
+	public:
+		LR_counter(const partition_t& lambda, const partition_t& mu, unsigned int maxrows, 
+					  LR_coefficients_t& res);
+
+		void row(unsigned int r, unsigned int remaining);
+
+	private:
+		const partition_t&         lambda, mu;
+		const unsigned int         maxrows;
+		LR_coefficients_t&         res;
+
+		partition_t                nu;       // rows done so far
+		std::vector<unsigned int>  used;     // labels used in those rows
+		std::vector<partition_t>   labels;   // labels of the new boxes, per row
+		std::vector<unsigned int>  rowused;  // labels used in the current row
+
+		void fill(unsigned int r, unsigned int pos, unsigned int len, unsigned int minlabel, 
+					 unsigned int remaining);
+		unsigned int lambda_row(unsigned int r) const;
+};
+
+LR_counter::LR_counter(const partition_t& l, const partition_t& m, unsigned int mr, LR_coefficients_t& r)
+	: lambda(l), mu(m), maxrows(mr), res(r), used(m.size(), 0), rowused(m.size(), 0)
+	{
+	}
+
+unsigned int LR_counter::lambda_row(unsigned int r) const
+	{
+	return r<lambda.size()?lambda[r]:0;
+	}
+
+void LR_counter::row(unsigned int r, unsigned int remaining)
+	{
+	if(remaining==0) {
+		partition_t shp(nu);
+		for(unsigned int i=r; i<lambda.size(); ++i)
+			shp.push_back(lambda[i]);
+		if(shp.size()<=maxrows)
+			++res[shp];
+		return;
+		}
+	if(r>=maxrows || r>=lambda.size()+mu.size()) 
+		return;
+
+	const unsigned int lr=lambda_row(r);
+	unsigned int maxlen=lr+remaining;
+	if(r>0) maxlen=std::min(maxlen, nu[r-1]);
+	if(labels.size()<=r) labels.resize(r+1);
+
+	for(unsigned int len=lr; len<=maxlen; ++len) {
+		nu.push_back(len);
+		labels[r].resize(len-lr);
+		fill(r, 0, len-lr, 0, remaining);
+		nu.pop_back();
+		}
+	}
+
+void LR_counter::fill(unsigned int r, unsigned int pos, unsigned int len, unsigned int minlabel, 
+							 unsigned int remaining)
+	{
+	if(pos==len) {
+		for(unsigned int k=0; k<mu.size(); ++k) {
+			used[k]+=rowused[k];
+			rowused[k]=0;
+			}
+		row(r+1, remaining-len);
+		// Restore the counts of this row from its labels.
+		for(unsigned int i=0; i<len; ++i) {
+			--used[labels[r][i]];
+			++rowused[labels[r][i]];
+			}
+		return;
+		}
+
+	// The box above, if it is a new box, has to carry a smaller label.
+	const unsigned int col=lambda_row(r)+pos;
+	if(r>0 && col>=lambda_row(r-1))
+		minlabel=std::max(minlabel, labels[r-1][col-lambda_row(r-1)]+1);
+
+	for(unsigned int k=minlabel; k<mu.size(); ++k) {
+		if(used[k]+rowused[k]>=mu[k]) continue;
+		if(k>0 && used[k]+rowused[k]+1>used[k-1]) continue; // lattice condition
+		labels[r][pos]=k;
+		++rowused[k];
+		fill(r, pos+1, len, k, remaining);
+		--rowused[k];
+		}
+	}
+
+}
+
+partition_t shape(const tableau_base& tab)
+	{
+	partition_t ret(tab.number_of_rows());
+	for(unsigned int r=0; r<ret.size(); ++r)
+		ret[r]=tab.row_size(r);
+	return ret;
+	}
+
+const LR_coefficients_t& LR_coefficients(const partition_t& one, const partition_t& two, 
+													  unsigned int maxrows)
+	{
+	std::lock_guard<std::mutex> lock(young_mutex);
+
+	LR_key_t key(std::make_pair(one, two), maxrows);
+	std::map<LR_key_t, LR_coefficients_t>::iterator it=LR_cache.find(key);
+	if(it!=LR_cache.end())
+		return it->second;
+
+	LR_coefficients_t& res=LR_cache[key];
+	unsigned int boxes=0;
+	for(unsigned int i=0; i<two.size(); ++i)
+		boxes+=two[i];
+	LR_counter counter(one, two, maxrows, res);
+	counter.row(0, boxes);
+	return res;
+	}
+
+unsigned long LR_coefficient(const partition_t& one, const partition_t& two, const partition_t& prod)
+	{
+	const LR_coefficients_t& coeffs=LR_coefficients(one, two, prod.size());
+	LR_coefficients_t::const_iterator it=coeffs.find(prod);
+	if(it==coeffs.end()) return 0;
+	return it->second;
+	}
+
 tableau_base::tableau_base()
 	: multiplicity(1), selfdual_column(0)
 	{
@@ -53,8 +194,9 @@ yngint_t tableau_base::dimension(unsigned int dim) const
 			ret*=(dim++);
 		dim=backup-1;
 		}
-	assert(ret%hook_length_prod()==0);
-	ret/=hook_length_prod();
+	const yngint_t hook=hook_length_prod();
+	assert(ret%hook==0);
+	ret/=hook;
 	return ret;
 	}
 
@@ -79,12 +221,21 @@ unsigned long tableau_base::hook_length(unsigned int row, unsigned int col) cons
 	return hook;
 	}
 
+// Only depends on the shape, so cached by shape.
+
 yngint_t tableau_base::hook_length_prod() const
 	{
+	const partition_t shp=shape(*this);
+	std::lock_guard<std::mutex> lock(young_mutex);
+	std::map<partition_t, yngint_t>::const_iterator it=hook_products.find(shp);
+	if(it!=hook_products.end())
+		return it->second;
+
 	yngint_t hook=1;
 	for(unsigned int i=0; i<number_of_rows(); ++i)
 		for(unsigned int j=0; j<row_size(i); ++j)
 			hook*=hook_length(i,j);
+	hook_products[shp]=hook;
 	return hook;
 	}
 
@@ -32,6 +32,8 @@
 #include <iterator>
 #include <vector>
 #include <list>
+#include <map>
+#include <functional>
 #include <gmpxx.h>
 #include "combinatorics.hh"
 #include <cstddef>
@@ -218,6 +220,21 @@ bool legal_box(const std::vector<std::pair<int,int> >& prev,
 					const std::vector<std::pair<int,int> >& ths, 
 					int colpos, int trypos);
 
+/// Littlewood-Richardson coefficients, counted without building the filled
+/// tableaux (use LR_tensor when the labels of the boxes are needed). Shapes
+/// are given by their row lengths; results are cached.
+
+typedef std::vector<unsigned int>                                        partition_t;
+typedef std::map<partition_t, unsigned long, std::greater<partition_t> > LR_coefficients_t;
+
+partition_t              shape(const tableau_base&);
+/// All shapes with at most 'maxrows' rows in the product of 'one' and 'two', with
+/// their multiplicities, in the order in which LR_tensor generates them.
+const LR_coefficients_t& LR_coefficients(const partition_t& one, const partition_t& two,
+												 unsigned int maxrows);
+unsigned long            LR_coefficient(const partition_t& one, const partition_t& two, 
+												const partition_t& prod);
+
 // --------------------------------------
 
 